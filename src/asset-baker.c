@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "raylib.h"
+
+#include "asset-bundle.h"
+
+
+// Offline tool baking the models, animations and textures of the game into
+// the bundle it maps at startup, so that it never parses a glTF or decodes an
+// image again
+// Usage : ./asset-baker [resourcesDir] [output]
+
+
+bool bakeImage(bundleWriter* writer, const char* name, Image image) {
+    // Pixels in the format the GPU takes without conversion
+    if (image.data == NULL) {
+        return false;
+    }
+    ImageFormat(&image, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+    addBundleImage(writer, name, image);
+    UnloadImage(image);
+    return true;
+}
+
+bool bakeTexture(bundleWriter* writer, const char* name, const char* path) {
+    return bakeImage(writer, name, LoadImage(path));
+}
+
+bool bakeModel(bundleWriter* writer, const char* name, const char* path) {
+    // The model as LoadModel gives it, the textures of its materials read back
+    // from the GPU and baked as images of their own
+    if (!FileExists(path)) {
+        return false;
+    }
+    Model model = LoadModel(path);
+
+    Material defaultMaterial = LoadMaterialDefault();
+    unsigned int defaultTexture = defaultMaterial.maps[MATERIAL_MAP_DIFFUSE].texture.id;
+    UnloadMaterial(defaultMaterial);
+
+    char (*materialTextures)[MAX_BUNDLE_NAME] = calloc(model.materialCount, MAX_BUNDLE_NAME);
+    for (int m = 0; m < model.materialCount; m++) {
+        Texture2D texture = model.materials[m].maps[MATERIAL_MAP_DIFFUSE].texture;
+        if (texture.id == 0 || texture.id == defaultTexture) {
+            continue;
+        }
+        snprintf(materialTextures[m], MAX_BUNDLE_NAME, "%s/material%i", name, m);
+        if (!bakeImage(writer, materialTextures[m], LoadImageFromTexture(texture))) {
+            materialTextures[m][0] = '\0';
+        }
+    }
+
+    addBundleModel(writer, name, model, materialTextures);
+    free(materialTextures);
+    UnloadModel(model);
+    return true;
+}
+
+bool bakeAnimations(bundleWriter* writer, const char* name, const char* path) {
+    if (!FileExists(path)) {
+        return false;
+    }
+    int nbAnimations = 0;
+    ModelAnimation* animations = LoadModelAnimations(path, &nbAnimations);
+    if (animations == NULL || nbAnimations == 0) {
+        return false;
+    }
+    addBundleAnimations(writer, name, animations, nbAnimations);
+    UnloadModelAnimations(animations, nbAnimations);
+    return true;
+}
+
+
+int main(int argc, char** argv) {
+
+    const char* resources = (argc > 1) ? argv[1] : "../resources";
+    const char* output = (argc > 2) ? argv[2] : TextFormat("%s/penguins.bundle", resources);
+    char outputPath[1024];
+    snprintf(outputPath, sizeof(outputPath), "%s", output);
+
+    // Models and textures need a GL context, in a window never shown
+    SetConfigFlags(FLAG_WINDOW_HIDDEN);
+    InitWindow(16, 16, "asset-baker");
+
+    // Same names as the ones render.c looks for
+    char path[1024];
+    bundleWriter* writer = newBundleWriter();
+    bool isBaked = true;
+
+    snprintf(path, sizeof(path), "%s/models/fish/scene.gltf", resources);
+    isBaked = isBaked && bakeModel(writer, "fish/model", path);
+    snprintf(path, sizeof(path), "%s/models/fish/textures/blueFish.png", resources);
+    isBaked = isBaked && bakeTexture(writer, "fish/blue", path);
+    snprintf(path, sizeof(path), "%s/models/fish/textures/purpleFish.png", resources);
+    isBaked = isBaked && bakeTexture(writer, "fish/purple", path);
+    snprintf(path, sizeof(path), "%s/models/fish/textures/magentaFish.png", resources);
+    isBaked = isBaked && bakeTexture(writer, "fish/magenta", path);
+
+    snprintf(path, sizeof(path), "%s/models/penguin/penguinAnims.glb", resources);
+    isBaked = isBaked && bakeModel(writer, "penguin/model", path);
+    isBaked = isBaked && bakeAnimations(writer, "penguin/animations", path);
+    snprintf(path, sizeof(path), "%s/models/penguin/textures/penguin_color.jpg", resources);
+    isBaked = isBaked && bakeTexture(writer, "penguin/color", path);
+
+    snprintf(path, sizeof(path), "%s/models/crocodile/crocoAnims.glb", resources);
+    isBaked = isBaked && bakeModel(writer, "croco/model", path);
+    isBaked = isBaked && bakeAnimations(writer, "croco/animations", path);
+    snprintf(path, sizeof(path), "%s/models/crocodile/textures/croco_color.jpg", resources);
+    isBaked = isBaked && bakeTexture(writer, "croco/color", path);
+
+    CloseWindow();
+
+    if (!isBaked) {
+        fprintf(stderr, "Usage : %s [resourcesDir] [output], some assets are missing from %s\n", argv[0], resources);
+        freeBundleWriter(writer);
+        return 1;
+    }
+    if (!writeAssetBundle(writer, outputPath)) {
+        fprintf(stderr, "Can't write %s\n", outputPath);
+        freeBundleWriter(writer);
+        return 1;
+    }
+    printf("%i assets, %zu bytes, written to %s\n", writer->nbEntries, writer->size, outputPath);
+    freeBundleWriter(writer);
+    return 0;
+}
@@ -0,0 +1,499 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "asset-bundle.h"
+
+// Models, animations and textures baked offline into a single file, mapped in
+// memory by the game : nothing is parsed or decoded at runtime anymore
+//
+// The file starts with a header and a table of entries, then the entries
+// themselves, every piece of them aligned on 8 bytes. Images are raw pixels in
+// the format of the GPU texture, models are the arrays of their meshes as
+// raylib uploads them, animations are the poses of every frame. The layout is
+// the one of the machine which baked the bundle.
+
+
+typedef struct _imageRecord {
+    int32_t width;
+    int32_t height;
+    int32_t mipmaps;
+    int32_t format;
+} imageRecord;
+
+typedef struct _modelRecord {
+    int32_t nbMeshes;
+    int32_t nbMaterials;
+    int32_t nbBones;
+    int32_t reserved;
+    Matrix transform;
+} modelRecord;
+
+typedef struct _materialRecord {
+    Color diffuse;
+    int32_t reserved; // Pads the record to a multiple of 8 bytes
+    char texture[MAX_BUNDLE_NAME]; // Image entry of the diffuse map, empty without
+} materialRecord;
+
+typedef struct _meshRecord {
+    int32_t vertexCount;
+    int32_t triangleCount;
+    uint32_t arrays; // Bit a is set when MESH_ARRAYS[a] follows
+    int32_t reserved;
+} meshRecord;
+
+typedef struct _animationRecord {
+    int32_t nbBones;
+    int32_t nbFrames;
+    char name[32];
+} animationRecord;
+
+typedef struct _bundleCursor {
+    // Next bytes of an entry, NULL once a read went past its end
+    const unsigned char* next;
+    const unsigned char* end;
+} bundleCursor;
+
+// Arrays of a mesh in the bundle, in this order, with the size of a vertex or triangle
+typedef struct _meshArray {
+    size_t offset; // In the Mesh structure
+    size_t elementSize;
+    bool isPerTriangle;
+} meshArray;
+
+#define NB_MESH_ARRAYS 9
+
+static const meshArray MESH_ARRAYS[NB_MESH_ARRAYS] = {
+    {offsetof(Mesh, vertices), 3 * sizeof(float), false},
+    {offsetof(Mesh, texcoords), 2 * sizeof(float), false},
+    {offsetof(Mesh, texcoords2), 2 * sizeof(float), false},
+    {offsetof(Mesh, normals), 3 * sizeof(float), false},
+    {offsetof(Mesh, tangents), 4 * sizeof(float), false},
+    {offsetof(Mesh, colors), 4 * sizeof(unsigned char), false},
+    {offsetof(Mesh, indices), 3 * sizeof(unsigned short), true},
+    {offsetof(Mesh, boneIds), 4 * sizeof(unsigned char), false},
+    {offsetof(Mesh, boneWeights), 4 * sizeof(float), false}
+};
+
+
+////////////////////////////////////////////////////////////////////////////
+// Reading a bundle, any thread but the uploads to the GPU
+
+static void** meshArrayOf(Mesh* mesh, int a) {
+    return (void**) ((char*) mesh + MESH_ARRAYS[a].offset);
+}
+
+static size_t meshArraySize(Mesh* mesh, int a) {
+    return MESH_ARRAYS[a].elementSize * (MESH_ARRAYS[a].isPerTriangle ? mesh->triangleCount : mesh->vertexCount);
+}
+
+static bundleCursor entryCursor(assetBundle* bundle, const bundleEntry* entry) {
+    const unsigned char* start = bundle->data + entry->offset;
+    return (bundleCursor) {.next = start, .end = start + entry->size};
+}
+
+static const void* takeBytes(bundleCursor* cursor, size_t size) {
+    // The next size bytes of the entry and their padding, NULL past its end
+    if (cursor->next == NULL || size > (size_t) (cursor->end - cursor->next)) {
+        cursor->next = NULL;
+        return NULL;
+    }
+    const void* bytes = cursor->next;
+    size_t padded = (size + 7) & ~(size_t) 7;
+    cursor->next += (padded < (size_t) (cursor->end - cursor->next)) ? padded : (size_t) (cursor->end - cursor->next);
+    return bytes;
+}
+
+assetBundle* openAssetBundle(const char* path) {
+    // NULL when the file is missing, truncated or baked by another version
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) < 0 || (size_t) fileStat.st_size < sizeof(bundleHeader)) {
+        close(fd);
+        return NULL;
+    }
+    void* data = mmap(NULL, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+
+    assetBundle* bundle = malloc(sizeof(assetBundle));
+    bundle->data = data;
+    bundle->size = fileStat.st_size;
+    bundle->header = (const bundleHeader*) data;
+    bundle->entries = (const bundleEntry*) (bundle->data + sizeof(bundleHeader));
+
+    bool isValid = memcmp(bundle->header->magic, BUNDLE_MAGIC, 8) == 0 && bundle->header->version == BUNDLE_VERSION
+        && bundle->header->nbEntries <= (bundle->size - sizeof(bundleHeader)) / sizeof(bundleEntry);
+    for (uint32_t i = 0; isValid && i < bundle->header->nbEntries; i++) {
+        const bundleEntry* entry = &bundle->entries[i];
+        isValid = memchr(entry->name, '\0', MAX_BUNDLE_NAME) != NULL && entry->offset % 8 == 0
+            && entry->offset <= bundle->size && entry->size <= bundle->size - entry->offset;
+    }
+    if (!isValid) {
+        closeAssetBundle(bundle);
+        return NULL;
+    }
+    return bundle;
+}
+
+void closeAssetBundle(assetBundle* bundle) {
+    // Textures and models keep their own copies, the mapping can go away
+    if (bundle != NULL) {
+        munmap((void*) bundle->data, bundle->size);
+        free(bundle);
+    }
+}
+
+const bundleEntry* findBundleEntry(assetBundle* bundle, const char* name, bundleKind kind) {
+    for (uint32_t i = 0; i < bundle->header->nbEntries; i++) {
+        if (bundle->entries[i].kind == (uint32_t) kind && strcmp(bundle->entries[i].name, name) == 0) {
+            return &bundle->entries[i];
+        }
+    }
+    return NULL;
+}
+
+void prefaultBundleEntry(assetBundle* bundle, const bundleEntry* entry) {
+    // Reads the pages of an entry ahead, so that the thread using it never waits for the disk
+    const unsigned char* start = bundle->data + entry->offset;
+    madvise((void*) ((uintptr_t) start & ~(uintptr_t) 4095), entry->size + ((uintptr_t) start & 4095), MADV_WILLNEED);
+
+    volatile unsigned char sum = 0;
+    for (uint64_t i = 0; i < entry->size; i += 4096) {
+        sum += start[i];
+    }
+}
+
+bool bundleImage(assetBundle* bundle, const bundleEntry* entry, Image* image) {
+    // The pixels stay in the mapping, the image must not be unloaded
+    bundleCursor cursor = entryCursor(bundle, entry);
+    const imageRecord* record = takeBytes(&cursor, sizeof(imageRecord));
+    if (record == NULL || record->width <= 0 || record->height <= 0) {
+        return false;
+    }
+    int size = GetPixelDataSize(record->width, record->height, record->format);
+    const void* pixels = takeBytes(&cursor, size);
+    if (pixels == NULL) {
+        return false;
+    }
+
+    *image = (Image) {.data = (void*) pixels, .width = record->width, .height = record->height, .mipmaps = 1, .format = record->format};
+    return true;
+}
+
+void freePreparedBundleModel(Model* model) {
+    // Same as UnloadModel, for a model never uploaded
+    for (int m = 0; model->meshes != NULL && m < model->meshCount; m++) {
+        for (int a = 0; a < NB_MESH_ARRAYS; a++) {
+            MemFree(*meshArrayOf(&model->meshes[m], a));
+        }
+        MemFree(model->meshes[m].animVertices);
+        MemFree(model->meshes[m].animNormals);
+    }
+    MemFree(model->meshes);
+    MemFree(model->meshMaterial);
+    MemFree(model->bones);
+    MemFree(model->bindPose);
+    *model = (Model) {0};
+}
+
+bool prepareBundleModel(assetBundle* bundle, const bundleEntry* entry, Model* model) {
+    // Meshes copied out of the mapping, where raylib expects to own them,
+    // materials and GPU buffers are left to uploadBundleModel
+    bundleCursor cursor = entryCursor(bundle, entry);
+    const modelRecord* record = takeBytes(&cursor, sizeof(modelRecord));
+    if (record == NULL || record->nbMeshes < 0 || record->nbMaterials <= 0 || record->nbBones < 0) {
+        return false;
+    }
+
+    *model = (Model) {0};
+    model->transform = record->transform;
+    model->meshCount = record->nbMeshes;
+    model->materialCount = record->nbMaterials;
+    model->boneCount = record->nbBones;
+
+    const int32_t* meshMaterial = takeBytes(&cursor, record->nbMeshes * sizeof(int32_t));
+    takeBytes(&cursor, record->nbMaterials * sizeof(materialRecord));
+    if (meshMaterial == NULL) {
+        return false;
+    }
+    model->meshMaterial = MemAlloc(record->nbMeshes * sizeof(int));
+    model->meshes = MemAlloc(record->nbMeshes * sizeof(Mesh));
+    for (int m = 0; m < record->nbMeshes; m++) {
+        model->meshMaterial[m] = (meshMaterial[m] >= 0 && meshMaterial[m] < record->nbMaterials) ? meshMaterial[m] : 0;
+    }
+
+    for (int m = 0; m < record->nbMeshes; m++) {
+        const meshRecord* meshInfo = takeBytes(&cursor, sizeof(meshRecord));
+        if (meshInfo == NULL || meshInfo->vertexCount < 0 || meshInfo->triangleCount < 0) {
+            freePreparedBundleModel(model);
+            return false;
+        }
+        Mesh* mesh = &model->meshes[m];
+        mesh->vertexCount = meshInfo->vertexCount;
+        mesh->triangleCount = meshInfo->triangleCount;
+
+        for (int a = 0; a < NB_MESH_ARRAYS; a++) {
+            if ((meshInfo->arrays & (1u << a)) == 0) {
+                continue;
+            }
+            size_t size = meshArraySize(mesh, a);
+            const void* array = takeBytes(&cursor, size);
+            if (array == NULL) {
+                freePreparedBundleModel(model);
+                return false;
+            }
+            *meshArrayOf(mesh, a) = MemAlloc(size);
+            memcpy(*meshArrayOf(mesh, a), array, size);
+        }
+
+        // Skinned meshes are animated on the CPU, in copies of their vertices and normals
+        if (mesh->boneIds != NULL && mesh->vertices != NULL) {
+            mesh->animVertices = MemAlloc(3 * mesh->vertexCount * sizeof(float));
+            memcpy(mesh->animVertices, mesh->vertices, 3 * mesh->vertexCount * sizeof(float));
+            if (mesh->normals != NULL) {
+                mesh->animNormals = MemAlloc(3 * mesh->vertexCount * sizeof(float));
+                memcpy(mesh->animNormals, mesh->normals, 3 * mesh->vertexCount * sizeof(float));
+            }
+        }
+    }
+
+    const BoneInfo* bones = takeBytes(&cursor, record->nbBones * sizeof(BoneInfo));
+    const Transform* bindPose = takeBytes(&cursor, record->nbBones * sizeof(Transform));
+    if (bindPose == NULL) {
+        freePreparedBundleModel(model);
+        return false;
+    }
+    if (record->nbBones > 0) {
+        model->bones = MemAlloc(record->nbBones * sizeof(BoneInfo));
+        model->bindPose = MemAlloc(record->nbBones * sizeof(Transform));
+        memcpy(model->bones, bones, record->nbBones * sizeof(BoneInfo));
+        memcpy(model->bindPose, bindPose, record->nbBones * sizeof(Transform));
+    }
+    return true;
+}
+
+ModelAnimation* prepareBundleAnimations(assetBundle* bundle, const bundleEntry* entry, int* nbAnimations) {
+    // Allocated like LoadModelAnimations does, for UnloadModelAnimations
+    bundleCursor cursor = entryCursor(bundle, entry);
+    const int32_t* count = takeBytes(&cursor, sizeof(int32_t));
+    if (count == NULL || *count <= 0) {
+        return NULL;
+    }
+
+    ModelAnimation* animations = MemAlloc(*count * sizeof(ModelAnimation));
+    int nbPrepared = 0;
+    while (nbPrepared < *count) {
+        const animationRecord* record = takeBytes(&cursor, sizeof(animationRecord));
+        if (record == NULL || record->nbBones < 0 || record->nbFrames <= 0) {
+            break;
+        }
+        const BoneInfo* bones = takeBytes(&cursor, record->nbBones * sizeof(BoneInfo));
+        const Transform* poses = takeBytes(&cursor, (size_t) record->nbFrames * record->nbBones * sizeof(Transform));
+        if (poses == NULL) {
+            break;
+        }
+
+        ModelAnimation* animation = &animations[nbPrepared++];
+        animation->boneCount = record->nbBones;
+        animation->frameCount = record->nbFrames;
+        memcpy(animation->name, record->name, sizeof(animation->name));
+        animation->name[sizeof(animation->name) - 1] = '\0';
+        animation->bones = MemAlloc(record->nbBones * sizeof(BoneInfo));
+        memcpy(animation->bones, bones, record->nbBones * sizeof(BoneInfo));
+        animation->framePoses = MemAlloc(record->nbFrames * sizeof(Transform*));
+        for (int f = 0; f < record->nbFrames; f++) {
+            animation->framePoses[f] = MemAlloc(record->nbBones * sizeof(Transform));
+            memcpy(animation->framePoses[f], &poses[f * record->nbBones], record->nbBones * sizeof(Transform));
+        }
+    }
+
+    if (nbPrepared < *count) {
+        UnloadModelAnimations(animations, nbPrepared);
+        return NULL;
+    }
+    *nbAnimations = nbPrepared;
+    return animations;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Uploading to the GPU, from the thread of the window only
+
+Texture2D uploadBundleTexture(assetBundle* bundle, const char* name) {
+    // A texture with a zero id when the bundle has no such image
+    const bundleEntry* entry = findBundleEntry(bundle, name, BUNDLE_IMAGE);
+    Image image;
+    if (entry == NULL || !bundleImage(bundle, entry, &image)) {
+        return (Texture2D) {0};
+    }
+    return LoadTextureFromImage(image);
+}
+
+void uploadBundleModel(assetBundle* bundle, const bundleEntry* entry, Model* model, int replacedMaterial) {
+    // Materials with their textures, then the buffers of the meshes, but for
+    // the texture of the material the game replaces anyway
+    bundleCursor cursor = entryCursor(bundle, entry);
+    takeBytes(&cursor, sizeof(modelRecord));
+    takeBytes(&cursor, model->meshCount * sizeof(int32_t));
+    const materialRecord* materials = takeBytes(&cursor, model->materialCount * sizeof(materialRecord));
+
+    model->materials = MemAlloc(model->materialCount * sizeof(Material));
+    for (int m = 0; m < model->materialCount; m++) {
+        model->materials[m] = LoadMaterialDefault();
+        model->materials[m].maps[MATERIAL_MAP_DIFFUSE].color = materials[m].diffuse;
+        if (materials[m].texture[0] != '\0' && m != replacedMaterial) {
+            Texture2D texture = uploadBundleTexture(bundle, materials[m].texture);
+            if (texture.id != 0) {
+                model->materials[m].maps[MATERIAL_MAP_DIFFUSE].texture = texture;
+            }
+        }
+    }
+
+    for (int m = 0; m < model->meshCount; m++) {
+        UploadMesh(&model->meshes[m], false);
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Writing a bundle, for the asset baker
+
+bundleWriter* newBundleWriter() {
+    bundleWriter* writer = calloc(1, sizeof(bundleWriter));
+    writer->capacity = 1 << 20;
+    writer->blobs = malloc(writer->capacity);
+    return writer;
+}
+
+static void appendBytes(bundleWriter* writer, const void* bytes, size_t size) {
+    // Copied at the end of the blobs, padded to 8 bytes
+    size_t padded = (size + 7) & ~(size_t) 7;
+    while (writer->size + padded > writer->capacity) {
+        writer->capacity *= 2;
+        writer->blobs = realloc(writer->blobs, writer->capacity);
+    }
+    if (size > 0) {
+        memcpy(writer->blobs + writer->size, bytes, size);
+    }
+    memset(writer->blobs + writer->size + size, 0, padded - size);
+    writer->size += padded;
+}
+
+static void addEntry(bundleWriter* writer, const char* name, bundleKind kind, size_t start) {
+    // Entry of the bytes appended since start, offsets are fixed when the bundle is written
+    writer->entries = realloc(writer->entries, (writer->nbEntries + 1) * sizeof(bundleEntry));
+    bundleEntry* entry = &writer->entries[writer->nbEntries++];
+    memset(entry, 0, sizeof(bundleEntry));
+    snprintf(entry->name, MAX_BUNDLE_NAME, "%s", name);
+    entry->kind = kind;
+    entry->offset = start;
+    entry->size = writer->size - start;
+}
+
+void addBundleImage(bundleWriter* writer, const char* name, Image image) {
+    // Only the first level, the game does not use mipmaps
+    size_t start = writer->size;
+    imageRecord record = {.width = image.width, .height = image.height, .mipmaps = 1, .format = image.format};
+    appendBytes(writer, &record, sizeof(record));
+    appendBytes(writer, image.data, GetPixelDataSize(image.width, image.height, image.format));
+    addEntry(writer, name, BUNDLE_IMAGE, start);
+}
+
+void addBundleModel(bundleWriter* writer, const char* name, Model model, char materialTextures[][MAX_BUNDLE_NAME]) {
+    // materialTextures names the image entry of the diffuse map of every material
+    size_t start = writer->size;
+    modelRecord record = {.nbMeshes = model.meshCount, .nbMaterials = model.materialCount, .nbBones = model.boneCount, .transform = model.transform};
+    appendBytes(writer, &record, sizeof(record));
+
+    int32_t* meshMaterial = malloc((model.meshCount + 1) * sizeof(int32_t));
+    for (int m = 0; m < model.meshCount; m++) {
+        meshMaterial[m] = model.meshMaterial[m];
+    }
+    appendBytes(writer, meshMaterial, model.meshCount * sizeof(int32_t));
+    free(meshMaterial);
+
+    for (int m = 0; m < model.materialCount; m++) {
+        materialRecord material = {.diffuse = model.materials[m].maps[MATERIAL_MAP_DIFFUSE].color};
+        snprintf(material.texture, MAX_BUNDLE_NAME, "%s", materialTextures[m]);
+        appendBytes(writer, &material, sizeof(material));
+    }
+
+    for (int m = 0; m < model.meshCount; m++) {
+        Mesh* mesh = &model.meshes[m];
+        meshRecord meshInfo = {.vertexCount = mesh->vertexCount, .triangleCount = mesh->triangleCount, .arrays = 0};
+        for (int a = 0; a < NB_MESH_ARRAYS; a++) {
+            meshInfo.arrays |= (*meshArrayOf(mesh, a) != NULL) ? 1u << a : 0;
+        }
+        appendBytes(writer, &meshInfo, sizeof(meshInfo));
+        for (int a = 0; a < NB_MESH_ARRAYS; a++) {
+            if (*meshArrayOf(mesh, a) != NULL) {
+                appendBytes(writer, *meshArrayOf(mesh, a), meshArraySize(mesh, a));
+            }
+        }
+    }
+
+    appendBytes(writer, model.bones, model.boneCount * sizeof(BoneInfo));
+    appendBytes(writer, model.bindPose, model.boneCount * sizeof(Transform));
+    addEntry(writer, name, BUNDLE_MODEL, start);
+}
+
+void addBundleAnimations(bundleWriter* writer, const char* name, ModelAnimation* animations, int nbAnimations) {
+    size_t start = writer->size;
+    int32_t count = nbAnimations;
+    appendBytes(writer, &count, sizeof(count));
+
+    for (int i = 0; i < nbAnimations; i++) {
+        animationRecord record = {.nbBones = animations[i].boneCount, .nbFrames = animations[i].frameCount};
+        memcpy(record.name, animations[i].name, sizeof(record.name));
+        appendBytes(writer, &record, sizeof(record));
+        appendBytes(writer, animations[i].bones, animations[i].boneCount * sizeof(BoneInfo));
+
+        // All the poses in a row, frame after frame
+        size_t frameSize = animations[i].boneCount * sizeof(Transform);
+        unsigned char* poses = malloc(animations[i].frameCount * frameSize + 1);
+        for (int f = 0; f < animations[i].frameCount; f++) {
+            memcpy(poses + f * frameSize, animations[i].framePoses[f], frameSize);
+        }
+        appendBytes(writer, poses, animations[i].frameCount * frameSize);
+        free(poses);
+    }
+    addEntry(writer, name, BUNDLE_ANIMATIONS, start);
+}
+
+bool writeAssetBundle(bundleWriter* writer, const char* path) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        return false;
+    }
+
+    bundleHeader header = {.version = BUNDLE_VERSION, .nbEntries = writer->nbEntries};
+    memcpy(header.magic, BUNDLE_MAGIC, 8);
+    size_t tableEnd = sizeof(bundleHeader) + writer->nbEntries * sizeof(bundleEntry);
+    for (int i = 0; i < writer->nbEntries; i++) {
+        writer->entries[i].offset += tableEnd;
+    }
+
+    bool isWritten = fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(writer->entries, sizeof(bundleEntry), writer->nbEntries, file) == (size_t) writer->nbEntries
+        && fwrite(writer->blobs, 1, writer->size, file) == writer->size;
+
+    for (int i = 0; i < writer->nbEntries; i++) {
+        writer->entries[i].offset -= tableEnd;
+    }
+    return (fclose(file) == 0) && isWritten;
+}
+
+void freeBundleWriter(bundleWriter* writer) {
+    free(writer->entries);
+    free(writer->blobs);
+    free(writer);
+}
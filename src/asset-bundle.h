@@ -0,0 +1,85 @@
+#ifndef ASSET_BUNDLE_H
+#define ASSET_BUNDLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "raylib.h"
+
+////////////////////////////////////////////////////////////////////////////
+// Asset bundle file
+
+#define BUNDLE_MAGIC "PENGBNDL"
+#define BUNDLE_VERSION 1
+
+// Longest name of an entry, its terminating zero included
+#define MAX_BUNDLE_NAME 48
+
+typedef enum _bundleKind {
+    BUNDLE_IMAGE = 1, // Pixels ready to be uploaded as a texture
+    BUNDLE_MODEL = 2, // Meshes, materials and skeleton
+    BUNDLE_ANIMATIONS = 3
+} bundleKind;
+
+typedef struct _bundleHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t nbEntries;
+} bundleHeader;
+
+typedef struct _bundleEntry {
+    char name[MAX_BUNDLE_NAME];
+    uint32_t kind;
+    uint32_t reserved;
+    uint64_t offset; // From the start of the file, aligned on 8 bytes
+    uint64_t size;
+} bundleEntry;
+
+typedef struct _assetBundle {
+    // The whole file is mapped read only, entries point into it
+    const unsigned char* data;
+    size_t size;
+    const bundleHeader* header;
+    const bundleEntry* entries;
+} assetBundle;
+
+typedef struct _bundleWriter {
+    bundleEntry* entries;
+    int nbEntries;
+    unsigned char* blobs; // Everything after the table of entries
+    size_t size;
+    size_t capacity;
+} bundleWriter;
+
+////////////////////////////////////////////////////////////////////////////
+// Reading a bundle, any thread but the uploads to the GPU
+
+assetBundle* openAssetBundle(const char* path);
+void closeAssetBundle(assetBundle* bundle);
+const bundleEntry* findBundleEntry(assetBundle* bundle, const char* name, bundleKind kind);
+void prefaultBundleEntry(assetBundle* bundle, const bundleEntry* entry);
+bool bundleImage(assetBundle* bundle, const bundleEntry* entry, Image* image);
+bool prepareBundleModel(assetBundle* bundle, const bundleEntry* entry, Model* model);
+void freePreparedBundleModel(Model* model);
+ModelAnimation* prepareBundleAnimations(assetBundle* bundle, const bundleEntry* entry, int* nbAnimations);
+
+////////////////////////////////////////////////////////////////////////////
+// Uploading to the GPU, from the thread of the window only
+
+Texture2D uploadBundleTexture(assetBundle* bundle, const char* name);
+void uploadBundleModel(assetBundle* bundle, const bundleEntry* entry, Model* model, int replacedMaterial);
+
+////////////////////////////////////////////////////////////////////////////
+// Writing a bundle, for the asset baker
+
+bundleWriter* newBundleWriter(void);
+void addBundleImage(bundleWriter* writer, const char* name, Image image);
+void addBundleModel(bundleWriter* writer, const char* name, Model model, char materialTextures[][MAX_BUNDLE_NAME]);
+void addBundleAnimations(bundleWriter* writer, const char* name, ModelAnimation* animations, int nbAnimations);
+bool writeAssetBundle(bundleWriter* writer, const char* path);
+void freeBundleWriter(bundleWriter* writer);
+
+
+#endif
@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "board.h"
+#include "monte-carlo.h"
+
+
+// Benchmark of the search building blocks, on fixed fish layouts
+// Usage : ./bench [nbPlayouts] [nbPairs] [nbIterations]
+
+const char* POLICY_NAMES[2] = {"uniform", "heavy"};
+
+// Number of fish layouts cycled through when timing playouts
+#define NB_LAYOUTS 16
+
+
+double now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+boardState* layout(int seed) {
+    // The fishes and the random games that follow are drawn from the seed
+    srand(seed);
+    seedSearchRandom(seed, 0);
+    boardState* board = freshBoard();
+    initializeBoard(board);
+    return board;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Playout cost
+
+void benchPlayouts(int nbPlayouts) {
+    printf("Playouts from the starting position (%i per policy)\n", nbPlayouts);
+
+    boardState* boards[NB_LAYOUTS];
+    for (int i = 0; i < NB_LAYOUTS; i++) {
+        boards[i] = layout(i + 1);
+    }
+
+    for (int policy = 0; policy < 2; policy++) {
+        PLAYOUT_POLICY = policy;
+        int nbP1Wins = 0;
+        double startTime = now();
+
+        for (int i = 0; i < nbPlayouts; i++) {
+            nbP1Wins += randomGame(boards[i % NB_LAYOUTS], NULL);
+        }
+
+        double elapsed = now() - startTime;
+        printf("  %-8s %9.0f playouts/s  %7.1f us/playout  P1 wins %.3f\n",
+            POLICY_NAMES[policy], nbPlayouts / elapsed, elapsed * 1e6 / nbPlayouts, (float) nbP1Wins / nbPlayouts);
+    }
+    PLAYOUT_POLICY = 0;
+
+    // Same uniform games, PLAYOUT_LANES at a time : the P1 wins should match
+    int nbP1Wins = 0;
+    double startTime = now();
+    for (int first = 0; first < nbPlayouts; first += PLAYOUT_LANES) {
+        int nbLanes = (nbPlayouts - first < PLAYOUT_LANES) ? nbPlayouts - first : PLAYOUT_LANES;
+        nbP1Wins += lockstepRandomGames(boards[(first / PLAYOUT_LANES) % NB_LAYOUTS], nbLanes, first + 1);
+    }
+    double elapsed = now() - startTime;
+    printf("  %-8s %9.0f playouts/s  %7.1f us/playout  P1 wins %.3f\n",
+        "lockstep", nbPlayouts / elapsed, elapsed * 1e6 / nbPlayouts, (float) nbP1Wins / nbPlayouts);
+
+    for (int i = 0; i < NB_LAYOUTS; i++) {
+        freeBoardState(boards[i]);
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Static evaluation cost
+
+void benchEvaluation(int nbEvaluations) {
+    printf("Static evaluations of the starting positions (%i per mode)\n", nbEvaluations);
+
+    boardState* boards[NB_LAYOUTS];
+    for (int i = 0; i < NB_LAYOUTS; i++) {
+        boards[i] = layout(i + 1);
+    }
+    float p1WinProbas[NB_LAYOUTS];
+
+    double startTime = now();
+    for (int i = 0; i < nbEvaluations; i++) {
+        p1WinProbas[i % NB_LAYOUTS] = evaluateBoard(boards[i % NB_LAYOUTS]);
+    }
+    double elapsed = now() - startTime;
+    printf("  %-8s %9.0f evaluations/s\n", "single", nbEvaluations / elapsed);
+
+    startTime = now();
+    for (int i = 0; i < nbEvaluations; i += NB_LAYOUTS) {
+        evaluateBoards(boards, NB_LAYOUTS, p1WinProbas);
+    }
+    elapsed = now() - startTime;
+    printf("  %-8s %9.0f evaluations/s  P1 win proba %.3f\n", "batched", nbEvaluations / elapsed, p1WinProbas[0]);
+
+    for (int i = 0; i < NB_LAYOUTS; i++) {
+        freeBoardState(boards[i]);
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Playout quality
+
+int policyGame(boardState* board, int p1Policy, int p2Policy) {
+    // Both players move with their playout policy, returns the P1 score minus the P2 score
+    boardState* boardCopy = copyBoardState(board);
+    legalMoves* moves = newLegalMoves(boardCopy);
+    int adjacentIce[board->sizeX * board->sizeY];
+    initAdjacentIce(boardCopy, adjacentIce);
+    int consecutivePasses = 0;
+
+    while (consecutivePasses < 2) {
+        int nbMoves = nbLegalMoves(moves, boardCopy->playerToPlay);
+
+        if (nbMoves == 0) {
+            consecutivePasses += 1;
+            boardCopy->playerToPlay = (boardCopy->playerToPlay == 4) ? 5 : 4;
+        } else {
+            consecutivePasses = 0;
+            int policy = (boardCopy->playerToPlay == 4) ? p1Policy : p2Policy;
+            boardMove move;
+            if (policy == 1) {
+                boardMove allMoves[nbMoves];
+                listLegalMoves(moves, boardCopy, allMoves);
+                move = heavyPlayoutMove(boardCopy, allMoves, nbMoves, adjacentIce);
+            } else {
+                move = legalMoveByIndex(moves, boardCopy, rand() % nbMoves);
+            }
+            updateAdjacentIce(boardCopy, adjacentIce, move);
+            playLegalMove(boardCopy, moves, move);
+        }
+    }
+    freeLegalMoves(moves);
+
+    int difference = boardCopy->p1Score - boardCopy->p2Score;
+    freeBoardState(boardCopy);
+    return difference;
+}
+
+void benchQuality(int nbPairs) {
+    // A more realistic policy is also a stronger player
+    printf("Heavy policy playing against the uniform policy (%i pairs of games)\n", nbPairs);
+
+    int wins = 0, draws = 0, losses = 0;
+    for (int pair = 0; pair < nbPairs; pair++) {
+        boardState* board = layout(pair + 1);
+        for (int heavySide = 0; heavySide < 2; heavySide++) {
+            int difference = policyGame(board, heavySide == 0, heavySide == 1);
+            if (heavySide == 1) {
+                difference = -difference;
+            }
+            wins += (difference > 0);
+            draws += (difference == 0);
+            losses += (difference < 0);
+        }
+        freeBoardState(board);
+    }
+
+    printf("  heavy +%i =%i -%i, score %.3f\n", wins, draws, losses, (wins + 0.5 * draws) / (2.0 * nbPairs));
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Search speed
+
+void benchSearch(int nbIterations) {
+    printf("Tree search from the starting position (%i iterations per policy)\n", nbIterations);
+
+    for (int policy = 0; policy < 2; policy++) {
+        PLAYOUT_POLICY = policy;
+        boardState* board = layout(1);
+        double startTime = now();
+
+        mcts* tree = newMCTS(board);
+        mctsSteps(tree, board, nbIterations);
+        boardMove move = bestMove(tree);
+
+        double elapsed = now() - startTime;
+        printf("  %-8s %9.0f iterations/s  best move %i,%i-%i,%i  P1 win ratio %.3f  %.0f bytes/node\n",
+            POLICY_NAMES[policy], nbIterations / elapsed, move.start.x, move.start.y, move.end.x, move.end.y,
+            (float) tree->nbP1Wins / (float) tree->nbVisits, (double) treeMemory(tree) / treeSize(tree));
+
+        freeMCTS(tree);
+        freeBoardState(board);
+    }
+    PLAYOUT_POLICY = 0;
+
+    // Leaves estimated one game at a time then in lockstep, with the default
+    // number of games per leaf and with a full batch of lanes
+    int nbSims = NB_SIMS;
+    int leafGames[2] = {nbSims, PLAYOUT_LANES};
+    for (int games = 0; games < 2; games++) {
+        NB_SIMS = leafGames[games];
+        for (int lockstep = 0; lockstep < 2; lockstep++) {
+            LOCKSTEP_PLAYOUTS = lockstep;
+            boardState* board = layout(1);
+            double startTime = now();
+
+            mcts* tree = newMCTS(board);
+            mctsSteps(tree, board, nbIterations);
+
+            double elapsed = now() - startTime;
+            printf("  %-8s %9.0f iterations/s  %i games per leaf  P1 win ratio %.3f\n",
+                lockstep ? "lockstep" : "uniform", nbIterations / elapsed, NB_SIMS, (float) tree->nbP1Wins / (float) tree->nbVisits);
+
+            freeMCTS(tree);
+            freeBoardState(board);
+        }
+    }
+    LOCKSTEP_PLAYOUTS = 1;
+    NB_SIMS = nbSims;
+}
+
+
+int main(int argc, char** argv) {
+
+    int nbPlayouts = (argc > 1) ? atoi(argv[1]) : 5000;
+    int nbPairs = (argc > 2) ? atoi(argv[2]) : 500;
+    int nbIterations = (argc > 3) ? atoi(argv[3]) : 5000;
+
+    benchPlayouts(nbPlayouts);
+    benchEvaluation(nbPlayouts);
+    benchQuality(nbPairs);
+    benchSearch(nbIterations);
+
+    return 0;
+}
@@ -1,5 +1,7 @@
 #include "board.h"
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdio.h>
 
 // Core implementation of the game
 
@@ -41,41 +43,45 @@ boardMoveL* addMove(boardMoveL* moveL, boardMove move) {
 }
 
 int boardPosLSize(boardPosL* posL) {
-    if (posL == NULL) {
-        return 0;
+    int size = 0;
+    for (; posL != NULL; posL = posL->next) {
+        size++;
     }
-    return 1 + boardPosLSize(posL->next);
+    return size;
 }
 
 int boardMoveLSize(boardMoveL* moveL) {
-    if (moveL == NULL) {
-        return 0;
+    int size = 0;
+    for (; moveL != NULL; moveL = moveL->next) {
+        size++;
     }
-    return 1 + boardMoveLSize(moveL->next);
+    return size;
 }
 
 boardMove getMoveByIndex(boardMoveL* moveL, int i) {
     // Returns the ith element of the move list
 
-    if (moveL == NULL || i < 0) {
-        return (boardMove) {.start=(boardPos){.x=0, .y=0}, .end=(boardPos){.x=0, .y=0}};
+    if (i < 0) {
+        moveL = NULL;
     }
-    if (i == 0) {
-        return moveL->move;
+    for (; moveL != NULL && i > 0; moveL = moveL->next) {
+        i--;
+    }
+    if (moveL == NULL) {
+        return (boardMove) {.start=(boardPos){.x=0, .y=0}, .end=(boardPos){.x=0, .y=0}};
     }
-    return getMoveByIndex(moveL->next, i-1);
+    return moveL->move;
 }
 
 bool posInList(boardPos pos, boardPosL* posL) {
     // Checks if a pos is in a list
 
-    if (posL == NULL) {
-        return false;
-    }
-    if (pos.x == posL->pos.x && pos.y == posL->pos.y) {
-        return true;
+    for (; posL != NULL; posL = posL->next) {
+        if (pos.x == posL->pos.x && pos.y == posL->pos.y) {
+            return true;
+        }
     }
-    return posInList(pos, posL->next);
+    return false;
 }
 
 boardPosL* piecesPosL(boardState* board, int pieceNumber) {
@@ -93,110 +99,232 @@ boardPosL* piecesPosL(boardState* board, int pieceNumber) {
 
 void findAndReplace(boardPosL* posL, boardPos target, boardPos replace) {
     // Searches for the first occurence of a pos in a list and modifies it
-    if (posL != NULL) {
+    for (; posL != NULL; posL = posL->next) {
         if (posL->pos.x == target.x && posL->pos.y == target.y) {
             posL->pos.x = replace.x;
             posL->pos.y = replace.y;
-        } else {
-            findAndReplace(posL->next, target, replace);
+            return;
         }
     }
 }
 
 void freeBoardPosL(boardPosL* posL) {
-    if (posL != NULL) {
-        freeBoardPosL(posL->next);
+    while (posL != NULL) {
+        boardPosL* next = posL->next;
+        free(posL);
+        posL = next;
     }
-    free(posL);
 }
 
 void freeBoardMoveL(boardMoveL* moveL) {
-    if (moveL != NULL) {
-        freeBoardMoveL(moveL->next);
+    while (moveL != NULL) {
+        boardMoveL* next = moveL->next;
+        free(moveL);
+        moveL = next;
     }
-    free(moveL);
 }
 ////////////////////////////////////////////////////////////////////////////
 // Neighbours of a position
 
 boardPosL* addNeighbours(boardPos pos, boardState* board, boardPosL* neighboursL) {
     // Returns the list of all boardPos that can be reached from pos in the board
-    boardPos current;
+    // Every ray is walked until its first tile that is not free ice
+    if (!isTerrain(board, pos)) {
+        return neighboursL;
+    }
 
-    // Lateral tiles
-    current = (boardPos){.x = pos.x, .y = pos.y};
-    while (isTerrain(board, current)) {
-        current.x += 1;
-        current.y += 0;
-        if (isReachable(board, current)) {neighboursL = addPos(neighboursL, current);} else {break;}
+    const int* rayStarts = &board->rays->rayStarts[6 * (pos.x * board->sizeY + pos.y)];
+
+    for (int direction = 0; direction < 6; direction++) {
+        for (int k = rayStarts[direction]; k < rayStarts[direction + 1] && isReachable(board, rayStep(board->rays, k)); k++) {
+            neighboursL = addPos(neighboursL, rayStep(board->rays, k));
+        }
     }
 
-    current = (boardPos){.x = pos.x, .y = pos.y};
-    while (isTerrain(board, current)) {
-        current.x -= 1;
-        current.y += 0;
-        if (isReachable(board, current)) {neighboursL = addPos(neighboursL, current);} else {break;}
+    return neighboursL;
+}
+
+boardPosL* neighbours(boardPos pos, boardState* board) {
+    return addNeighbours(pos, board, NULL);
+}
+
+void adjacentTiles(boardPos pos, boardPos adjacent[6]) {
+    // The six tiles touching a position, every other row is shifted
+    adjacent[0] = (boardPos) {.x = pos.x + 1, .y = pos.y};
+    adjacent[1] = (boardPos) {.x = pos.x - 1, .y = pos.y};
+    adjacent[2] = (boardPos) {.x = pos.x + pos.y%2, .y = pos.y + 1};
+    adjacent[3] = (boardPos) {.x = pos.x + pos.y%2, .y = pos.y - 1};
+    adjacent[4] = (boardPos) {.x = pos.x - 1 + pos.y%2, .y = pos.y + 1};
+    adjacent[5] = (boardPos) {.x = pos.x - 1 + pos.y%2, .y = pos.y - 1};
+}
+
+int adjacentTilesInside(boardState* board, boardPos pos, boardPos adjacent[6]) {
+    // The tiles touching a position without leaving the map, they are the first steps of its rays
+    const int* rayStarts = &board->rays->rayStarts[6 * (pos.x * board->sizeY + pos.y)];
+
+    int nbAdjacent = 0;
+    for (int direction = 0; direction < 6; direction++) {
+        if (rayStarts[direction] < rayStarts[direction + 1]) {
+            adjacent[nbAdjacent++] = rayStep(board->rays, rayStarts[direction]);
+        }
     }
+    return nbAdjacent;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Precomputed rays of the maps
+
+// Every size of map met so far, the tables are kept until the program ends
+static _Atomic(hexRays*) knownRays = NULL;
+
+static int walkRay(int sizeX, int sizeY, boardPos start, int direction, int* stepCells) {
+    // Cells from start to the edge of the map in one direction, only counted without stepCells
+    int nbSteps = 0;
+    boardPos current = start;
+    while (true) {
+        boardPos adjacent[6];
+        adjacentTiles(current, adjacent);
+        current = adjacent[direction];
+        if (current.x < 0 || current.x >= sizeX || current.y < 0 || current.y >= sizeY) {
+            return nbSteps;
+        }
+        if (stepCells != NULL) {
+            stepCells[nbSteps] = current.x * sizeY + current.y;
+        }
+        nbSteps++;
+    }
+}
+
+boardPos rayStep(const hexRays* rays, int step) {
+    return rays->cellPositions[rays->stepCells[step]];
+}
 
-    // Diagonal tiles
-    current = (boardPos){.x = pos.x, .y = pos.y};
-    while (isTerrain(board, current)) {
-        current.x += current.y%2;
-        current.y += 1;
-        if (isReachable(board, current)) {neighboursL = addPos(neighboursL, current);} else {break;}
+static void freeHexRays(hexRays* rays) {
+    free(rays->rayStarts);
+    free(rays->stepCells);
+    free(rays->cellPositions);
+    free(rays);
+}
+
+hexRays* buildHexRays(int sizeX, int sizeY) {
+    // Walks the six directions of adjacentTiles from every cell until the edge of the map,
+    // once to size the tables and once to fill them, NULL if they do not fit in memory
+    int nbCells = sizeX * sizeY;
+
+    hexRays* rays = malloc(sizeof(hexRays));
+    if (rays == NULL) {
+        return NULL;
+    }
+    rays->sizeX = sizeX;
+    rays->sizeY = sizeY;
+    rays->rayStarts = malloc((6 * nbCells + 1) * sizeof(int));
+    rays->stepCells = NULL;
+    rays->cellPositions = malloc(nbCells * sizeof(boardPos));
+    rays->next = NULL;
+    if (rays->rayStarts == NULL || rays->cellPositions == NULL) {
+        freeHexRays(rays);
+        return NULL;
     }
 
-    current = (boardPos){.x = pos.x, .y = pos.y};
-    while (isTerrain(board, current)) {
-        current.x += current.y%2;
-        current.y -= 1;
-        if (isReachable(board, current)) {neighboursL = addPos(neighboursL, current);} else {break;}       
+    int nbSteps = 0;
+    for (int cell = 0; cell < nbCells; cell++) {
+        boardPos start = (boardPos) {.x = cell / sizeY, .y = cell % sizeY};
+        rays->cellPositions[cell] = start;
+        for (int direction = 0; direction < 6; direction++) {
+            rays->rayStarts[6 * cell + direction] = nbSteps;
+            nbSteps += walkRay(sizeX, sizeY, start, direction, NULL);
+        }
     }
+    rays->rayStarts[6 * nbCells] = nbSteps;
 
-    current = (boardPos){.x = pos.x, .y = pos.y};
-    while (isTerrain(board, current)) {
-        current.x -= 1 - current.y%2;
-        current.y += 1;
-        if (isReachable(board, current)) {neighboursL = addPos(neighboursL, current);} else {break;}
+    rays->stepCells = malloc((nbSteps > 0 ? nbSteps : 1) * sizeof(int));
+    if (rays->stepCells == NULL) {
+        freeHexRays(rays);
+        return NULL;
+    }
+    for (int cell = 0; cell < nbCells; cell++) {
+        boardPos start = (boardPos) {.x = cell / sizeY, .y = cell % sizeY};
+        for (int direction = 0; direction < 6; direction++) {
+            walkRay(sizeX, sizeY, start, direction, &rays->stepCells[rays->rayStarts[6 * cell + direction]]);
+        }
     }
 
-    current = (boardPos){.x = pos.x, .y = pos.y};
-    while (isTerrain(board, current)) {
-        current.x -= 1 - current.y%2;
-        current.y -= 1;
-        if (isReachable(board, current)) {neighboursL = addPos(neighboursL, current);} else {break;}
+    return rays;
+}
+
+static const hexRays* findHexRays(hexRays* rays, int sizeX, int sizeY) {
+    for (; rays != NULL; rays = rays->next) {
+        if (rays->sizeX == sizeX && rays->sizeY == sizeY) {
+            return rays;
+        }
     }
-    
-    return neighboursL;
+    return NULL;
 }
 
-boardPosL* neighbours(boardPos pos, boardState* board) {
-    return addNeighbours(pos, board, NULL);
+const hexRays* hexRaysOfSize(int sizeX, int sizeY) {
+    // Tables of a map size, built the first time a board of this size is created
+    // Boards can be created from several threads, the new tables are pushed without locks
+    const hexRays* found = findHexRays(atomic_load(&knownRays), sizeX, sizeY);
+    if (found != NULL) {
+        return found;
+    }
+
+    hexRays* rays = buildHexRays(sizeX, sizeY);
+    if (rays == NULL) {
+        return NULL;
+    }
+    rays->next = atomic_load(&knownRays);
+    while (!atomic_compare_exchange_weak(&knownRays, &rays->next, rays)) {
+        // Another thread may just have pushed the same size
+        found = findHexRays(rays->next, sizeX, sizeY);
+        if (found != NULL) {
+            freeHexRays(rays);
+            return found;
+        }
+    }
+    return rays;
 }
 
 
 ////////////////////////////////////////////////////////////////////////////
 // boardState functions
 
-boardState* freshBoard() {
-    // Fresh empty board allocation
+static boardState* allocateBoard(int sizeX, int sizeY, const hexRays* rays) {
 
-    int** mat = (int**)calloc(ROWS, sizeof(int*));
-    for (int i = 0; i < ROWS; i++) {
-        mat[i] = (int*)calloc(COLUMNS, sizeof(int));
+    int** mat = (int**)calloc(sizeX, sizeof(int*));
+    for (int i = 0; i < sizeX; i++) {
+        mat[i] = (int*)calloc(sizeY, sizeof(int));
     }
 
     boardState* board = (boardState*)malloc(sizeof(boardState));
-    board->sizeX = ROWS;
-    board->sizeY = COLUMNS;
+    board->sizeX = sizeX;
+    board->sizeY = sizeY;
     board->map = mat;
+    board->rays = rays;
     board->playerToPlay = 4;
     board->p1Score = 0;
     board->p2Score = 0;
+    board->p1Pieces = NULL;
+    board->p2Pieces = NULL;
 
     return board;
 }
 
+boardState* emptyBoard(int sizeX, int sizeY) {
+    // Empty board allocation of any size, NULL if the rays of the size cannot be built
+    const hexRays* rays = hexRaysOfSize(sizeX, sizeY);
+    if (rays == NULL) {
+        return NULL;
+    }
+    return allocateBoard(sizeX, sizeY, rays);
+}
+
+boardState* freshBoard() {
+    // Fresh empty board allocation
+    return emptyBoard(ROWS, COLUMNS);
+}
+
 void initializeBoard(boardState* board) {
     // Board initialization with random amount of fishes
 
@@ -230,18 +358,54 @@ void initializeBoard(boardState* board) {
     board->p2Pieces = piecesPosL(board, 5);
 }
 
-boardState* copyBoardState(boardState* board) {
-    // Allocates of copy of a given board
+boardState* loadMap(const char* path) {
+    // Reads a map file : its size, then one value per tile
+    // 0 is water, 1 is ice with a random amount of fishes, 4 and 5 are pieces
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        return NULL;
+    }
 
-    int** mat = (int**)calloc(ROWS, sizeof(int*));
-    for (int i = 0; i < ROWS; i++) {
-        mat[i] = (int*)calloc(COLUMNS, sizeof(int));
+    int sizeX, sizeY;
+    if (fscanf(file, "%d %d", &sizeX, &sizeY) != 2 || sizeX < 3 || sizeY < 3 || sizeX > MAX_MAP_SIZE || sizeY > MAX_MAP_SIZE) {
+        fclose(file);
+        return NULL;
     }
 
-    boardState* boardCopy = (boardState*) malloc(sizeof(boardState));
-    boardCopy->sizeX = ROWS;
-    boardCopy->sizeY = COLUMNS;
-    boardCopy->map = mat;
+    boardState* board = emptyBoard(sizeX, sizeY);
+    if (board == NULL) {
+        fclose(file);
+        return NULL;
+    }
+    bool isValid = true;
+
+    for (int i = 0; i < sizeX && isValid; i++) {
+        for (int j = 0; j < sizeY && isValid; j++) {
+            int tile;
+            isValid = fscanf(file, "%d", &tile) == 1 && (tile == 0 || tile == 1 || tile == 4 || tile == 5);
+            if (isValid && tile == 1) {
+                tile = rand() % 3 + 1;
+            }
+            board->map[i][j] = tile;
+        }
+    }
+    fclose(file);
+
+    if (!isValid) {
+        freeBoardState(board);
+        return NULL;
+    }
+
+    board->p1Pieces = piecesPosL(board, 4);
+    board->p2Pieces = piecesPosL(board, 5);
+
+    return board;
+}
+
+boardState* copyBoardState(boardState* board) {
+    // Allocates of copy of a given board
+
+    boardState* boardCopy = allocateBoard(board->sizeX, board->sizeY, board->rays);
     boardCopy->playerToPlay = board->playerToPlay;
     boardCopy->p1Score = board->p1Score;
     boardCopy->p2Score = board->p2Score;
@@ -259,7 +423,7 @@ boardState* copyBoardState(boardState* board) {
 }
 
 void freeBoardState(boardState* board) {
-    for (int i = 0; i < ROWS; i++) {
+    for (int i = 0; i < board->sizeX; i++) {
         free(board->map[i]);
     }
     free(board->map);
@@ -332,3 +496,149 @@ void movePenguin(boardState* board, boardMove move) {
     }
 }
 
+
+////////////////////////////////////////////////////////////////////////////
+// Legal moves kept up to date
+
+// Direction going back along each of the six rays of adjacentTiles
+const int OPPOSITE_DIRECTIONS[6] = {1, 0, 5, 4, 3, 2};
+
+int rayReach(boardState* board, boardPos pos, int direction) {
+    // Number of free ice tiles in a row from pos in a direction
+    int cell = pos.x * board->sizeY + pos.y;
+    int first = board->rays->rayStarts[6 * cell + direction];
+    int last = board->rays->rayStarts[6 * cell + direction + 1];
+
+    int k = first;
+    while (k < last && isReachable(board, rayStep(board->rays, k))) {
+        k++;
+    }
+    return k - first;
+}
+
+static void updateReaches(boardState* board, legalMoves* moves, int piece) {
+    // Walks again the six rays of a piece that has just arrived on a tile
+    int player = (piece < moves->nbP1Pieces) ? 0 : 1;
+    for (int direction = 0; direction < 6; direction++) {
+        moves->nbMoves[player] -= moves->reaches[piece][direction];
+        moves->reaches[piece][direction] = rayReach(board, moves->pieces[piece], direction);
+        moves->nbMoves[player] += moves->reaches[piece][direction];
+    }
+}
+
+static int pieceIndex(legalMoves* moves, boardPos pos) {
+    for (int i = 0; i < moves->nbPieces; i++) {
+        if (moves->pieces[i].x == pos.x && moves->pieces[i].y == pos.y) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+legalMoves* newLegalMoves(boardState* board) {
+    // Walks all the rays of all the pieces once, moves then only update what they change
+    int nbP1Pieces = boardPosLSize(board->p1Pieces);
+    int nbPieces = nbP1Pieces + boardPosLSize(board->p2Pieces);
+
+    legalMoves* moves = malloc(sizeof(legalMoves));
+    moves->nbPieces = nbPieces;
+    moves->nbP1Pieces = nbP1Pieces;
+    moves->pieces = malloc((nbPieces > 0 ? nbPieces : 1) * sizeof(boardPos));
+    moves->reaches = calloc((nbPieces > 0 ? nbPieces : 1), sizeof(int[6]));
+    moves->nbMoves[0] = 0;
+    moves->nbMoves[1] = 0;
+
+    // Same order of the moves as allPossibleMoves
+    int i = nbP1Pieces;
+    for (boardPosL* posL = board->p1Pieces; posL != NULL; posL = posL->next) {
+        moves->pieces[--i] = posL->pos;
+    }
+    i = nbPieces;
+    for (boardPosL* posL = board->p2Pieces; posL != NULL; posL = posL->next) {
+        moves->pieces[--i] = posL->pos;
+    }
+
+    for (int piece = 0; piece < nbPieces; piece++) {
+        updateReaches(board, moves, piece);
+    }
+
+    return moves;
+}
+
+int nbLegalMoves(legalMoves* moves, int player) {
+    return moves->nbMoves[player - 4];
+}
+
+boardMove legalMoveByIndex(legalMoves* moves, boardState* board, int index) {
+    // The ith move of the player to play, in the order of allPossibleMoves
+    int firstPiece = (board->playerToPlay == 4) ? 0 : moves->nbP1Pieces;
+    int lastPiece = (board->playerToPlay == 4) ? moves->nbP1Pieces : moves->nbPieces;
+
+    for (int piece = firstPiece; piece < lastPiece; piece++) {
+        for (int direction = 0; direction < 6; direction++) {
+            if (index < moves->reaches[piece][direction]) {
+                boardPos start = moves->pieces[piece];
+                int first = board->rays->rayStarts[6 * (start.x * board->sizeY + start.y) + direction];
+                return (boardMove) {.start = start, .end = rayStep(board->rays, first + index)};
+            }
+            index -= moves->reaches[piece][direction];
+        }
+    }
+
+    return (boardMove) {.start=(boardPos){.x=0, .y=0}, .end=(boardPos){.x=0, .y=0}};
+}
+
+int listLegalMoves(legalMoves* moves, boardState* board, boardMove* moveArray) {
+    // Writes all the moves of the player to play, in the order of allPossibleMoves
+    int firstPiece = (board->playerToPlay == 4) ? 0 : moves->nbP1Pieces;
+    int lastPiece = (board->playerToPlay == 4) ? moves->nbP1Pieces : moves->nbPieces;
+
+    int nbMoves = 0;
+    for (int piece = firstPiece; piece < lastPiece; piece++) {
+        boardPos start = moves->pieces[piece];
+        const int* rayStarts = &board->rays->rayStarts[6 * (start.x * board->sizeY + start.y)];
+        for (int direction = 0; direction < 6; direction++) {
+            for (int k = 0; k < moves->reaches[piece][direction]; k++) {
+                moveArray[nbMoves++] = (boardMove) {.start = start, .end = rayStep(board->rays, rayStarts[direction] + k)};
+            }
+        }
+    }
+    return nbMoves;
+}
+
+void playLegalMove(boardState* board, legalMoves* moves, boardMove move) {
+    // Makes a move and updates the moves it changes
+    // The start tile was already blocking every ray through it, only the rays through the end tile change
+    int piece = pieceIndex(moves, move.start);
+
+    movePenguin(board, move);
+    moves->pieces[piece] = move.end;
+    updateReaches(board, moves, piece);
+
+    // Going back along a ray through the end tile, the first tile that is not free ice may be a piece
+    int cell = move.end.x * board->sizeY + move.end.y;
+    for (int direction = 0; direction < 6; direction++) {
+        int first = board->rays->rayStarts[6 * cell + direction];
+        int reach = rayReach(board, move.end, direction);
+        if (first + reach == board->rays->rayStarts[6 * cell + direction + 1]) {
+            continue;
+        }
+
+        boardPos blocking = rayStep(board->rays, first + reach);
+        if (!isTerrain(board, blocking)) {
+            continue;
+        }
+
+        int other = pieceIndex(moves, blocking);
+        int otherDirection = OPPOSITE_DIRECTIONS[direction];
+        int player = (other < moves->nbP1Pieces) ? 0 : 1;
+        moves->nbMoves[player] -= moves->reaches[other][otherDirection] - reach;
+        moves->reaches[other][otherDirection] = reach;
+    }
+}
+
+void freeLegalMoves(legalMoves* moves) {
+    free(moves->pieces);
+    free(moves->reaches);
+    free(moves);
+}
@@ -4,6 +4,9 @@
 #include <stdbool.h>
 #include <stdlib.h>
 
+// Largest width and height of a map, a tile then fits in 16 bits (x << 8 | y)
+#define MAX_MAP_SIZE 256
+
 ////////////////////////////////////////////////////////////////////////////
 // Data structures
 
@@ -27,11 +30,25 @@ typedef struct _boardMoveL {
      struct _boardMoveL* next;
 } boardMoveL;
 
+typedef struct _hexRays {
+    // Cells met walking from every cell in the six directions, up to the map edge
+    // The ray of cell c in direction d is stepCells[rayStarts[6 * c + d]] to stepCells[rayStarts[6 * c + d + 1] - 1]
+    int sizeX;
+    int sizeY;
+
+    int* rayStarts;
+    int* stepCells; // Cell indices x * sizeY + y
+    boardPos* cellPositions; // Position of every cell index, rayStep reads the steps with it
+
+    struct _hexRays* next;
+} hexRays;
+
 typedef struct _boardState {
     int sizeX;
     int sizeY;
 
     int** map;
+    const hexRays* rays; // Shared by all the boards of the same size
 
     int playerToPlay;
     int p1Score;
@@ -42,6 +59,17 @@ typedef struct _boardState {
 } boardState;
 
 
+typedef struct _legalMoves {
+    // Moves of all the pieces, kept up to date as moves are played
+    // P1 pieces come first, each player's pieces are in the reverse order of its list
+    int nbPieces;
+    int nbP1Pieces;
+    boardPos* pieces;
+    int (*reaches)[6]; // Number of free ice tiles in front of each piece in each direction
+    int nbMoves[2];    // Indexed by player - 4
+} legalMoves;
+
+
 ////////////////////////////////////////////////////////////////////////////
 // Types of tiles
 
@@ -70,12 +98,23 @@ void freeBoardMoveL(boardMoveL* moveL);
 
 boardPosL* addNeighbours(boardPos pos, boardState* board, boardPosL* neighboursL);
 boardPosL* neighbours(boardPos pos, boardState* board);
+void adjacentTiles(boardPos pos, boardPos adjacent[6]);
+int adjacentTilesInside(boardState* board, boardPos pos, boardPos adjacent[6]);
+
+////////////////////////////////////////////////////////////////////////////
+// Precomputed rays of the maps
+
+boardPos rayStep(const hexRays* rays, int step);
+hexRays* buildHexRays(int sizeX, int sizeY);
+const hexRays* hexRaysOfSize(int sizeX, int sizeY);
 
 ////////////////////////////////////////////////////////////////////////////
 // boardState functions
 
+boardState* emptyBoard(int sizeX, int sizeY);
 boardState* freshBoard(void);
 void initializeBoard(boardState* board);
+boardState* loadMap(const char* path);
 boardState* copyBoardState(boardState* board);
 void freeBoardState(boardState* board);
 
@@ -87,5 +126,18 @@ boardMoveL* allPossibleMoves(boardState* board);
 bool currentPlayerCanPlay(boardState* board);
 void movePenguin(boardState* board, boardMove move);
 
+////////////////////////////////////////////////////////////////////////////
+// Legal moves kept up to date
+
+extern const int OPPOSITE_DIRECTIONS[6];
+
+int rayReach(boardState* board, boardPos pos, int direction);
+legalMoves* newLegalMoves(boardState* board);
+int nbLegalMoves(legalMoves* moves, int player);
+boardMove legalMoveByIndex(legalMoves* moves, boardState* board, int index);
+int listLegalMoves(legalMoves* moves, boardState* board, boardMove* moveArray);
+void playLegalMove(boardState* board, legalMoves* moves, boardMove move);
+void freeLegalMoves(legalMoves* moves);
+
 
 #endif
\ No newline at end of file
@@ -0,0 +1,150 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "board.h"
+#include "monte-carlo.h"
+#include "opening-book.h"
+
+
+// Offline tool building the opening book consulted by the game
+// Usage : ./book-builder [nbLayouts] [nbPlies] [nbIterations] [output]
+//
+// The fish layouts are the ones drawn with srand(1) to srand(nbLayouts), the
+// positions of each layout are the first plies of the game the search plays
+// against itself
+
+
+typedef struct _bookRecord {
+    uint64_t key;
+    uint16_t start;
+    uint16_t end;
+    uint64_t nbVisits;
+} bookRecord;
+
+int compareBookRecords(const void* a, const void* b) {
+    const bookRecord* recordA = (const bookRecord*) a;
+    const bookRecord* recordB = (const bookRecord*) b;
+
+    if (recordA->key != recordB->key) {
+        return (recordA->key > recordB->key) - (recordA->key < recordB->key);
+    }
+    if (recordA->start != recordB->start) {
+        return recordA->start - recordB->start;
+    }
+    return recordA->end - recordB->end;
+}
+
+
+int main(int argc, char** argv) {
+
+    int nbLayouts = (argc > 1) ? atoi(argv[1]) : 200;
+    int nbPlies = (argc > 2) ? atoi(argv[2]) : 6;
+    int nbIterations = (argc > 3) ? atoi(argv[3]) : 20000;
+    const char* output = (argc > 4) ? argv[4] : "../resources/opening.book";
+
+    if (nbLayouts < 1 || nbPlies < 1 || nbIterations < 1) {
+        fprintf(stderr, "Usage : %s [nbLayouts] [nbPlies] [nbIterations] [output]\n", argv[0]);
+        return 1;
+    }
+
+    size_t nbRecords = 0;
+    size_t capacity = 1024;
+    bookRecord* records = malloc(capacity * sizeof(bookRecord));
+    boardState* board = NULL;
+
+    for (int layout = 0; layout < nbLayouts; layout++) {
+        // Every sample starts from a different fish layout
+        srand(layout + 1);
+        seedSearchRandom(layout + 1, 0);
+        if (board != NULL) {
+            freeBoardState(board);
+        }
+        board = freshBoard();
+        initializeBoard(board);
+
+        for (int ply = 0; ply < nbPlies; ply++) {
+            mcts* tree = newMCTS(board);
+            mctsSteps(tree, board, nbIterations);
+
+            if (tree->nbSons == 0) {
+                freeMCTS(tree);
+                break;
+            }
+
+            // Every son visit count is a vote for its move in this position
+            uint64_t key = bookKey(board);
+            for (int i = 0; i < tree->nbSons; i++) {
+                if (sonNbVisits(tree, i) == 0) {
+                    continue;
+                }
+                if (nbRecords == capacity) {
+                    capacity *= 2;
+                    records = realloc(records, capacity * sizeof(bookRecord));
+                }
+                records[nbRecords++] = (bookRecord) {
+                    .key = key,
+                    .start = cellIndex(board, sonMove(tree, i).start),
+                    .end = cellIndex(board, sonMove(tree, i).end),
+                    .nbVisits = sonNbVisits(tree, i)
+                };
+            }
+
+            boardMove move = bestMove(tree);
+            movePenguin(board, move);
+            freeMCTS(tree);
+        }
+
+        fprintf(stderr, "\rLayout %i/%i, %zu records", layout + 1, nbLayouts, nbRecords);
+    }
+    fprintf(stderr, "\n");
+
+    // Merging the votes of the positions reached more than once
+    qsort(records, nbRecords, sizeof(bookRecord), compareBookRecords);
+
+    size_t nbMerged = 0;
+    for (size_t i = 0; i < nbRecords; i++) {
+        if (nbMerged > 0 && compareBookRecords(&records[nbMerged - 1], &records[i]) == 0) {
+            records[nbMerged - 1].nbVisits += records[i].nbVisits;
+        } else {
+            records[nbMerged++] = records[i];
+        }
+    }
+
+    // Keeping the most visited move of each position
+    uint64_t nbEntries = 0;
+    bookEntry* entries = malloc((nbMerged + 1) * sizeof(bookEntry));
+    size_t bestRecord = 0;
+
+    for (size_t i = 0; i <= nbMerged; i++) {
+        if (i == nbMerged || records[i].key != records[bestRecord].key) {
+            if (nbMerged > 0) {
+                uint64_t nbVisits = records[bestRecord].nbVisits;
+                entries[nbEntries++] = (bookEntry) {
+                    .key = records[bestRecord].key,
+                    .start = records[bestRecord].start,
+                    .end = records[bestRecord].end,
+                    .weight = (nbVisits < UINT32_MAX) ? (uint32_t) nbVisits : UINT32_MAX
+                };
+            }
+            bestRecord = i;
+        } else if (records[i].nbVisits > records[bestRecord].nbVisits) {
+            bestRecord = i;
+        }
+    }
+
+    bool success = writeOpeningBook(output, board, nbLayouts, entries, nbEntries);
+    if (success) {
+        printf("%llu positions written to %s\n", (unsigned long long) nbEntries, output);
+    } else {
+        fprintf(stderr, "Could not write %s\n", output);
+    }
+
+    free(entries);
+    free(records);
+    if (board != NULL) {
+        freeBoardState(board);
+    }
+
+    return success ? 0 : 1;
+}
@@ -0,0 +1,237 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "cluster-link.h"
+#include "protocol.h"
+
+// Links between the coordinator of a cluster and its workers : text lines
+// over a stream socket, TCP between machines or a Unix socket on one box
+//
+// Sockets are non-blocking, a line is only returned once it is whole and
+// a line is always sent whole, waiting for room in the socket if needed
+
+
+////////////////////////////////////////////////////////////////////////////
+// Opening links, to <host>:<port> or to unix:<path>
+
+static int openSocket(const char* address, bool isListening) {
+    // Socket bound to the address or connected to it, -1 on failure
+    if (strncmp(address, "unix:", 5) == 0) {
+        struct sockaddr_un unixAddress = {.sun_family = AF_UNIX};
+        if (strlen(address + 5) >= sizeof(unixAddress.sun_path)) {
+            return -1;
+        }
+        strcpy(unixAddress.sun_path, address + 5);
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) {
+            return -1;
+        }
+        if (isListening) {
+            unlink(unixAddress.sun_path);
+        }
+        int result = isListening ? bind(fd, (struct sockaddr*) &unixAddress, sizeof(unixAddress))
+                                 : connect(fd, (struct sockaddr*) &unixAddress, sizeof(unixAddress));
+        if (result < 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    // <host>:<port>, an empty host being the loopback, 0.0.0.0 or :: to listen on every interface
+    const char* colon = strrchr(address, ':');
+    if (colon == NULL || colon - address >= 256) {
+        return -1;
+    }
+    char host[256];
+    memcpy(host, address, colon - address);
+    host[colon - address] = '\0';
+
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    struct addrinfo* results;
+    if (getaddrinfo((host[0] != '\0') ? host : NULL, colon + 1, &hints, &results) != 0) {
+        return -1;
+    }
+
+    int fd = -1;
+    for (struct addrinfo* result = results; result != NULL && fd < 0; result = result->ai_next) {
+        fd = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        int yes = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        if ((isListening ? bind(fd, result->ai_addr, result->ai_addrlen) : connect(fd, result->ai_addr, result->ai_addrlen)) < 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(results);
+    return fd;
+}
+
+static void initLink(clusterLink* link, int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    link->socket = fd;
+    link->buffer = malloc(MAX_LINK_LINE);
+    link->length = 0;
+}
+
+int listenLinks(const char* address) {
+    // Listening socket, non-blocking, -1 on failure
+    int fd = openSocket(address, true);
+    if (fd >= 0 && listen(fd, 64) < 0) {
+        close(fd);
+        fd = -1;
+    }
+    if (fd >= 0) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+    return fd;
+}
+
+bool acceptLink(int listeningSocket, clusterLink* link) {
+    // False when nobody is waiting to connect
+    int fd = accept(listeningSocket, NULL, NULL);
+    if (fd < 0) {
+        return false;
+    }
+    initLink(link, fd);
+    return true;
+}
+
+bool connectLink(const char* address, clusterLink* link) {
+    int fd = openSocket(address, false);
+    if (fd < 0) {
+        return false;
+    }
+    initLink(link, fd);
+    return true;
+}
+
+void closeLink(clusterLink* link) {
+    if (link->socket >= 0) {
+        close(link->socket);
+        free(link->buffer);
+        link->socket = -1;
+        link->buffer = NULL;
+    }
+}
+
+void closeListener(int listeningSocket, const char* address) {
+    close(listeningSocket);
+    if (strncmp(address, "unix:", 5) == 0) {
+        unlink(address + 5);
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Exchanging lines
+
+bool sendLine(clusterLink* link, const char* format, ...) {
+    // The line and its line feed, false once the link is broken, the link
+    // being closed when the peer takes nothing for SEND_TIMEOUT seconds
+    if (link->socket < 0) {
+        return false;
+    }
+
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    if (length < 0 || length + 1 >= MAX_LINK_LINE) {
+        return false;
+    }
+
+    char* line = malloc(length + 2);
+    va_start(args, format);
+    vsnprintf(line, length + 1, format, args);
+    va_end(args);
+    line[length++] = '\n';
+
+    int sent = 0;
+    double deadline = now() + SEND_TIMEOUT;
+    while (sent < length) {
+        ssize_t written = send(link->socket, line + sent, length - sent, MSG_NOSIGNAL);
+        if (written >= 0) {
+            sent += written;
+            deadline = now() + SEND_TIMEOUT;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            double remaining = deadline - now();
+            if (remaining <= 0) {
+                closeLink(link);
+                break;
+            }
+            struct pollfd pollFd = {.fd = link->socket, .events = POLLOUT};
+            poll(&pollFd, 1, (int) (remaining * 1000) + 1);
+        } else if (errno != EINTR) {
+            break;
+        }
+    }
+
+    free(line);
+    return sent == length;
+}
+
+static int takeLine(clusterLink* link, char* line, size_t size) {
+    // Moves the first buffered line to line, without its line feed, 0 without a whole line
+    char* end = memchr(link->buffer, '\n', link->length);
+    if (end == NULL) {
+        return 0;
+    }
+    int lineLength = end - link->buffer;
+    int copied = ((size_t) lineLength < size) ? lineLength : (int) size - 1;
+    memcpy(line, link->buffer, copied);
+    line[copied] = '\0';
+
+    link->length -= lineLength + 1;
+    memmove(link->buffer, end + 1, link->length);
+    return 1;
+}
+
+int readLine(clusterLink* link, char* line, size_t size, double timeout) {
+    // Next line within timeout seconds (0 does not wait, a negative timeout waits forever)
+    // Returns 1 with a line, 0 without one, -1 once the link is closed
+    if (link->socket < 0) {
+        return -1;
+    }
+    double deadline = now() + timeout;
+
+    while (true) {
+        if (takeLine(link, line, size)) {
+            return 1;
+        }
+        if (link->length == MAX_LINK_LINE) {
+            // A line too long for the buffer breaks the link
+            closeLink(link);
+            return -1;
+        }
+
+        ssize_t received = recv(link->socket, link->buffer + link->length, MAX_LINK_LINE - link->length, 0);
+        if (received > 0) {
+            link->length += received;
+            continue;
+        }
+        if (received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            closeLink(link);
+            return -1;
+        }
+
+        double remaining = deadline - now();
+        if (timeout >= 0 && remaining <= 0) {
+            return 0;
+        }
+        struct pollfd pollFd = {.fd = link->socket, .events = POLLIN};
+        poll(&pollFd, 1, (timeout < 0) ? -1 : (int) (remaining * 1000) + 1);
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef CLUSTER_LINK_H
+#define CLUSTER_LINK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+////////////////////////////////////////////////////////////////////////////
+// Line-based links between the processes of a cluster
+
+// Longest line carried by a link, enough for a position of the largest maps
+#define MAX_LINK_LINE (1 << 18)
+
+// Time a peer has to take a line before its link is given up
+#define SEND_TIMEOUT 5.0
+
+typedef struct _clusterLink {
+    int socket; // -1 once closed
+    char* buffer; // Received bytes not returned yet, MAX_LINK_LINE of them at most
+    int length;
+} clusterLink;
+
+////////////////////////////////////////////////////////////////////////////
+// Opening links, to <host>:<port> or to unix:<path>
+
+int listenLinks(const char* address);
+bool acceptLink(int listeningSocket, clusterLink* link);
+bool connectLink(const char* address, clusterLink* link);
+void closeLink(clusterLink* link);
+void closeListener(int listeningSocket, const char* address);
+
+////////////////////////////////////////////////////////////////////////////
+// Exchanging lines
+
+bool sendLine(clusterLink* link, const char* format, ...);
+int readLine(clusterLink* link, char* line, size_t size, double timeout);
+
+
+#endif
@@ -0,0 +1,857 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "board.h"
+#include "cluster-link.h"
+#include "monte-carlo.h"
+#include "protocol.h"
+
+
+// Root parallel search spread over worker processes, on one machine or several
+// Usage : ./penguins-cluster coordinator <address> [nbLocalWorkers]
+//         ./penguins-cluster worker <address>
+// The address is <host>:<port> or unix:<path>. An empty host is the loopback,
+// workers of other machines need a host such as 0.0.0.0, and the links have
+// no authentication : they are meant for a trusted network
+//
+// The coordinator speaks the protocol of penguins-engine on stdin/stdout :
+// penguins, isready, setoption, newgame, map, position, moves, go, stop, print
+// and quit. It starts nbLocalWorkers workers itself, and other workers may join
+// from any machine until the next search.
+//
+// Every worker grows its own tree from the root, and reports the statistics of
+// the root sons MERGE_PERIOD times a second. The coordinator sums them by move
+// for its info lines, and plays the move with the most visits over all workers.
+// When no worker reports anything, the coordinator runs the search itself.
+//
+// Messages from the coordinator to a worker :
+//   setoption <name> <value>   search parameters, see FORWARDED_OPTIONS
+//   position <player> <p1Score> <p2Score> <sizeX> <sizeY> <tiles...>
+//   go <iterations> <seed> <stream>
+//                              search with its own random stream, -1 iterations
+//                              search until stop
+//   stop
+//   quit                       also stops a search
+// Other messages received during a search are followed once it is over.
+// Messages from a worker to the coordinator :
+//   stats <iterations> <visits> <p1Wins> <nbSons> [<move> <visits> <p1Wins>]...
+//                              the MAX_ROOT_SONS most visited sons at most
+//   done ...                   the same fields, once the search is over, all
+//                              zero when the worker has no valid position
+//   error <message>            a message the worker could not follow
+
+extern char** environ;
+
+// Delay between two info lines during a search
+const double INFO_PERIOD = 0.2;
+
+// Delay between two root statistics reports of a worker
+const double MERGE_PERIOD = 0.1;
+
+// Time given to the local workers to connect at startup
+const double JOIN_TIME = 5.0;
+
+// Time the workers have to answer a stop, the ones still searching after it are dropped
+const double STOP_TIME = 2.0;
+
+// Options passed to the workers, the other ones are refused
+const char* FORWARDED_OPTIONS[8] = {"exploration", "sims", "widening", "prior", "rave", "playouts", "evaluation", "batch"};
+
+#define MAX_CLUSTER_WORKERS 64
+
+// Root sons in a report, the most visited ones, so that a report always fits
+// in a line
+#define MAX_ROOT_SONS 256
+
+// Messages a worker keeps for after its search, more are answered with an error
+#define MAX_QUEUED_LINES 16
+
+
+typedef struct _rootStats {
+    long long iterations;
+    int nbVisits;
+    int nbP1Wins;
+    int nbSons;
+    boardMove sonMoves[MAX_ROOT_SONS];
+    int sonVisits[MAX_ROOT_SONS];
+    int sonP1Wins[MAX_ROOT_SONS];
+} rootStats;
+
+typedef struct _sonVisits {
+    int nbVisits;
+    int sonIndex;
+} sonVisits;
+
+typedef struct _lineQueue {
+    // Messages received by a worker during a search
+    char* lines[MAX_QUEUED_LINES];
+    int nbLines;
+} lineQueue;
+
+typedef struct _workerLink {
+    clusterLink link;
+    rootStats stats; // Latest report of the current search
+    bool isSearching;
+} workerLink;
+
+typedef struct _coordinatorState {
+    boardState* board;
+
+    int listeningSocket;
+    workerLink workers[MAX_CLUSTER_WORKERS];
+    int nbWorkers;
+    pid_t localWorkers[MAX_CLUSTER_WORKERS];
+    int nbLocalWorkers;
+
+    // Latest setoption lines, given again to the workers joining later
+    char options[8][128];
+
+    pthread_t searchThread;
+    bool isSearching;
+    atomic_bool stopRequested;
+    searchLimits limits;
+    searchSettings settings; // Options of the reading thread, for a search without workers
+} coordinatorState;
+
+
+////////////////////////////////////////////////////////////////////////////
+// Worker : a single search at a time, reporting its root
+
+int stepSize(long long iterations, long long budget) {
+    // Descents made between two checks of the link, a whole batch of
+    // descents when leaves are evaluated together
+    long long nbSteps = (LEAF_EVALUATION > 0) ? EVALUATION_BATCH : 1;
+    if (budget >= 0 && budget - iterations < nbSteps) {
+        nbSteps = budget - iterations;
+    }
+    return (int) nbSteps;
+}
+
+int compareSonVisits(const void* a, const void* b) {
+    // Most visited first, then in the order of the sons
+    const sonVisits* first = (const sonVisits*) a;
+    const sonVisits* second = (const sonVisits*) b;
+    if (first->nbVisits != second->nbVisits) {
+        return (first->nbVisits > second->nbVisits) ? -1 : 1;
+    }
+    return first->sonIndex - second->sonIndex;
+}
+
+void treeRootStats(mcts* tree, long long iterations, rootStats* stats) {
+    // The fields of a report, with the MAX_ROOT_SONS most visited sons when
+    // there are more, in the order of the sons
+    stats->iterations = iterations;
+    stats->nbVisits = tree->nbVisits;
+    stats->nbP1Wins = tree->nbP1Wins;
+    stats->nbSons = 0;
+
+    int sonIndexes[MAX_ROOT_SONS];
+    int nbReported = 0;
+    if (tree->nbSons <= MAX_ROOT_SONS) {
+        for (int i = 0; i < tree->nbSons; i++) {
+            sonIndexes[nbReported++] = i;
+        }
+    } else {
+        sonVisits* sons = malloc(tree->nbSons * sizeof(sonVisits));
+        for (int i = 0; i < tree->nbSons; i++) {
+            sons[i] = (sonVisits) {.nbVisits = sonNbVisits(tree, i), .sonIndex = i};
+        }
+        qsort(sons, tree->nbSons, sizeof(sonVisits), compareSonVisits);
+        bool* isReported = calloc(tree->nbSons, sizeof(bool));
+        for (int k = 0; k < MAX_ROOT_SONS; k++) {
+            isReported[sons[k].sonIndex] = true;
+        }
+        for (int i = 0; i < tree->nbSons; i++) {
+            if (isReported[i]) {
+                sonIndexes[nbReported++] = i;
+            }
+        }
+        free(isReported);
+        free(sons);
+    }
+
+    for (int k = 0; k < nbReported; k++) {
+        int i = sonIndexes[k];
+        mcts* son = sonNode(tree, i);
+        stats->sonMoves[stats->nbSons] = sonMove(tree, i);
+        stats->sonVisits[stats->nbSons] = (son != NULL) ? son->nbVisits : 0;
+        stats->sonP1Wins[stats->nbSons] = (son != NULL) ? son->nbP1Wins : 0;
+        stats->nbSons++;
+    }
+}
+
+void sendRootStats(clusterLink* link, const char* kind, mcts* tree, long long iterations, char* buffer, rootStats* stats) {
+    // At most MAX_ROOT_SONS sons, which always fit in MAX_LINK_LINE
+    treeRootStats(tree, iterations, stats);
+    size_t length = snprintf(buffer, MAX_LINK_LINE, "%s %lld %i %i %i", kind, iterations, stats->nbVisits, stats->nbP1Wins, stats->nbSons);
+    for (int i = 0; i < stats->nbSons; i++) {
+        char move[32];
+        formatMove(move, sizeof(move), stats->sonMoves[i]);
+        length += snprintf(buffer + length, MAX_LINK_LINE - length, " %s %i %i", move, stats->sonVisits[i], stats->sonP1Wins[i]);
+    }
+    sendLine(link, "%s", buffer);
+}
+
+void queueLine(clusterLink* link, lineQueue* queue, const char* line) {
+    // A message to follow once the search is over
+    if (queue->nbLines == MAX_QUEUED_LINES) {
+        sendLine(link, "error busy, dropped %.32s", line);
+        return;
+    }
+    queue->lines[queue->nbLines++] = strdup(line);
+}
+
+bool nextLine(clusterLink* link, lineQueue* queue, char* line) {
+    // The messages received during the last search first, false once the link is closed
+    if (queue->nbLines > 0) {
+        strcpy(line, queue->lines[0]);
+        free(queue->lines[0]);
+        memmove(&queue->lines[0], &queue->lines[1], --queue->nbLines * sizeof(char*));
+        return true;
+    }
+    return readLine(link, line, MAX_LINK_LINE, -1) == 1;
+}
+
+void workerSearch(clusterLink* link, boardState* board, long long budget, uint64_t seed, int stream,
+    char* buffer, rootStats* stats, lineQueue* queue) {
+    // Searches until the budget is spent or the coordinator stops it
+    seedSearchRandom(seed, stream);
+    mcts* tree = newMCTS(board);
+    long long iterations = 0;
+    double lastReport = now();
+    bool isStopped = false;
+
+    while (!isStopped && (budget < 0 || iterations < budget)) {
+        int nbSteps = stepSize(iterations, budget);
+        mctsSteps(tree, board, nbSteps);
+        iterations += nbSteps;
+
+        if (now() - lastReport >= MERGE_PERIOD) {
+            sendRootStats(link, "stats", tree, iterations, buffer, stats);
+            lastReport = now();
+        }
+
+        // stop and quit end the search, as does a closed link, the other
+        // messages wait for its end
+        int result;
+        while ((result = readLine(link, buffer, MAX_LINK_LINE, 0)) == 1) {
+            if (strncmp(buffer, "stop", 4) == 0) {
+                isStopped = true;
+            } else {
+                isStopped |= (strncmp(buffer, "quit", 4) == 0);
+                queueLine(link, queue, buffer);
+            }
+        }
+        isStopped |= (result < 0);
+    }
+
+    sendRootStats(link, "done", tree, iterations, buffer, stats);
+    freeMCTS(tree);
+}
+
+void workerOption(const char* name, const char* value) {
+    // Same options as the engine, FORWARDED_OPTIONS are the only ones sent
+    searchSettings settings = currentSearchSettings();
+    if (parseSearchOption(&settings, name, value)) {
+        useSearchSettings(&settings);
+    }
+}
+
+int runWorker(const char* address) {
+    clusterLink link;
+    if (!connectLink(address, &link)) {
+        fprintf(stderr, "Cannot connect to the coordinator at %s\n", address);
+        return 1;
+    }
+
+    boardState* board = freshBoard();
+    initializeBoard(board);
+    char* line = malloc(MAX_LINK_LINE);
+    char* buffer = malloc(MAX_LINK_LINE);
+    rootStats* stats = malloc(sizeof(rootStats));
+    lineQueue queue = {.nbLines = 0};
+
+    while (nextLine(&link, &queue, line)) {
+        char* savePtr = NULL;
+        char* command = strtok_r(line, " \t\n", &savePtr);
+        if (command == NULL) {
+            continue;
+        }
+
+        if (strcmp(command, "quit") == 0) {
+            break;
+
+        } else if (strcmp(command, "setoption") == 0) {
+            char* name = strtok_r(NULL, " \t\n", &savePtr);
+            char* value = strtok_r(NULL, " \t\n", &savePtr);
+            if (name != NULL && value != NULL) {
+                workerOption(name, value);
+            }
+
+        } else if (strcmp(command, "position") == 0) {
+            // Without a valid position, the worker stays idle until the next one
+            if (board != NULL) {
+                freeBoardState(board);
+            }
+            board = parsePosition(&savePtr);
+            if (board == NULL) {
+                sendLine(&link, "error invalid position");
+            }
+
+        } else if (strcmp(command, "go") == 0) {
+            char* iterations = strtok_r(NULL, " \t\n", &savePtr);
+            char* seed = strtok_r(NULL, " \t\n", &savePtr);
+            char* stream = strtok_r(NULL, " \t\n", &savePtr);
+            if (board == NULL) {
+                sendLine(&link, "done 0 0 0 0");
+            } else if (stream != NULL) {
+                workerSearch(&link, board, atoll(iterations), strtoull(seed, NULL, 10), atoi(stream), buffer, stats, &queue);
+            }
+        }
+    }
+
+    while (queue.nbLines > 0) {
+        free(queue.lines[--queue.nbLines]);
+    }
+    free(stats);
+    free(buffer);
+    free(line);
+    if (board != NULL) {
+        freeBoardState(board);
+    }
+    closeLink(&link);
+    return 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Coordinator : workers and the merge of their roots
+
+void sendOptions(coordinatorState* coordinator, workerLink* worker) {
+    for (int i = 0; i < 8; i++) {
+        if (coordinator->options[i][0] != '\0') {
+            sendLine(&worker->link, "setoption %s %s", FORWARDED_OPTIONS[i], coordinator->options[i]);
+        }
+    }
+}
+
+int acceptWorkers(coordinatorState* coordinator) {
+    // Workers waiting to join, returns how many joined
+    int nbJoined = 0;
+    while (coordinator->nbWorkers < MAX_CLUSTER_WORKERS) {
+        workerLink* worker = &coordinator->workers[coordinator->nbWorkers];
+        if (!acceptLink(coordinator->listeningSocket, &worker->link)) {
+            break;
+        }
+        worker->isSearching = false;
+        sendOptions(coordinator, worker);
+        coordinator->nbWorkers++;
+        nbJoined++;
+    }
+    return nbJoined;
+}
+
+void forgetClosedWorkers(coordinatorState* coordinator) {
+    for (int i = 0; i < coordinator->nbWorkers; i++) {
+        if (coordinator->workers[i].link.socket < 0) {
+            coordinator->workers[i--] = coordinator->workers[--coordinator->nbWorkers];
+        }
+    }
+}
+
+bool parseRootStats(char** savePtr, rootStats* stats) {
+    // Fields of a stats or done message, after its first word
+    char* token;
+    long long values[4];
+    for (int i = 0; i < 4; i++) {
+        if ((token = strtok_r(NULL, " \t\n", savePtr)) == NULL) {
+            return false;
+        }
+        values[i] = atoll(token);
+    }
+    stats->iterations = values[0];
+    stats->nbVisits = (int) values[1];
+    stats->nbP1Wins = (int) values[2];
+    stats->nbSons = 0;
+
+    for (int i = 0; i < values[3] && stats->nbSons < MAX_ROOT_SONS; i++) {
+        char* move = strtok_r(NULL, " \t\n", savePtr);
+        char* visits = strtok_r(NULL, " \t\n", savePtr);
+        char* p1Wins = strtok_r(NULL, " \t\n", savePtr);
+        if (p1Wins == NULL || !parseMove(move, &stats->sonMoves[stats->nbSons])) {
+            return false;
+        }
+        stats->sonVisits[stats->nbSons] = atoi(visits);
+        stats->sonP1Wins[stats->nbSons] = atoi(p1Wins);
+        stats->nbSons++;
+    }
+    return true;
+}
+
+void mergeRootStats(coordinatorState* coordinator, rootStats* merged) {
+    // Sums of the roots of all workers, sons matched by their move, the moves
+    // that are not legal on the board of the coordinator being left out
+    merged->iterations = 0;
+    merged->nbVisits = 0;
+    merged->nbP1Wins = 0;
+    merged->nbSons = 0;
+
+    for (int w = 0; w < coordinator->nbWorkers; w++) {
+        rootStats* stats = &coordinator->workers[w].stats;
+        merged->iterations += stats->iterations;
+        merged->nbVisits += stats->nbVisits;
+        merged->nbP1Wins += stats->nbP1Wins;
+
+        for (int i = 0; i < stats->nbSons; i++) {
+            // Workers list the sons in the same order, the same index is tried first
+            int k = (i < merged->nbSons && sameMove(merged->sonMoves[i], stats->sonMoves[i])) ? i : 0;
+            while (k < merged->nbSons && !sameMove(merged->sonMoves[k], stats->sonMoves[i])) {
+                k++;
+            }
+            if (k == merged->nbSons) {
+                if (k == MAX_ROOT_SONS || !isLegalMove(coordinator->board, stats->sonMoves[i])) {
+                    continue;
+                }
+                merged->sonMoves[k] = stats->sonMoves[i];
+                merged->sonVisits[k] = 0;
+                merged->sonP1Wins[k] = 0;
+                merged->nbSons++;
+            }
+            merged->sonVisits[k] += stats->sonVisits[i];
+            merged->sonP1Wins[k] += stats->sonP1Wins[i];
+        }
+    }
+}
+
+int mostVisitedSon(rootStats* stats) {
+    // -1 without any son
+    int bestIndex = -1;
+    for (int i = 0; i < stats->nbSons; i++) {
+        if (bestIndex < 0 || stats->sonVisits[i] > stats->sonVisits[bestIndex]) {
+            bestIndex = i;
+        }
+    }
+    return bestIndex;
+}
+
+void sendInfo(coordinatorState* coordinator, rootStats* merged, int nbWorkers, double elapsed) {
+    float p1WinRatio = (merged->nbVisits > 0) ? (float) merged->nbP1Wins / (float) merged->nbVisits : 0.5f;
+    float winRate = (coordinator->board->playerToPlay == 4) ? p1WinRatio : 1.0f - p1WinRatio;
+
+    char pv[32] = "";
+    int bestIndex = mostVisitedSon(merged);
+    if (bestIndex >= 0 && merged->sonVisits[bestIndex] > 0) {
+        formatMove(pv, sizeof(pv), merged->sonMoves[bestIndex]);
+    }
+
+    reply("info iterations %lld visits %i workers %i winrate %.4f nps %.0f pv %s",
+        merged->iterations, merged->nbVisits, nbWorkers, winRate,
+        (elapsed > 0) ? merged->iterations / elapsed : 0.0, pv);
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Coordinator search thread
+
+void searchAlone(coordinatorState* coordinator, rootStats* stats, uint64_t seed, double startTime) {
+    // Without any report from a worker, the coordinator searches itself with
+    // the same limits, at least one step, rather than answer an unsearched move
+    seedSearchRandom(seed, MAX_CLUSTER_WORKERS);
+    useSearchSettings(&coordinator->settings);
+    mcts* tree = newMCTS(coordinator->board);
+    long long budget = (coordinator->limits.iterations > 0) ? coordinator->limits.iterations : -1;
+    long long iterations = 0;
+    double lastInfo = now();
+
+    do {
+        int nbSteps = stepSize(iterations, budget);
+        mctsSteps(tree, coordinator->board, nbSteps);
+        iterations += nbSteps;
+
+        double time = now();
+        if (time - lastInfo >= INFO_PERIOD) {
+            treeRootStats(tree, iterations, stats);
+            sendInfo(coordinator, stats, 0, time - startTime);
+            lastInfo = time;
+        }
+    } while (!atomic_load(&coordinator->stopRequested) && (budget < 0 || iterations < budget)
+        && (coordinator->limits.moveTime <= 0 || now() - startTime < coordinator->limits.moveTime));
+
+    treeRootStats(tree, iterations, stats);
+    freeMCTS(tree);
+}
+
+void readReports(coordinatorState* coordinator, char* line, double timeout) {
+    // Reports of the searching workers, waiting at most timeout seconds for one
+    struct pollfd pollFds[MAX_CLUSTER_WORKERS];
+    int nbPolled = 0;
+    for (int w = 0; w < coordinator->nbWorkers; w++) {
+        if (coordinator->workers[w].isSearching) {
+            pollFds[nbPolled++] = (struct pollfd) {.fd = coordinator->workers[w].link.socket, .events = POLLIN};
+        }
+    }
+    poll(pollFds, nbPolled, (int) (timeout * 1000));
+
+    for (int w = 0; w < coordinator->nbWorkers; w++) {
+        workerLink* worker = &coordinator->workers[w];
+        int result = 0;
+        while (worker->isSearching && (result = readLine(&worker->link, line, MAX_LINK_LINE, 0)) == 1) {
+            char* savePtr = NULL;
+            char* kind = strtok_r(line, " \t\n", &savePtr);
+            if (kind != NULL && strcmp(kind, "error") == 0) {
+                reply("info string worker %i error %s", w, (savePtr != NULL) ? savePtr : "");
+                continue;
+            }
+            if (kind == NULL || (strcmp(kind, "stats") != 0 && strcmp(kind, "done") != 0)) {
+                continue;
+            }
+            rootStats stats;
+            if (parseRootStats(&savePtr, &stats)) {
+                worker->stats = stats;
+            }
+            worker->isSearching = (strcmp(kind, "stats") == 0);
+        }
+        // A worker that left keeps its last report in this search
+        if (worker->isSearching && result < 0) {
+            worker->isSearching = false;
+        }
+    }
+}
+
+void* searchLoop(void* arg) {
+    // Sends the position to every worker, then merges their reports until they are all done
+    coordinatorState* coordinator = (coordinatorState*) arg;
+    double startTime = now();
+    double lastInfo = startTime;
+    uint64_t seed = (uint64_t) (startTime * 1e9);
+    char* line = malloc(MAX_LINK_LINE);
+    rootStats* merged = malloc(sizeof(rootStats));
+
+    // The iteration budget is evenly split between workers
+    int nbWorkers = coordinator->nbWorkers;
+    long long budget = (nbWorkers > 0) ? coordinator->limits.iterations / nbWorkers : 0;
+    long long remainder = (nbWorkers > 0) ? coordinator->limits.iterations % nbWorkers : 0;
+
+    formatPosition(line, MAX_LINK_LINE, coordinator->board);
+    for (int w = 0; w < nbWorkers; w++) {
+        workerLink* worker = &coordinator->workers[w];
+        long long iterations = (coordinator->limits.iterations > 0) ? budget + (w < remainder) : -1;
+        worker->stats = (rootStats) {0};
+        worker->isSearching = sendLine(&worker->link, "%s", line)
+            && sendLine(&worker->link, "go %lld %llu %i", iterations, (unsigned long long) seed, w);
+    }
+
+    bool isStopping = false;
+    double stopTime = 0;
+    while (true) {
+        int nbSearching = 0;
+        for (int w = 0; w < nbWorkers; w++) {
+            nbSearching += coordinator->workers[w].isSearching;
+        }
+        if (nbSearching == 0) {
+            break;
+        }
+
+        double time = now();
+        bool isTimeOver = coordinator->limits.moveTime > 0 && time - startTime >= coordinator->limits.moveTime;
+        if (!isStopping && (atomic_load(&coordinator->stopRequested) || isTimeOver)) {
+            for (int w = 0; w < nbWorkers; w++) {
+                if (coordinator->workers[w].isSearching) {
+                    sendLine(&coordinator->workers[w].link, "stop");
+                }
+            }
+            isStopping = true;
+            stopTime = time;
+        }
+        if (isStopping && time - stopTime >= STOP_TIME) {
+            // Their last reports are kept, the links are forgotten after the search
+            for (int w = 0; w < nbWorkers; w++) {
+                workerLink* worker = &coordinator->workers[w];
+                if (worker->isSearching) {
+                    reply("info string worker %i did not stop, dropped", w);
+                    closeLink(&worker->link);
+                    worker->isSearching = false;
+                }
+            }
+            continue;
+        }
+        if (time - lastInfo >= INFO_PERIOD) {
+            mergeRootStats(coordinator, merged);
+            sendInfo(coordinator, merged, nbSearching, time - startTime);
+            lastInfo = time;
+        }
+
+        readReports(coordinator, line, 0.01);
+    }
+
+    mergeRootStats(coordinator, merged);
+    boardMoveL* moves = allPossibleMoves(coordinator->board);
+    if (moves != NULL && mostVisitedSon(merged) < 0) {
+        reply("info string no worker reported, searching in the coordinator");
+        searchAlone(coordinator, merged, seed, startTime);
+    }
+    freeBoardMoveL(moves);
+    sendInfo(coordinator, merged, nbWorkers, now() - startTime);
+
+    int bestIndex = mostVisitedSon(merged);
+    if (bestIndex >= 0) {
+        formatMove(line, MAX_LINK_LINE, merged->sonMoves[bestIndex]);
+        reply("bestmove %s", line);
+    } else {
+        reply("bestmove pass");
+    }
+
+    free(merged);
+    free(line);
+    return NULL;
+}
+
+void stopSearch(coordinatorState* coordinator) {
+    if (coordinator->isSearching) {
+        atomic_store(&coordinator->stopRequested, true);
+        pthread_join(coordinator->searchThread, NULL);
+        coordinator->isSearching = false;
+        forgetClosedWorkers(coordinator);
+    }
+}
+
+void startSearch(coordinatorState* coordinator, searchLimits limits) {
+    stopSearch(coordinator);
+    acceptWorkers(coordinator);
+    coordinator->limits = limits;
+    coordinator->settings = currentSearchSettings();
+    atomic_store(&coordinator->stopRequested, false);
+    coordinator->isSearching = true;
+    pthread_create(&coordinator->searchThread, NULL, searchLoop, coordinator);
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Coordinator : position updates and commands
+
+void setBoard(coordinatorState* coordinator, boardState* board) {
+    if (coordinator->board != NULL) {
+        freeBoardState(coordinator->board);
+    }
+    coordinator->board = board;
+}
+
+void applyMove(coordinatorState* coordinator, const char* token) {
+    // Workers start every search from a new tree, only the board follows the moves
+    boardMove move;
+    bool isPass;
+    if (!parsePlayedMove(coordinator->board, token, &move, &isPass)) {
+        reply("info string illegal move %s", token);
+        return;
+    }
+    if (isPass) {
+        coordinator->board->playerToPlay = (coordinator->board->playerToPlay == 4) ? 5 : 4;
+        return;
+    }
+    movePenguin(coordinator->board, move);
+}
+
+void setOption(coordinatorState* coordinator, const char* name, const char* value) {
+    int option = 0;
+    while (option < 8 && strcmp(name, FORWARDED_OPTIONS[option]) != 0) {
+        option++;
+    }
+    searchSettings settings = currentSearchSettings();
+    if (value == NULL || option == 8 || strlen(value) >= sizeof(coordinator->options[option])
+        || !parseSearchOption(&settings, name, value)) {
+        reply("info string invalid option %s %s", name, (value != NULL) ? value : "");
+        return;
+    }
+
+    strcpy(coordinator->options[option], value);
+    useSearchSettings(&settings);
+    for (int w = 0; w < coordinator->nbWorkers; w++) {
+        sendLine(&coordinator->workers[w].link, "setoption %s %s", name, value);
+    }
+}
+
+bool startLocalWorkers(coordinatorState* coordinator, const char* program, const char* address, int nbLocalWorkers) {
+    // Worker processes on this machine, connected once the function returns.
+    // They run the executable of this process, program being only its name
+    // when it was found through the PATH
+    char* argv[] = {(char*) program, "worker", (char*) address, NULL};
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+
+    for (int i = 0; i < nbLocalWorkers && i < MAX_CLUSTER_WORKERS; i++) {
+        pid_t pid;
+        int error = posix_spawn(&pid, "/proc/self/exe", &actions, NULL, argv, environ);
+        if (error == ENOENT) {
+            error = posix_spawnp(&pid, program, &actions, NULL, argv, environ);
+        }
+        if (error != 0) {
+            fprintf(stderr, "Cannot start a local worker from %s : %s\n", program, strerror(error));
+            break;
+        }
+        coordinator->localWorkers[coordinator->nbLocalWorkers++] = pid;
+    }
+    posix_spawn_file_actions_destroy(&actions);
+
+    double startTime = now();
+    while (coordinator->nbWorkers < coordinator->nbLocalWorkers && now() - startTime < JOIN_TIME) {
+        struct pollfd pollFd = {.fd = coordinator->listeningSocket, .events = POLLIN};
+        poll(&pollFd, 1, 100);
+        acceptWorkers(coordinator);
+    }
+    return coordinator->nbWorkers == coordinator->nbLocalWorkers;
+}
+
+int runCoordinator(const char* program, const char* address, int nbLocalWorkers) {
+    coordinatorState* coordinator = calloc(1, sizeof(coordinatorState));
+    atomic_init(&coordinator->stopRequested, false);
+
+    coordinator->listeningSocket = listenLinks(address);
+    if (coordinator->listeningSocket < 0) {
+        fprintf(stderr, "Cannot listen on %s\n", address);
+        free(coordinator);
+        return 1;
+    }
+    if (!startLocalWorkers(coordinator, program, address, nbLocalWorkers)) {
+        fprintf(stderr, "Only %i of the %i local workers joined\n", coordinator->nbWorkers, nbLocalWorkers);
+    }
+
+    srand(time(NULL));
+    coordinator->board = freshBoard();
+    initializeBoard(coordinator->board);
+
+    char line[8192];
+    while (fgets(line, sizeof(line), stdin) != NULL) {
+        char* savePtr = NULL;
+        char* command = strtok_r(line, " \t\n", &savePtr);
+        if (command == NULL) {
+            continue;
+        }
+
+        if (strcmp(command, "quit") == 0) {
+            break;
+        }
+        if (strcmp(command, "isready") == 0) {
+            reply("readyok");
+            continue;
+        }
+        if (strcmp(command, "stop") == 0) {
+            stopSearch(coordinator);
+            continue;
+        }
+
+        // Any other command is handled once the search is over
+        stopSearch(coordinator);
+
+        if (strcmp(command, "penguins") == 0) {
+            reply("id name penguin-game-mcts cluster");
+            reply("penguinsok");
+
+        } else if (strcmp(command, "setoption") == 0) {
+            char* name = strtok_r(NULL, " \t\n", &savePtr);
+            char* value = strtok_r(NULL, " \t\n", &savePtr);
+            if (name != NULL) {
+                setOption(coordinator, name, value);
+            }
+
+        } else if (strcmp(command, "newgame") == 0) {
+            char* seed = strtok_r(NULL, " \t\n", &savePtr);
+            srand((seed != NULL) ? (unsigned int) strtoul(seed, NULL, 10) : (unsigned int) time(NULL));
+            boardState* board = freshBoard();
+            initializeBoard(board);
+            setBoard(coordinator, board);
+
+        } else if (strcmp(command, "map") == 0) {
+            char* path = strtok_r(NULL, " \t\n", &savePtr);
+            char* seed = strtok_r(NULL, " \t\n", &savePtr);
+            srand((seed != NULL) ? (unsigned int) strtoul(seed, NULL, 10) : (unsigned int) time(NULL));
+            boardState* board = (path != NULL) ? loadMap(path) : NULL;
+            if (board != NULL) {
+                setBoard(coordinator, board);
+            } else {
+                reply("info string cannot load map %s", (path != NULL) ? path : "");
+            }
+
+        } else if (strcmp(command, "position") == 0) {
+            boardState* board = parsePosition(&savePtr);
+            if (board != NULL) {
+                setBoard(coordinator, board);
+            } else {
+                reply("info string invalid position");
+            }
+
+        } else if (strcmp(command, "moves") == 0) {
+            char* token;
+            while ((token = strtok_r(NULL, " \t\n", &savePtr)) != NULL) {
+                applyMove(coordinator, token);
+            }
+
+        } else if (strcmp(command, "go") == 0) {
+            searchLimits limits = {.iterations = 0, .moveTime = 0};
+            bool isInfinite = false;
+            char* token;
+            while ((token = strtok_r(NULL, " \t\n", &savePtr)) != NULL) {
+                char* value = NULL;
+                if (strcmp(token, "iterations") == 0 && (value = strtok_r(NULL, " \t\n", &savePtr)) != NULL) {
+                    limits.iterations = atoll(value);
+                } else if (strcmp(token, "movetime") == 0 && (value = strtok_r(NULL, " \t\n", &savePtr)) != NULL) {
+                    limits.moveTime = atof(value) / 1000.0;
+                } else if (strcmp(token, "infinite") == 0) {
+                    isInfinite = true;
+                }
+            }
+            if (!isInfinite && limits.iterations <= 0 && limits.moveTime <= 0) {
+                limits.moveTime = 1.0;
+            }
+            startSearch(coordinator, limits);
+
+        } else if (strcmp(command, "print") == 0) {
+            char position[8192];
+            if (formatPosition(position, sizeof(position), coordinator->board) >= 0) {
+                reply("%s", position);
+            }
+
+        } else {
+            reply("info string unknown command %s", command);
+        }
+    }
+
+    stopSearch(coordinator);
+    for (int w = 0; w < coordinator->nbWorkers; w++) {
+        sendLine(&coordinator->workers[w].link, "quit");
+        closeLink(&coordinator->workers[w].link);
+    }
+    for (int i = 0; i < coordinator->nbLocalWorkers; i++) {
+        waitpid(coordinator->localWorkers[i], NULL, 0);
+    }
+    closeListener(coordinator->listeningSocket, address);
+    setBoard(coordinator, NULL);
+    free(coordinator);
+
+    return 0;
+}
+
+
+int main(int argc, char** argv) {
+
+    if (argc >= 3 && strcmp(argv[1], "coordinator") == 0) {
+        return runCoordinator(argv[0], argv[2], (argc > 3) ? atoi(argv[3]) : 1);
+    }
+    if (argc >= 3 && strcmp(argv[1], "worker") == 0) {
+        return runWorker(argv[2]);
+    }
+
+    fprintf(stderr, "Usage : %s coordinator <address> [nbLocalWorkers]\n", argv[0]);
+    fprintf(stderr, "        %s worker <address>\n", argv[0]);
+    return 1;
+}
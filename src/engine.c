@@ -0,0 +1,564 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "board.h"
+#include "monte-carlo.h"
+#include "protocol.h"
+#include "search-feed.h"
+
+
+// Headless engine speaking a line-based protocol on stdin/stdout,
+// in the spirit of UCI, so that the AI can run as a subprocess
+//
+// Commands :
+//   penguins                   -> id name ..., then penguinsok
+//   isready                    -> readyok
+//   setoption <name> <value>   exploration, sims, widening, prior, rave,
+//                              playouts (uniform or heavy), evaluation
+//                              (playouts, static or mixed), batch, threads,
+//                              feed (unix:<path>, a JSONL file or off), feedrate
+//                              deterministic (a seed, or off) or timeline (on or off)
+//   newgame [seed]             standard map with fishes drawn from the seed
+//   map <file> [seed]          map file (see loadMap) with fishes drawn from the seed
+//   position <player> <p1Score> <p2Score> <sizeX> <sizeY> <tiles...>
+//                              exact position, tiles given row by row, at most
+//                              MAX_POSITION_SIZE tiles in each dimension
+//   moves <move> ...           moves written x,y-x,y, or pass without any other move
+//   go [iterations <n>] [movetime <ms>] [infinite]
+//                              -> info ... lines, then bestmove <move>
+//   stop                       stops the search, which answers bestmove
+//   print                      -> the current position as a position command
+//   timeline <file>            writes the timeline recorded so far as a Chrome trace
+//   quit
+//
+// During a search, info lines are streamed :
+//   info iterations <n> visits <n> nodes <n> winrate <w> nps <n> pv <moves...>
+// The win rate is given for the player to play.
+//
+// With a feed, snapshots of the root (visits of every son, P1 win ratio,
+// principal variation, iterations per second) are also written feedrate times
+// per second as JSON lines, to a file or to the clients of a Unix socket.
+// The search thread never waits for the feed.
+//
+// In deterministic mode, every search seeds the random streams of its threads
+// from the given seed and only stops on an iteration budget (movetime is ignored),
+// the budget of every thread being fixed. The same commands then give the
+// same trees and moves, checked by an info string checksum line after bestmove.
+//
+// With the timeline on, every thread records its search steps and leaf batches,
+// and the number of nodes alive is sampled with the info lines.
+
+// Delay between two info lines during a search
+const double INFO_PERIOD = 0.2;
+
+// Longest principal variation printed
+const int MAX_PV_LENGTH = 16;
+
+// Snapshots per second of the search statistics feed, by default
+const double DEFAULT_FEED_RATE = 10.0;
+
+// Budget of a go command without iterations in deterministic mode
+const long long DETERMINISTIC_ITERATIONS = 10000;
+
+// Root parallelism : every thread grows its own tree, and the root sons are merged
+#define MAX_THREADS 64
+
+
+typedef struct _engineState engineState;
+
+typedef struct _helperState {
+    engineState* engine;
+    pthread_t thread;
+    mcts* tree;
+    long long iterations; // Budget of this thread, -1 means no limit
+    uint64_t seed;
+    int index;
+} helperState;
+
+struct _engineState {
+    boardState* board;
+    mcts* tree;
+
+    pthread_t searchThread;
+    bool isSearching;
+    atomic_bool stopRequested;
+    atomic_bool helpersStopRequested;
+    atomic_llong nbIterations;
+    searchLimits limits;
+
+    int nbThreads;
+    helperState helpers[MAX_THREADS];
+
+    bool isDeterministic;
+    uint64_t seed;
+    searchSettings settings; // Taken by every thread of a search
+
+    statsFeed* feed; // NULL without a feed
+    char feedTarget[256];
+    double feedRate;
+};
+
+
+////////////////////////////////////////////////////////////////////////////
+// Output
+
+void formatPV(char* buffer, size_t size, mcts* tree) {
+    // Principal variation : the most visited son, again and again
+    size_t length = 0;
+    buffer[0] = '\0';
+
+    for (int depth = 0; depth < MAX_PV_LENGTH && tree->nbVisits > 0 && tree->nbSons > 0; depth++) {
+        int sonIndex = 0;
+        for (int i = 1; i < tree->nbSons; i++) {
+            if (sonNbVisits(tree, i) > sonNbVisits(tree, sonIndex)) {
+                sonIndex = i;
+            }
+        }
+        if (sonNbVisits(tree, sonIndex) == 0) {
+            break;
+        }
+
+        if (length > 0 && length + 1 < size) {
+            buffer[length++] = ' ';
+            buffer[length] = '\0';
+        }
+        int written = formatMove(buffer + length, size - length, sonMove(tree, sonIndex));
+        if (written < 0 || length + written >= size) {
+            break;
+        }
+        length += written;
+        tree = sonNode(tree, sonIndex);
+    }
+}
+
+void sendInfo(engineState* engine, double elapsed) {
+    mcts* tree = engine->tree;
+    float p1WinRatio = (tree->nbVisits > 0) ? (float) tree->nbP1Wins / (float) tree->nbVisits : 0.5f;
+    float winRate = (engine->board->playerToPlay == 4) ? p1WinRatio : 1.0f - p1WinRatio;
+
+    char pv[MAX_PV_LENGTH * 16];
+    formatPV(pv, sizeof(pv), tree);
+
+    long long iterations = atomic_load(&engine->nbIterations);
+    reply("info iterations %lld visits %i nodes %i winrate %.4f nps %.0f pv %s",
+        iterations, tree->nbVisits, treeSize(tree), winRate,
+        (elapsed > 0) ? iterations / elapsed : 0.0, pv);
+}
+
+boardMove mergedBestMove(engineState* engine) {
+    // The move with the most visits, summed over the trees of all threads
+    mcts* tree = engine->tree;
+    int bestIndex = 0;
+    long long biggestNbVisits = -1;
+
+    for (int i = 0; i < tree->nbSons; i++) {
+        packedMove move = tree->sons[i].move;
+        long long nbVisits = sonNbVisits(tree, i);
+
+        for (int t = 1; t < engine->nbThreads; t++) {
+            mcts* helperTree = engine->helpers[t].tree;
+            for (int j = 0; j < helperTree->nbSons; j++) {
+                if (helperTree->sons[j].move == move) {
+                    nbVisits += sonNbVisits(helperTree, j);
+                    break;
+                }
+            }
+        }
+
+        if (nbVisits > biggestNbVisits) {
+            biggestNbVisits = nbVisits;
+            bestIndex = i;
+        }
+    }
+
+    return sonMove(tree, bestIndex);
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Search thread
+
+int stepSize(long long iterations, long long budget) {
+    // Descents made between two checks of the limits, a whole batch of
+    // descents when leaves are evaluated together
+    long long nbSteps = (LEAF_EVALUATION > 0) ? EVALUATION_BATCH : 1;
+    if (budget >= 0 && budget - iterations < nbSteps) {
+        nbSteps = budget - iterations;
+    }
+    return (int) nbSteps;
+}
+
+void* helperLoop(void* arg) {
+    // Tree descents of an extra thread, in its own tree
+    helperState* helper = (helperState*) arg;
+    engineState* engine = helper->engine;
+    long long iterations = 0;
+    seedSearchRandom(helper->seed, helper->index);
+    useSearchSettings(&engine->settings);
+
+    char threadName[32];
+    snprintf(threadName, sizeof(threadName), "helper %i", helper->index);
+    nameTimelineThread(threadName);
+
+    while (!atomic_load(&engine->helpersStopRequested)) {
+        if (helper->iterations >= 0 && iterations >= helper->iterations) {
+            break;
+        }
+        int nbSteps = stepSize(iterations, helper->iterations);
+        int64_t spanStart = timelineBegin();
+        mctsSteps(helper->tree, engine->board, nbSteps);
+        timelineEnd("search", spanStart);
+        atomic_fetch_add(&engine->nbIterations, nbSteps);
+        iterations += nbSteps;
+    }
+
+    return NULL;
+}
+
+void* searchLoop(void* arg) {
+    // Tree descents until the budget is spent or a stop is requested
+    engineState* engine = (engineState*) arg;
+    double startTime = now();
+    double lastInfo = startTime;
+    double lastSnapshot = startTime;
+    long long iterations = 0;
+
+    // Every thread draws from its own stream of the seed
+    uint64_t seed = engine->isDeterministic ? engine->seed : (uint64_t) (startTime * 1e9);
+    seedSearchRandom(seed, 0);
+    useSearchSettings(&engine->settings);
+    nameTimelineThread("search");
+
+    if (engine->tree == NULL) {
+        engine->tree = newMCTS(engine->board);
+    }
+
+    // The iteration budget is evenly split between threads
+    long long budget = engine->limits.iterations / engine->nbThreads;
+    long long remainder = engine->limits.iterations % engine->nbThreads;
+
+    atomic_store(&engine->nbIterations, 0);
+    atomic_store(&engine->helpersStopRequested, false);
+    for (int t = 1; t < engine->nbThreads; t++) {
+        helperState* helper = &engine->helpers[t];
+        helper->engine = engine;
+        helper->tree = newMCTS(engine->board);
+        helper->iterations = (engine->limits.iterations > 0) ? budget + (t < remainder) : -1;
+        helper->seed = seed;
+        helper->index = t;
+        pthread_create(&helper->thread, NULL, helperLoop, helper);
+    }
+    budget += (remainder > 0);
+
+    while (!atomic_load(&engine->stopRequested)) {
+        if (engine->limits.iterations > 0 && iterations >= budget) {
+            break;
+        }
+        double time = now();
+        if (engine->limits.moveTime > 0 && time - startTime >= engine->limits.moveTime) {
+            break;
+        }
+        if (time - lastInfo >= INFO_PERIOD) {
+            sendInfo(engine, time - startTime);
+            if (isTimelineEnabled()) {
+                timelineCounter("nodes", nbLiveNodes());
+            }
+            lastInfo = time;
+        }
+        if (engine->feed != NULL && time - lastSnapshot >= engine->feed->period) {
+            publishSearchStats(engine->feed, engine->tree, engine->board, atomic_load(&engine->nbIterations), time - startTime);
+            lastSnapshot = time;
+        }
+
+        int nbSteps = stepSize(iterations, (engine->limits.iterations > 0) ? budget : -1);
+        int64_t spanStart = timelineBegin();
+        mctsSteps(engine->tree, engine->board, nbSteps);
+        timelineEnd("search", spanStart);
+        atomic_fetch_add(&engine->nbIterations, nbSteps);
+        iterations += nbSteps;
+    }
+
+    // Helpers finish their share of an iteration budget, unless time is over
+    if (atomic_load(&engine->stopRequested) || engine->limits.moveTime > 0 || engine->limits.iterations == 0) {
+        atomic_store(&engine->helpersStopRequested, true);
+    }
+    for (int t = 1; t < engine->nbThreads; t++) {
+        pthread_join(engine->helpers[t].thread, NULL);
+    }
+
+    sendInfo(engine, now() - startTime);
+    if (engine->feed != NULL) {
+        publishSearchStats(engine->feed, engine->tree, engine->board, atomic_load(&engine->nbIterations), now() - startTime);
+    }
+
+    if (engine->tree->nbSons > 0) {
+        char move[32];
+        formatMove(move, sizeof(move), mergedBestMove(engine));
+        reply("bestmove %s", move);
+    } else {
+        reply("bestmove pass");
+    }
+
+    if (engine->isDeterministic) {
+        uint64_t checksum = treeChecksum(engine->tree);
+        for (int t = 1; t < engine->nbThreads; t++) {
+            checksum = checksum * 31 + treeChecksum(engine->helpers[t].tree);
+        }
+        reply("info string checksum %016llx", (unsigned long long) checksum);
+    }
+
+    for (int t = 1; t < engine->nbThreads; t++) {
+        freeMCTS(engine->helpers[t].tree);
+        engine->helpers[t].tree = NULL;
+    }
+
+    return NULL;
+}
+
+void stopSearch(engineState* engine) {
+    if (engine->isSearching) {
+        atomic_store(&engine->stopRequested, true);
+        pthread_join(engine->searchThread, NULL);
+        engine->isSearching = false;
+    }
+}
+
+void startSearch(engineState* engine, searchLimits limits) {
+    stopSearch(engine);
+    engine->limits = limits;
+    atomic_store(&engine->stopRequested, false);
+    engine->isSearching = true;
+    pthread_create(&engine->searchThread, NULL, searchLoop, engine);
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Position updates
+
+void setBoard(engineState* engine, boardState* board) {
+    // The previous tree is useless on a new position
+    if (engine->tree != NULL) {
+        freeMCTS(engine->tree);
+        engine->tree = NULL;
+    }
+    if (engine->board != NULL) {
+        freeBoardState(engine->board);
+    }
+    engine->board = board;
+}
+
+void applyMove(engineState* engine, const char* token) {
+    // Plays a move, keeping the subtree of the move when there is one
+
+    boardMove move;
+    bool isPass;
+    if (!parsePlayedMove(engine->board, token, &move, &isPass)) {
+        reply("info string illegal move %s", token);
+        return;
+    }
+
+    if (isPass) {
+        if (engine->tree != NULL) {
+            freeMCTS(engine->tree);
+            engine->tree = NULL;
+        }
+        engine->board->playerToPlay = (engine->board->playerToPlay == 4) ? 5 : 4;
+        return;
+    }
+
+    if (engine->tree != NULL) {
+        if (engine->tree->nbVisits > 0) {
+            engine->tree = makeMove(engine->tree, move);
+        } else {
+            freeMCTS(engine->tree);
+            engine->tree = NULL;
+        }
+    }
+    movePenguin(engine->board, move);
+}
+
+void openFeed(engineState* engine) {
+    // Replaces the feed, once the search is over
+    closeStatsFeed(engine->feed);
+    engine->feed = NULL;
+    if (engine->feedTarget[0] != '\0' && strcmp(engine->feedTarget, "off") != 0) {
+        engine->feed = openStatsFeed(engine->feedTarget, engine->feedRate);
+        if (engine->feed == NULL) {
+            reply("info string cannot open feed %s", engine->feedTarget);
+        }
+    }
+}
+
+void setOption(engineState* engine, const char* name, const char* value) {
+    if (value == NULL) {
+        reply("info string missing value for option %s", name);
+    } else if (parseSearchOption(&engine->settings, name, value)) {
+        // Tree statistics are counted in random games, the tree is restarted
+        useSearchSettings(&engine->settings);
+        if (strcmp(name, "sims") == 0) {
+            setBoard(engine, copyBoardState(engine->board));
+        }
+    } else if (strcmp(name, "threads") == 0 && atoi(value) > 0 && atoi(value) <= MAX_THREADS) {
+        engine->nbThreads = atoi(value);
+    } else if (strcmp(name, "deterministic") == 0) {
+        engine->isDeterministic = (strcmp(value, "off") != 0);
+        engine->seed = strtoull(value, NULL, 10);
+    } else if (strcmp(name, "timeline") == 0 && (strcmp(value, "on") == 0 || strcmp(value, "off") == 0)) {
+        setTimelineEnabled(strcmp(value, "on") == 0);
+    } else if (strcmp(name, "feed") == 0 && strlen(value) < sizeof(engine->feedTarget)) {
+        strcpy(engine->feedTarget, value);
+        openFeed(engine);
+    } else if (strcmp(name, "feedrate") == 0 && atof(value) > 0) {
+        engine->feedRate = atof(value);
+        openFeed(engine);
+    } else {
+        reply("info string invalid option %s %s", name, value);
+    }
+}
+
+void printPosition(boardState* board) {
+    // Two characters a tile, the tiles being single digits
+    size_t size = 64 + 2 * board->sizeX * board->sizeY;
+    char* position = malloc(size);
+    if (formatPosition(position, size, board) >= 0) {
+        reply("%s", position);
+    }
+    free(position);
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Main loop reading commands
+
+int main(void) {
+
+    engineState engine = {0};
+    atomic_init(&engine.stopRequested, false);
+    atomic_init(&engine.helpersStopRequested, false);
+    atomic_init(&engine.nbIterations, 0);
+    engine.nbThreads = 1;
+    engine.feedRate = DEFAULT_FEED_RATE;
+    engine.settings = currentSearchSettings();
+
+    srand(time(NULL));
+    engine.board = freshBoard();
+    initializeBoard(engine.board);
+
+    char line[8192];
+    while (fgets(line, sizeof(line), stdin) != NULL) {
+        char* savePtr = NULL;
+        char* command = strtok_r(line, " \t\n", &savePtr);
+        if (command == NULL) {
+            continue;
+        }
+
+        if (strcmp(command, "quit") == 0) {
+            break;
+        }
+        if (strcmp(command, "isready") == 0) {
+            reply("readyok");
+            continue;
+        }
+        if (strcmp(command, "stop") == 0) {
+            stopSearch(&engine);
+            continue;
+        }
+        if (strcmp(command, "timeline") == 0) {
+            // The threads keep recording while their rings are written
+            char* path = strtok_r(NULL, " \t\n", &savePtr);
+            if (path == NULL || !dumpTimeline(path)) {
+                reply("info string cannot write timeline %s", (path != NULL) ? path : "");
+            }
+            continue;
+        }
+
+        // Any other command is handled once the search is over
+        stopSearch(&engine);
+
+        if (strcmp(command, "penguins") == 0) {
+            reply("id name penguin-game-mcts");
+            reply("penguinsok");
+
+        } else if (strcmp(command, "setoption") == 0) {
+            char* name = strtok_r(NULL, " \t\n", &savePtr);
+            char* value = strtok_r(NULL, " \t\n", &savePtr);
+            if (name != NULL) {
+                setOption(&engine, name, value);
+            }
+
+        } else if (strcmp(command, "newgame") == 0) {
+            char* seed = strtok_r(NULL, " \t\n", &savePtr);
+            srand((seed != NULL) ? (unsigned int) strtoul(seed, NULL, 10) : (unsigned int) time(NULL));
+            boardState* board = freshBoard();
+            initializeBoard(board);
+            setBoard(&engine, board);
+
+        } else if (strcmp(command, "map") == 0) {
+            char* path = strtok_r(NULL, " \t\n", &savePtr);
+            char* seed = strtok_r(NULL, " \t\n", &savePtr);
+            srand((seed != NULL) ? (unsigned int) strtoul(seed, NULL, 10) : (unsigned int) time(NULL));
+            boardState* board = (path != NULL) ? loadMap(path) : NULL;
+            if (board != NULL) {
+                setBoard(&engine, board);
+            } else {
+                reply("info string cannot load map %s", (path != NULL) ? path : "");
+            }
+
+        } else if (strcmp(command, "position") == 0) {
+            boardState* board = parsePosition(&savePtr);
+            if (board != NULL) {
+                setBoard(&engine, board);
+            } else {
+                reply("info string invalid position");
+            }
+
+        } else if (strcmp(command, "moves") == 0) {
+            char* token;
+            while ((token = strtok_r(NULL, " \t\n", &savePtr)) != NULL) {
+                applyMove(&engine, token);
+            }
+
+        } else if (strcmp(command, "go") == 0) {
+            searchLimits limits = {.iterations = 0, .moveTime = 0};
+            bool isInfinite = false;
+            char* token;
+            while ((token = strtok_r(NULL, " \t\n", &savePtr)) != NULL) {
+                char* value = NULL;
+                if (strcmp(token, "iterations") == 0 && (value = strtok_r(NULL, " \t\n", &savePtr)) != NULL) {
+                    limits.iterations = atoll(value);
+                } else if (strcmp(token, "movetime") == 0 && (value = strtok_r(NULL, " \t\n", &savePtr)) != NULL) {
+                    limits.moveTime = atof(value) / 1000.0;
+                } else if (strcmp(token, "infinite") == 0) {
+                    isInfinite = true;
+                }
+            }
+            if (engine.isDeterministic) {
+                // Only the iteration budget can stop a reproducible search
+                limits.moveTime = 0;
+                if (!isInfinite && limits.iterations <= 0) {
+                    limits.iterations = DETERMINISTIC_ITERATIONS;
+                }
+            }
+            if (!isInfinite && limits.iterations <= 0 && limits.moveTime <= 0) {
+                limits.moveTime = 1.0;
+            }
+            startSearch(&engine, limits);
+
+        } else if (strcmp(command, "print") == 0) {
+            printPosition(engine.board);
+
+        } else {
+            reply("info string unknown command %s", command);
+        }
+    }
+
+    stopSearch(&engine);
+    closeStatsFeed(engine.feed);
+    setBoard(&engine, NULL);
+
+    return 0;
+}
@@ -0,0 +1,134 @@
+#include "evaluation.h"
+
+// Static evaluation of a position, without playing it until the end :
+// every player is expected to collect the fishes of the tiles its penguins
+// can walk to before the opponent ones, and all the fishes of the ice
+// floes the opponent can no longer reach
+
+// Part of the fishes of a contested tile going to the closest player
+float TERRITORY_SHARE = 0.7;
+
+// Fish difference giving a 73% chance of winning (logistic scale)
+float EVALUATION_SCALE = 2.0;
+
+
+////////////////////////////////////////////////////////////////////////////
+// Static evaluation of positions
+
+int* neighbourTable(boardState* board) {
+    // The six neighbours of every cell, cells outside of the board are replaced
+    // by the extra cell nbCells, which is never walkable
+    int nbCells = board->sizeX * board->sizeY;
+    int* neighbours = malloc(6 * nbCells * sizeof(int));
+
+    for (int x = 0; x < board->sizeX; x++) {
+        for (int y = 0; y < board->sizeY; y++) {
+            boardPos adjacent[6];
+            adjacentTiles((boardPos) {.x = x, .y = y}, adjacent);
+            for (int k = 0; k < 6; k++) {
+                bool inside = (adjacent[k].x >= 0 && adjacent[k].x < board->sizeX && adjacent[k].y >= 0 && adjacent[k].y < board->sizeY);
+                neighbours[6 * (x * board->sizeY + y) + k] = inside ? adjacent[k].x * board->sizeY + adjacent[k].y : nbCells;
+            }
+        }
+    }
+
+    return neighbours;
+}
+
+void walkDistances(int nbCells, int* neighbours, uint8_t fishes[][EVALUATION_LANES], uint8_t distances[][EVALUATION_LANES]) {
+    // Number of steps from the pieces to every tile, for all the lanes at once
+    // Distances start at 0 on the pieces, tiles are relaxed until nothing changes
+    bool changed = true;
+
+    while (changed) {
+        uint8_t laneChanges = 0;
+
+        for (int cell = 0; cell < nbCells; cell++) {
+            int* cellNeighbours = &neighbours[6 * cell];
+            for (int lane = 0; lane < EVALUATION_LANES; lane++) {
+                uint8_t closest = UNREACHABLE;
+                for (int k = 0; k < 6; k++) {
+                    uint8_t distance = distances[cellNeighbours[k]][lane];
+                    closest = (distance < closest) ? distance : closest;
+                }
+                uint8_t walked = (fishes[cell][lane] > 0 && closest < UNREACHABLE) ? closest + 1 : UNREACHABLE;
+                uint8_t current = distances[cell][lane];
+                uint8_t updated = (walked < current) ? walked : current;
+                laneChanges |= (updated != current);
+                distances[cell][lane] = updated;
+            }
+        }
+
+        changed = (laneChanges != 0);
+    }
+}
+
+void evaluateLanes(boardState** boards, int nbBoards, int* neighbours, float* p1WinProbas) {
+    // Evaluation of up to EVALUATION_LANES boards of the same size
+    // Lanes beyond nbBoards are left empty
+    int nbCells = boards[0]->sizeX * boards[0]->sizeY;
+    int sizeY = boards[0]->sizeY;
+
+    uint8_t fishes[nbCells + 1][EVALUATION_LANES];
+    uint8_t p1Distances[nbCells + 1][EVALUATION_LANES];
+    uint8_t p2Distances[nbCells + 1][EVALUATION_LANES];
+    memset(fishes, 0, sizeof(fishes));
+    memset(p1Distances, UNREACHABLE, sizeof(p1Distances));
+    memset(p2Distances, UNREACHABLE, sizeof(p2Distances));
+
+    for (int lane = 0; lane < nbBoards; lane++) {
+        for (int cell = 0; cell < nbCells; cell++) {
+            int tile = boards[lane]->map[cell / sizeY][cell % sizeY];
+            fishes[cell][lane] = (tile >= 1 && tile <= 3) ? tile : 0;
+            p1Distances[cell][lane] = (tile == 4) ? 0 : UNREACHABLE;
+            p2Distances[cell][lane] = (tile == 5) ? 0 : UNREACHABLE;
+        }
+    }
+
+    walkDistances(nbCells, neighbours, fishes, p1Distances);
+    walkDistances(nbCells, neighbours, fishes, p2Distances);
+
+    float p1Fishes[EVALUATION_LANES] = {0};
+    float p2Fishes[EVALUATION_LANES] = {0};
+
+    for (int cell = 0; cell < nbCells; cell++) {
+        for (int lane = 0; lane < EVALUATION_LANES; lane++) {
+            uint8_t p1Distance = p1Distances[cell][lane];
+            uint8_t p2Distance = p2Distances[cell][lane];
+            float p1Share = (p1Distance < p2Distance) ? TERRITORY_SHARE : (p1Distance > p2Distance) ? 1.0f - TERRITORY_SHARE : 0.5f;
+            // A tile only one player can reach belongs to its ice floe
+            p1Share = (p2Distance == UNREACHABLE) ? 1.0f : (p1Distance == UNREACHABLE) ? 0.0f : p1Share;
+            float reachableFishes = (p1Distance < UNREACHABLE || p2Distance < UNREACHABLE) ? fishes[cell][lane] : 0.0f;
+            p1Fishes[lane] += p1Share * reachableFishes;
+            p2Fishes[lane] += (1.0f - p1Share) * reachableFishes;
+        }
+    }
+
+    for (int lane = 0; lane < nbBoards; lane++) {
+        // Draws are lost by P1, as in the random games
+        float difference = boards[lane]->p1Score + p1Fishes[lane] - boards[lane]->p2Score - p2Fishes[lane] - 0.5f;
+        p1WinProbas[lane] = 1.0f / (1.0f + expf(-difference / EVALUATION_SCALE));
+    }
+}
+
+void evaluateBoards(boardState** boards, int nbBoards, float* p1WinProbas) {
+    // Batch evaluation of boards of the same size, EVALUATION_LANES at a time
+    if (nbBoards == 0) {
+        return;
+    }
+
+    int* neighbours = neighbourTable(boards[0]);
+
+    for (int first = 0; first < nbBoards; first += EVALUATION_LANES) {
+        int nbLanes = (nbBoards - first < EVALUATION_LANES) ? nbBoards - first : EVALUATION_LANES;
+        evaluateLanes(&boards[first], nbLanes, neighbours, &p1WinProbas[first]);
+    }
+
+    free(neighbours);
+}
+
+float evaluateBoard(boardState* board) {
+    float p1WinProba;
+    evaluateBoards(&board, 1, &p1WinProba);
+    return p1WinProba;
+}
@@ -0,0 +1,35 @@
+#ifndef EVALUATION_H
+#define EVALUATION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "math.h"
+
+#include "board.h"
+
+////////////////////////////////////////////////////////////////////////////
+// Static evaluation parameters
+
+// Boards evaluated side by side, every step of the evaluation loops over them
+#define EVALUATION_LANES 16
+
+// Distance of the tiles no piece can walk to
+#define UNREACHABLE 255
+
+extern float TERRITORY_SHARE;
+extern float EVALUATION_SCALE;
+
+////////////////////////////////////////////////////////////////////////////
+// Static evaluation of positions
+
+int* neighbourTable(boardState* board);
+void walkDistances(int nbCells, int* neighbours, uint8_t fishes[][EVALUATION_LANES], uint8_t distances[][EVALUATION_LANES]);
+void evaluateLanes(boardState** boards, int nbBoards, int* neighbours, float* p1WinProbas);
+void evaluateBoards(boardState** boards, int nbBoards, float* p1WinProbas);
+float evaluateBoard(boardState* board);
+
+
+#endif
@@ -0,0 +1,233 @@
+#include "lockstep.h"
+
+// Uniform random games played PLAYOUT_LANES at a time from the same position :
+// the move counts, the random draws, the choice of the moves and the end of the
+// games are loops over the lanes without branches, only the chosen moves are
+// played lane by lane. The loops only go over the lanes of the batch, so that a
+// batch of a few games costs a few lanes. Every legal move is drawn with the same probability,
+// the games are the ones of randomGame with PLAYOUT_POLICY = 0
+
+
+////////////////////////////////////////////////////////////////////////////
+// Lane buffers of the threads
+
+typedef struct _laneBuffers {
+    // Tiles and pieces of the lanes, on the heap rather than on the stack of
+    // the thread and reused by its next batches of games
+    int nbCells;
+    int nbPieces; // Pieces plus the sentinel piece
+    uint8_t (*tiles)[PLAYOUT_LANES];
+    uint16_t (*pieceCells)[PLAYOUT_LANES];
+    uint8_t (*reaches)[6][PLAYOUT_LANES];
+    bool isRegistered;
+} laneBuffers;
+
+static _Thread_local laneBuffers threadLanes = {0};
+static pthread_key_t laneBuffersKey;
+static pthread_once_t laneBuffersOnce = PTHREAD_ONCE_INIT;
+
+static void releaseLaneBuffers(void* arg) {
+    laneBuffers* lanes = (laneBuffers*) arg;
+    free(lanes->tiles);
+    free(lanes->pieceCells);
+    free(lanes->reaches);
+    *lanes = (laneBuffers) {0};
+}
+
+static void createLaneBuffersKey() {
+    pthread_key_create(&laneBuffersKey, releaseLaneBuffers);
+}
+
+static laneBuffers* lanesFor(int nbCells, int nbPieces) {
+    // Buffers of the calling thread, large enough for the cells and pieces
+    laneBuffers* lanes = &threadLanes;
+    if (!lanes->isRegistered) {
+        pthread_once(&laneBuffersOnce, createLaneBuffersKey);
+        pthread_setspecific(laneBuffersKey, lanes);
+        lanes->isRegistered = true;
+    }
+
+    if (nbCells > lanes->nbCells) {
+        lanes->tiles = realloc(lanes->tiles, nbCells * sizeof(*lanes->tiles));
+        lanes->nbCells = nbCells;
+    }
+    if (nbPieces > lanes->nbPieces) {
+        lanes->pieceCells = realloc(lanes->pieceCells, nbPieces * sizeof(*lanes->pieceCells));
+        lanes->reaches = realloc(lanes->reaches, nbPieces * sizeof(*lanes->reaches));
+        lanes->nbPieces = nbPieces;
+    }
+    return lanes;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Uniform random games played in lockstep
+
+static int laneReach(const hexRays* rays, uint8_t tiles[][PLAYOUT_LANES], int lane, int cell, int direction) {
+    // Number of free ice tiles in a row from a cell, in one lane
+    int first = rays->rayStarts[6 * cell + direction];
+    int last = rays->rayStarts[6 * cell + direction + 1];
+
+    int k = first;
+    while (k < last && (uint8_t) (tiles[rays->stepCells[k]][lane] - 1) < 3) {
+        k++;
+    }
+    return k - first;
+}
+
+int lockstepRandomGames(boardState* board, int nbGames, uint32_t seed) {
+    // Plays nbGames random games (at most PLAYOUT_LANES) and returns the P1 wins
+    const int nbLanes = (nbGames < PLAYOUT_LANES) ? nbGames : PLAYOUT_LANES;
+    const hexRays* rays = board->rays;
+    int nbCells = board->sizeX * board->sizeY;
+    int nbP1Pieces = boardPosLSize(board->p1Pieces);
+    int nbPieces = nbP1Pieces + boardPosLSize(board->p2Pieces);
+
+    laneBuffers* lanes = lanesFor(nbCells, nbPieces + 1);
+    uint8_t (*tiles)[PLAYOUT_LANES] = lanes->tiles;
+    uint16_t (*pieceCells)[PLAYOUT_LANES] = lanes->pieceCells;
+    uint8_t (*reaches)[6][PLAYOUT_LANES] = lanes->reaches;
+
+    // Games still running all move or pass at every step, they share the player to play
+    int player = board->playerToPlay - 4;
+    int32_t scores[2][PLAYOUT_LANES];
+    uint8_t passes[PLAYOUT_LANES]; // Games are over after two passes in a row
+    uint32_t randoms[PLAYOUT_LANES];
+
+    for (int cell = 0; cell < nbCells; cell++) {
+        memset(tiles[cell], board->map[cell / board->sizeY][cell % board->sizeY], nbLanes);
+    }
+
+    // The pieces of P1 come first, then the ones of P2
+    int firstPieces[3] = {0, nbP1Pieces, nbPieces};
+    int piece = 0;
+    for (int owner = 0; owner < 2; owner++) {
+        boardPosL* posL = (owner == 0) ? board->p1Pieces : board->p2Pieces;
+        for (; posL != NULL; posL = posL->next) {
+            int cell = posL->pos.x * board->sizeY + posL->pos.y;
+            for (int lane = 0; lane < nbLanes; lane++) {
+                pieceCells[piece][lane] = cell;
+            }
+            for (int direction = 0; direction < 6; direction++) {
+                memset(reaches[piece][direction], laneReach(rays, tiles, 0, cell, direction), nbLanes);
+            }
+            piece++;
+        }
+    }
+
+    for (int lane = 0; lane < nbLanes; lane++) {
+        scores[0][lane] = board->p1Score;
+        scores[1][lane] = board->p2Score;
+        passes[lane] = 0;
+
+        // Independent streams of xorshift32, seeded with splitmix64
+        uint64_t z = seed + (lane + 1) * 0x9e3779b97f4a7c15ULL;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        randoms[lane] = (uint32_t) (z ^ (z >> 31)) | 1;
+    }
+
+    while (true) {
+        // Moves of the player to play in every lane
+        int32_t nbMoves[PLAYOUT_LANES] = {0};
+        for (int p = firstPieces[player]; p < firstPieces[player + 1]; p++) {
+            for (int direction = 0; direction < 6; direction++) {
+                for (int lane = 0; lane < nbLanes; lane++) {
+                    nbMoves[lane] += reaches[p][direction][lane];
+                }
+            }
+        }
+
+        // A game without moves passes, finished games neither move nor pass
+        uint8_t isPlaying[PLAYOUT_LANES];
+        uint8_t isMoving[PLAYOUT_LANES];
+        uint8_t nbPlaying = 0;
+        for (int lane = 0; lane < nbLanes; lane++) {
+            isPlaying[lane] = (passes[lane] < 2);
+            isMoving[lane] = isPlaying[lane] & (nbMoves[lane] > 0);
+            passes[lane] = isMoving[lane] ? 0 : passes[lane] + isPlaying[lane];
+            nbPlaying += isPlaying[lane];
+        }
+        if (nbPlaying == 0) {
+            break;
+        }
+
+        // Uniform draw of a move index, then of the piece, direction and step it stands for
+        uint32_t indexes[PLAYOUT_LANES];
+        for (int lane = 0; lane < nbLanes; lane++) {
+            uint32_t x = randoms[lane];
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            randoms[lane] = x;
+            indexes[lane] = (uint32_t) (((uint64_t) x * (uint32_t) nbMoves[lane]) >> 32);
+        }
+
+        uint16_t chosenPieces[PLAYOUT_LANES] = {0};
+        uint8_t chosenDirections[PLAYOUT_LANES] = {0};
+        uint8_t isChosen[PLAYOUT_LANES] = {0};
+        for (int p = firstPieces[player]; p < firstPieces[player + 1]; p++) {
+            for (int direction = 0; direction < 6; direction++) {
+                for (int lane = 0; lane < nbLanes; lane++) {
+                    uint32_t reach = reaches[p][direction][lane];
+                    uint8_t isHere = !isChosen[lane] & (indexes[lane] < reach);
+                    chosenPieces[lane] = isHere ? p : chosenPieces[lane];
+                    chosenDirections[lane] = isHere ? direction : chosenDirections[lane];
+                    indexes[lane] -= (isChosen[lane] | isHere) ? 0 : reach;
+                    isChosen[lane] |= isHere;
+                }
+            }
+        }
+
+        // The chosen moves are played lane by lane, the moving piece walks its
+        // six rays again and the pieces whose rays went through its end tile stop there
+        for (int lane = 0; lane < nbLanes; lane++) {
+            if (!isMoving[lane]) {
+                continue;
+            }
+            int p = chosenPieces[lane];
+            int start = pieceCells[p][lane];
+            int end = rays->stepCells[rays->rayStarts[6 * start + chosenDirections[lane]] + indexes[lane]];
+
+            scores[player][lane] += tiles[end][lane];
+            tiles[end][lane] = 4 + player;
+            tiles[start][lane] = 0;
+            pieceCells[p][lane] = end;
+
+            for (int direction = 0; direction < 6; direction++) {
+                int reach = laneReach(rays, tiles, lane, end, direction);
+                reaches[p][direction][lane] = reach;
+
+                int blocking = rays->rayStarts[6 * end + direction] + reach;
+                if (blocking == rays->rayStarts[6 * end + direction + 1] || tiles[rays->stepCells[blocking]][lane] < 4) {
+                    continue;
+                }
+                // The piece standing there, the sentinel piece nbPieces never does
+                int other = 0;
+                pieceCells[nbPieces][lane] = rays->stepCells[blocking];
+                while (pieceCells[other][lane] != rays->stepCells[blocking]) {
+                    other++;
+                }
+                reaches[other][OPPOSITE_DIRECTIONS[direction]][lane] = reach;
+            }
+        }
+
+        player = 1 - player;
+    }
+
+    int nbP1Wins = 0;
+    for (int lane = 0; lane < nbLanes; lane++) {
+        nbP1Wins += (scores[0][lane] > scores[1][lane]);
+    }
+    return nbP1Wins;
+}
+
+int lockstepWins(boardState* board, int nbGames, uint32_t seed) {
+    // Any number of games, PLAYOUT_LANES at a time
+    int nbP1Wins = 0;
+    for (int first = 0; first < nbGames; first += PLAYOUT_LANES) {
+        int nbLanes = (nbGames - first < PLAYOUT_LANES) ? nbGames - first : PLAYOUT_LANES;
+        nbP1Wins += lockstepRandomGames(board, nbLanes, seed + first);
+    }
+    return nbP1Wins;
+}
@@ -0,0 +1,25 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "board.h"
+
+////////////////////////////////////////////////////////////////////////////
+// Lockstep random games parameters
+
+// Random games played side by side, every step of the games loops over them
+#define PLAYOUT_LANES 16
+
+////////////////////////////////////////////////////////////////////////////
+// Uniform random games played in lockstep
+
+int lockstepRandomGames(boardState* board, int nbGames, uint32_t seed);
+int lockstepWins(boardState* board, int nbGames, uint32_t seed);
+
+
+#endif
@@ -1,3 +1,4 @@
+#include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
 #include <assert.h>
@@ -8,22 +9,101 @@
 
 #include "render.h"
 #include "monte-carlo.h"
+#include "opening-book.h"
 
 
 // Penguin game with Monte-Carlo Tree Search
 
+typedef struct _searchBudget {
+    // Number of tree descents per frame, so that the search fills the time
+    // left by everything else before the end of the frame
+    double frameTime; // Target duration of a frame
+    double margin; // Kept free for the spikes
+    double iterationCost; // Moving averages of the measured costs, in seconds
+    double otherCost;
+    int nbSteps;
+} searchBudget;
+
+// Weight of the last measure in the moving averages
+const double BUDGET_SMOOTHING = 0.1;
+const int MAX_STEPS_PER_FRAME = 100000;
+
+searchBudget newSearchBudget(int targetFPS) {
+    return (searchBudget) {.frameTime = 1.0 / targetFPS, .margin = 0.002, .iterationCost = 0.0, .otherCost = 0.0, .nbSteps = 10};
+}
+
+void recordSearchCost(searchBudget* budget, int nbSteps, double elapsed) {
+    double iterationCost = elapsed / nbSteps;
+    if (budget->iterationCost <= 0.0) {
+        budget->iterationCost = iterationCost;
+    } else {
+        budget->iterationCost += BUDGET_SMOOTHING * (iterationCost - budget->iterationCost);
+    }
+}
+
+void recordFrameCost(searchBudget* budget, double frameElapsed, double searchElapsed) {
+    // Everything but the search, then the number of steps for the next frame
+    budget->otherCost += BUDGET_SMOOTHING * (frameElapsed - searchElapsed - budget->otherCost);
+
+    // The number of steps at most doubles from a frame to the next, a run of
+    // cheap descents must not let one expensive frame through
+    double available = budget->frameTime - budget->margin - budget->otherCost;
+    int nbSteps = (budget->iterationCost > 0.0) ? (int) (available / budget->iterationCost) : budget->nbSteps;
+    int maxSteps = (2 * budget->nbSteps < MAX_STEPS_PER_FRAME) ? 2 * budget->nbSteps : MAX_STEPS_PER_FRAME;
+    budget->nbSteps = (nbSteps < 1) ? 1 : (nbSteps > maxSteps) ? maxSteps : nbSteps;
+}
+
+typedef struct _bookProbe {
+    // Answer of the opening book for the current position, the book is only
+    // searched again once a move changed the position
+    bool isProbed;
+    bool isInBook;
+    boardMove move;
+} bookProbe;
+
+bool isInBook(bookProbe* probe, openingBook* book, boardState* board) {
+    if (!probe->isProbed) {
+        probe->isInBook = probeOpeningBook(book, board, &probe->move);
+        probe->isProbed = true;
+    }
+    return probe->isInBook;
+}
+
+void forgetBookProbe(bookProbe* probe) {
+    probe->isProbed = false;
+}
+
+boardMove suggestedMove(bookProbe* probe, openingBook* book, mcts* tree, boardState* board) {
+    // Book move if the position is known, most visited move otherwise
+    return isInBook(probe, book, board) ? probe->move : bestMove(tree);
+}
+
+int thinkingFrames(bookProbe* probe, openingBook* book, boardState* board, int aiThinkingFrames) {
+    // No need to think when the position is in the opening book
+    if (isInBook(probe, book, board)) {
+        return 1;
+    }
+    return aiThinkingFrames;
+}
 
 int main(void) {
 
-    srand(time(NULL));
+    seedSearchRandom(time(NULL), 0);
 
     // Window initialisation
     InitWindow(0, 0, "Jeu des pingouins");
     const int WINDOWS_SIZE_X = GetScreenWidth();
     const int WINDOWS_SIZE_Y = GetScreenHeight();
-    SetTargetFPS(60);
+    const int TARGET_FPS = 60; // Paced by the main loop itself, see the end of the loop
 
-    // Board initialisation
+    // The resources are found next to the executable, wherever it is started from
+    char resourcesDir[1024];
+    snprintf(resourcesDir, sizeof(resourcesDir), "%s../resources", GetApplicationDirectory());
+    openingBook* book = loadOpeningBook(TextFormat("%s/opening.book", resourcesDir));
+    bookProbe probe = {.isProbed = false};
+
+    // Board initialisation, with one of the fish layouts of the book if there is one
+    srand(bookLayoutSeed(book, time(NULL)));
     boardState* mainBoard = freshBoard();
     initializeBoard(mainBoard);
 
@@ -36,16 +116,24 @@ int main(void) {
     camera.up = (Vector3){ 0.0f, 1.0f, 0.0f };
     camera.fovy = 45.0f;
 
-    // 3D models and animation stuff
-    load3DModels();
+    // 3D models and animation stuff, streamed in while the game already runs
+    const double ASSET_UPLOAD_TIME = 0.004; // Seconds per frame spent uploading models and textures
+    startLoadingAssets(resourcesDir);
     pieceModelL* piecesModels = createPiecesModels(mainBoard);
     assert(piecesModels != NULL);
+    updateBoardRender(mainBoard);
 
     // Monte-Carlo Tree initialisation
     mcts* tree = newMCTS(mainBoard);
     int countDown = 0;
     const int AI_THINKING_FRAMES = 300;
-    const int NB_TREE_STEPS = 10;
+    searchBudget budget = newSearchBudget(TARGET_FPS);
+    const double RECLAIM_TIME = 0.002; // Seconds per frame spent freeing discarded subtrees
+    treeReclaimer* reclaimer = newTreeReclaimer();
+
+    // Timeline of the frames, recorded from T to T again and then written as a Chrome trace
+    const char* TIMELINE_PATH = "penguins-timeline.json";
+    nameTimelineThread("main");
 
     // Interface 
     bool showDetails = true;
@@ -56,6 +144,8 @@ int main(void) {
     // Main loop of the game
     while (!WindowShouldClose()) {
 
+        double frameStart = GetTime();
+
         // Cam update
         camAngle += dtheta;
         camera.position = (Vector3){cos(camAngle) * 35.0f + 18.0f, 30.0f, sin(camAngle) * 35.0f + 24.0f };
@@ -78,38 +168,68 @@ int main(void) {
         if (IsKeyPressed(KEY_SPACE)) {
             gameMode = (gameMode + 1) % 3;
             if (countDown == 0 && (gameMode == 1 || gameMode == 2)) {
-                countDown = AI_THINKING_FRAMES;
+                countDown = thinkingFrames(&probe, book, mainBoard, AI_THINKING_FRAMES);
             }
         }
         if (IsKeyPressed(KEY_D)) {
             makePiecesDance(piecesModels);
         }
+        if (IsKeyPressed(KEY_T)) {
+            setTimelineEnabled(!isTimelineEnabled());
+            if (!isTimelineEnabled()) {
+                dumpTimeline(TIMELINE_PATH);
+            }
+        }
+        int64_t frameSpan = timelineBegin();
 
         // The AI is thinking...
-        mctsSteps(tree, mainBoard, NB_TREE_STEPS);
+        double searchStart = GetTime();
+        int64_t span = timelineBegin();
+        mctsSteps(tree, mainBoard, budget.nbSteps);
+        timelineEnd("mctsSteps", span);
+        double searchElapsed = GetTime() - searchStart;
+        recordSearchCost(&budget, budget.nbSteps, searchElapsed);
+
+        // ...while the subtrees of the previous moves are freed little by little
+        double reclaimStart = GetTime();
+        span = timelineBegin();
+        while (GetTime() - reclaimStart < RECLAIM_TIME && reclaimNodes(reclaimer, 1000) > 0) {}
+        timelineEnd("reclaim", span);
+        if (isTimelineEnabled()) {
+            timelineCounter("nodes", nbLiveNodes());
+        }
+
+        if (!areAssetsLoaded()) {
+            span = timelineBegin();
+            streamAssets(ASSET_UPLOAD_TIME);
+            timelineEnd("streamAssets", span);
+        }
 
         // The AI is moving
         if (countDown == 1) {
             if (tree->nbSons > 0) {
-                boardMove suggestedMove = bestMove(tree);
-
-                movePenguin(mainBoard, suggestedMove);
-                tree = makeMove(tree, suggestedMove);
+                boardMove aiMove = suggestedMove(&probe, book, tree, mainBoard);
+
+                movePenguin(mainBoard, aiMove);
+                forgetBookProbe(&probe);
+                updateBoardRender(mainBoard);
+                span = timelineBegin();
+                tree = makeMoveDeferred(reclaimer, tree, aiMove);
+                timelineEnd("makeMove", span);
                 assert(tree != NULL);
 
-                updatePiecesWithMove(piecesModels, suggestedMove);
+                updatePiecesWithMove(piecesModels, aiMove);
             } 
-            if (gameMode == 2) {
-                // In a AI vs AI game, AI thinks again
-                countDown = AI_THINKING_FRAMES;
-            }     
-        }
-        if (countDown > 0) {
+            // In a AI vs AI game, AI thinks again, the count down is not
+            // decremented this frame so that a book move is played on the next
+            countDown = (gameMode == 2) ? thinkingFrames(&probe, book, mainBoard, AI_THINKING_FRAMES) : 0;
+        } else if (countDown > 0) {
             countDown -= 1;
         }
        
 
         // Board rendering
+        int64_t renderSpan = timelineBegin();
         BeginDrawing();
 
         ClearBackground(RAYWHITE);
@@ -119,20 +239,25 @@ int main(void) {
         renderPieces(piecesModels);
 
         if (countDown > 0 && tree->nbSons > 0) {
-            boardMove suggestedMove = bestMove(tree);
-            drawMove(suggestedMove);
+            drawMove(suggestedMove(&probe, book, tree, mainBoard));
         }
 
+        span = timelineBegin();
         boardMoveL* movesDetected = updateSelectedPos(mainBoard, camera, piecesModels, IsMouseButtonPressed(MOUSE_BUTTON_LEFT));
+        timelineEnd("updateSelectedPos", span);
         if (movesDetected != NULL && countDown == 0) {
             boardMove moveToDo = movesDetected->move;
             movePenguin(mainBoard, moveToDo);
+            forgetBookProbe(&probe);
+            updateBoardRender(mainBoard);
             updatePiecesWithMove(piecesModels, moveToDo);
-            tree = makeMove(tree, moveToDo);
+            span = timelineBegin();
+            tree = makeMoveDeferred(reclaimer, tree, moveToDo);
+            timelineEnd("makeMove", span);
             assert(tree != NULL);
 
             if (gameMode == 1) {
-                countDown = AI_THINKING_FRAMES;
+                countDown = thinkingFrames(&probe, book, mainBoard, AI_THINKING_FRAMES);
             }
         }
         freeBoardMoveL(movesDetected);
@@ -145,20 +270,34 @@ int main(void) {
         DrawFPS(10, 10);
 
         if (showDetails) {
-            DrawText(TextFormat("Tree size : %i", treeSize(tree)), WINDOWS_SIZE_X / 4, WINDOWS_SIZE_Y / 9, WINDOWS_SIZE_X / 48, WHITE);
+            DrawText(TextFormat("Tree size : %i (%i per frame)", treeSize(tree), budget.nbSteps), WINDOWS_SIZE_X / 4, WINDOWS_SIZE_Y / 9, WINDOWS_SIZE_X / 48, WHITE);
             drawWinningEstimation(WINDOWS_SIZE_X / 4, WINDOWS_SIZE_Y / 15, WINDOWS_SIZE_X / 2, (float) tree->nbP1Wins / (float) tree->nbVisits);
 
             if (gameMode == 0) {DrawText("Duel mode (space to change)", WINDOWS_SIZE_X / 4, WINDOWS_SIZE_Y / 40, WINDOWS_SIZE_X / 48, WHITE);}
             if (gameMode == 1) {DrawText("Human vs AI mode (space to change)", WINDOWS_SIZE_X / 4, WINDOWS_SIZE_Y / 40, WINDOWS_SIZE_X / 48, WHITE);}
             if (gameMode == 2) {DrawText("AI vs AI mode (space to change)", WINDOWS_SIZE_X / 4, WINDOWS_SIZE_Y / 40, WINDOWS_SIZE_X / 48, WHITE);}
+            if (isTimelineEnabled()) {DrawText("Recording the timeline (T to save it)", WINDOWS_SIZE_X / 4, WINDOWS_SIZE_Y / 7, WINDOWS_SIZE_X / 48, WHITE);}
         }
 
-        
-
         EndDrawing();
+        timelineEnd("render", renderSpan);
+
+        // The frame is measured once the batch is flushed and the buffers swapped,
+        // the game then waits for the next frame itself
+        double frameElapsed = GetTime() - frameStart;
+        recordFrameCost(&budget, frameElapsed, searchElapsed);
+        if (frameElapsed > budget.frameTime) {
+            timelineInstant("hitch");
+        }
+        timelineEnd("frame", frameSpan);
+        if (frameElapsed < budget.frameTime) {
+            WaitTime(budget.frameTime - frameElapsed);
+        }
     }
 
     freeMCTS(tree);
+    freeTreeReclaimer(reclaimer);
+    freeOpeningBook(book);
     freeBoardState(mainBoard);
     unloadAllModels(piecesModels);
     CloseWindow();
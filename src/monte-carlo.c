@@ -4,97 +4,469 @@
 // https://en.wikipedia.org/wiki/Monte_Carlo_tree_search
 
 // Number of random games played to estimate a node
-const int NB_SIMS = 4;
+_Thread_local int NB_SIMS = 4;
 
 // Tradeoff between exploration (big value) and exploitation (low value)
-const float EXPLORATION_CONSTANT = 1.41;
+_Thread_local float EXPLORATION_CONSTANT = 1.41;
 
+// Progressive widening : only the first 1 + C * n^alpha sons of a node visited
+// n times are considered, C = 0 considers every son
+_Thread_local float WIDENING_COEFFICIENT = 0.0;
+_Thread_local float WIDENING_EXPONENT = 0.5;
+
+// Weight of the heuristic priors in a PUCT selection, which then replaces
+// the exploration constant, 0 falls back to plain UCB
+_Thread_local float PRIOR_WEIGHT = 2.0;
+
+// Heuristic priors : softmax of a score made of the fishes on the target tile,
+// the ice around it and its closeness to the opponent pieces
+const float PRIOR_FISH_WEIGHT = 1.0;
+const float PRIOR_MOBILITY_WEIGHT = 0.3;
+const float PRIOR_CONTEST_WEIGHT = 1.0;
+
+// Random games policy : 0 plays uniformly at random, 1 plays heavy playouts
+// which favour tiles with many fishes and with free ice around
+_Thread_local int PLAYOUT_POLICY = 0;
+
+// Uniform random games without AMAF trace are played up to PLAYOUT_LANES at a
+// time by lockstepRandomGames, 0 plays them one by one with randomGame
+_Thread_local int LOCKSTEP_PLAYOUTS = 1;
+
+// Heavy playouts weights, by number of fishes and by number of free adjacent tiles
+const int FISH_WEIGHTS[4] = {0, 1, 2, 4};
+const int MOBILITY_WEIGHTS[7] = {1, 2, 3, 4, 4, 4, 4};
+
+// RAVE : the win ratio of a son is blended with the results of the games where
+// the same player moved to the same tile later on (all moves as first), with the
+// weight sqrt(K / (3n + K)) after n visits of the son, K = 0 disables RAVE
+_Thread_local float RAVE_EQUIVALENCE = 0.0;
+
+// Leaf evaluation : 0 plays random games, 1 uses the static evaluation of the
+// leaves, 2 averages both ; static evaluations are made by batches of descents,
+// the nodes waiting for them count as lost for the player choosing them
+_Thread_local int LEAF_EVALUATION = 0;
+_Thread_local int EVALUATION_BATCH = 16;
+
+// Random numbers of the search, one stream per thread (PCG32), so that a search
+// seeded the same way with the same budget builds the same tree
+static _Thread_local uint64_t randomState = 0x853c49e6748fea9bULL;
+static _Thread_local uint64_t randomIncrement = 0xda3e39cb94b95bdbULL;
+
+
+
+////////////////////////////////////////////////////////////////////////////
+// Search parameters of a thread
+
+searchSettings currentSearchSettings() {
+    return (searchSettings) {
+        .nbSims = NB_SIMS,
+        .explorationConstant = EXPLORATION_CONSTANT,
+        .wideningCoefficient = WIDENING_COEFFICIENT,
+        .wideningExponent = WIDENING_EXPONENT,
+        .priorWeight = PRIOR_WEIGHT,
+        .playoutPolicy = PLAYOUT_POLICY,
+        .lockstepPlayouts = LOCKSTEP_PLAYOUTS,
+        .raveEquivalence = RAVE_EQUIVALENCE,
+        .leafEvaluation = LEAF_EVALUATION,
+        .evaluationBatch = EVALUATION_BATCH,
+    };
+}
+
+void useSearchSettings(const searchSettings* settings) {
+    // A thread searching for another one takes its parameters first
+    NB_SIMS = settings->nbSims;
+    EXPLORATION_CONSTANT = settings->explorationConstant;
+    WIDENING_COEFFICIENT = settings->wideningCoefficient;
+    WIDENING_EXPONENT = settings->wideningExponent;
+    PRIOR_WEIGHT = settings->priorWeight;
+    PLAYOUT_POLICY = settings->playoutPolicy;
+    LOCKSTEP_PLAYOUTS = settings->lockstepPlayouts;
+    RAVE_EQUIVALENCE = settings->raveEquivalence;
+    LEAF_EVALUATION = settings->leafEvaluation;
+    EVALUATION_BATCH = settings->evaluationBatch;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Random streams of the search
+
+void seedSearchRandom(uint64_t seed, uint64_t stream) {
+    // Streams of the same seed never overlap, every thread takes its own
+    randomState = 0;
+    randomIncrement = (stream << 1) | 1;
+    searchRandom();
+    randomState += seed;
+    searchRandom();
+}
+
+uint32_t searchRandom() {
+    uint64_t state = randomState;
+    randomState = state * 6364136223846793005ULL + randomIncrement;
+    uint32_t shifted = (uint32_t) (((state >> 18) ^ state) >> 27);
+    uint32_t rotation = (uint32_t) (state >> 59);
+    return (shifted >> rotation) | (shifted << ((-rotation) & 31));
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Compact nodes and moves
+
+// All the nodes of all the trees live in a pool of chunks that never move,
+// sons are linked by their 32 bits index in the pool instead of a pointer
+#define NODE_CHUNK_BITS 16
+#define NODE_CHUNK_SIZE (1 << NODE_CHUNK_BITS)
+#define MAX_NODE_CHUNKS (1 << 16)
+
+// Free nodes moved at once between a thread and the shared free list
+#define NODE_BATCH 1024
+
+typedef struct _nodeCache {
+    // Nodes of a thread, no other thread touches them : its free nodes,
+    // chained through their number of visits, and the rest of its last chunk
+    nodeIndex freeNodes;
+    nodeIndex lastFreeNode;
+    int nbFreeNodes;
+    nodeIndex nextFresh;
+    nodeIndex endFresh;
+    bool isRegistered;
+} nodeCache;
+
+static mcts* nodeChunks[MAX_NODE_CHUNKS];
+static int nbNodeChunks = 0;
+static atomic_int nbAllocatedNodes = 0;
+
+// Free nodes given back by the threads with too many of them, or which ended,
+// the mutex is only taken to move whole batches of nodes
+static nodeIndex sharedFreeNodes = 0;
+static nodeIndex lastSharedFreeNode = 0;
+static pthread_mutex_t poolMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static _Thread_local nodeCache threadNodes = {0};
+static pthread_key_t nodeCacheKey;
+static pthread_once_t nodeCacheOnce = PTHREAD_ONCE_INIT;
+
+packedMove packMove(boardMove move) {
+    return (packedMove) ((uint32_t) move.start.x << 24 | (uint32_t) move.start.y << 16 | (uint32_t) move.end.x << 8 | (uint32_t) move.end.y);
+}
+
+boardMove unpackMove(packedMove move) {
+    return (boardMove) {
+        .start = (boardPos) {.x = move >> 24, .y = (move >> 16) & 0xff},
+        .end = (boardPos) {.x = (move >> 8) & 0xff, .y = move & 0xff}
+    };
+}
+
+mcts* nodeAt(nodeIndex index) {
+    return &nodeChunks[index >> NODE_CHUNK_BITS][index & (NODE_CHUNK_SIZE - 1)];
+}
+
+boardMove sonMove(mcts* tree, int sonIndex) {
+    return unpackMove(tree->sons[sonIndex].move);
+}
+
+mcts* sonNode(mcts* tree, int sonIndex) {
+    // NULL for a son never selected, see getSon to create it
+    nodeIndex son = tree->sons[sonIndex].son;
+    return (son == 0) ? NULL : nodeAt(son);
+}
+
+amafStats* sonsAmaf(mcts* tree) {
+    return tree->hasAmaf ? (amafStats*) &tree->sons[tree->nbSons] : NULL;
+}
+
+int nbLiveNodes() {
+    // Nodes of all the trees, discarded ones included until they are reclaimed
+    return atomic_load_explicit(&nbAllocatedNodes, memory_order_relaxed);
+}
+
+size_t treeMemory(mcts* tree) {
+    // Bytes used by the nodes and the sons arrays of a tree
+    size_t nbBytes = 0;
+    int capacity = 1024;
+    int nbNodes = 0;
+    mcts** stack = malloc(capacity * sizeof(mcts*));
+    stack[nbNodes++] = tree;
+
+    while (nbNodes > 0) {
+        mcts* node = stack[--nbNodes];
+        nbBytes += sizeof(mcts) + node->nbSons * (sizeof(sonEntry) + (node->hasAmaf ? sizeof(amafStats) : 0));
+
+        for (int i = 0; i < node->nbSons; i++) {
+            if (node->sons[i].son == 0) {
+                continue;
+            }
+            if (nbNodes == capacity) {
+                capacity *= 2;
+                stack = realloc(stack, capacity * sizeof(mcts*));
+            }
+            stack[nbNodes++] = nodeAt(node->sons[i].son);
+        }
+    }
+
+    free(stack);
+    return nbBytes;
+}
 
 
 ////////////////////////////////////////////////////////////////////////////
 // Monte-Carlo Tree data structure initialization and free
 
+static void giveBackNodes(nodeCache* nodes, bool isThreadOver) {
+    // All the free nodes of a thread go to the shared list, the rest of its
+    // chunk included when the thread is over
+    if (isThreadOver) {
+        while (nodes->nextFresh < nodes->endFresh) {
+            nodeIndex index = nodes->nextFresh++;
+            nodeAt(index)->nbVisits = (int) nodes->freeNodes;
+            nodes->freeNodes = index;
+            nodes->lastFreeNode = (nodes->lastFreeNode == 0) ? index : nodes->lastFreeNode;
+        }
+    }
+    if (nodes->freeNodes == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&poolMutex);
+    nodeAt(nodes->lastFreeNode)->nbVisits = (int) sharedFreeNodes;
+    sharedFreeNodes = nodes->freeNodes;
+    if (lastSharedFreeNode == 0) {
+        lastSharedFreeNode = nodes->lastFreeNode;
+    }
+    pthread_mutex_unlock(&poolMutex);
+
+    nodes->freeNodes = 0;
+    nodes->lastFreeNode = 0;
+    nodes->nbFreeNodes = 0;
+}
+
+static void releaseNodeCache(void* cache) {
+    giveBackNodes((nodeCache*) cache, true);
+}
+
+static void createNodeCacheKey() {
+    pthread_key_create(&nodeCacheKey, releaseNodeCache);
+}
+
+static void refillNodes(nodeCache* nodes) {
+    // A batch of the shared free nodes, or a new chunk when there are none
+    if (!nodes->isRegistered) {
+        pthread_once(&nodeCacheOnce, createNodeCacheKey);
+        pthread_setspecific(nodeCacheKey, nodes);
+        nodes->isRegistered = true;
+    }
+
+    pthread_mutex_lock(&poolMutex);
+    if (sharedFreeNodes != 0) {
+        nodes->freeNodes = sharedFreeNodes;
+        nodeIndex last = sharedFreeNodes;
+        int nbTaken = 1;
+        while (nbTaken < NODE_BATCH && nodeAt(last)->nbVisits != 0) {
+            last = (nodeIndex) nodeAt(last)->nbVisits;
+            nbTaken++;
+        }
+        sharedFreeNodes = (nodeIndex) nodeAt(last)->nbVisits;
+        lastSharedFreeNode = (sharedFreeNodes == 0) ? 0 : lastSharedFreeNode;
+        nodeAt(last)->nbVisits = 0;
+        nodes->lastFreeNode = last;
+        nodes->nbFreeNodes = nbTaken;
+    } else {
+        int chunk = nbNodeChunks++;
+        nodeChunks[chunk] = malloc(NODE_CHUNK_SIZE * sizeof(mcts));
+        // Index 0 is no node
+        nodes->nextFresh = (chunk == 0) ? 1 : (nodeIndex) chunk << NODE_CHUNK_BITS;
+        nodes->endFresh = ((nodeIndex) chunk + 1) << NODE_CHUNK_BITS;
+    }
+    pthread_mutex_unlock(&poolMutex);
+}
+
 mcts* createNode() { 
-    // New node in the heap with no sons initialized yet
-    mcts* newNode = malloc(sizeof(mcts));
+    // New node of the pool with no sons initialized yet, taken from the nodes
+    // of the calling thread
+    nodeCache* nodes = &threadNodes;
+    if (nodes->freeNodes == 0 && nodes->nextFresh == nodes->endFresh) {
+        refillNodes(nodes);
+    }
+
+    nodeIndex index;
+    if (nodes->freeNodes != 0) {
+        index = nodes->freeNodes;
+        nodes->freeNodes = (nodeIndex) nodeAt(index)->nbVisits;
+        nodes->lastFreeNode = (nodes->freeNodes == 0) ? 0 : nodes->lastFreeNode;
+        nodes->nbFreeNodes--;
+    } else {
+        index = nodes->nextFresh++;
+    }
+    atomic_fetch_add_explicit(&nbAllocatedNodes, 1, memory_order_relaxed);
+
+    mcts* newNode = nodeAt(index);
     newNode->nbVisits = 0;
     newNode->nbP1Wins = 0;
-    newNode->nbP2Wins = 0;
+    newNode->nbPendingVisits = 0;
 
-    newNode->moveArray = NULL;
-    newNode->sonsArray = NULL;
+    newNode->nbSons = 0;
+    newNode->hasPriors = false;
+    newNode->hasAmaf = false;
+    newNode->index = index;
+    newNode->sons = NULL;
     
     return newNode;
 }
 
-int initNode(mcts* node, boardState* board) {
-    // Get the sons of a node and creates the sons array
-    int nbWins = nbWinsFromRandomGames(board, NB_SIMS);
+int initNode(mcts* node, boardState* board, amafTrace* trace) {
+    // Estimate a new node with random games and creates the sons array
+    int nbWins = nbWinsFromRandomGames(board, NB_SIMS, trace);
     node->nbVisits += NB_SIMS;
-
-    boardMoveL* allMoves = allPossibleMoves(board);
-
     node->nbP1Wins += nbWins;
-    node->nbP2Wins += NB_SIMS - nbWins;
 
-    node->nbSons = boardMoveLSize(allMoves);
+    expandNode(node, board);
 
     if (node->nbSons == 0) {
-        // Final node : if there is at least one way to win
-        // for the only remaining player, it wins
-        if (board->playerToPlay == 4 && nbWins < NB_SIMS) {
-            nbWins = 0;
-        }
-        if (board->playerToPlay == 5 && nbWins > 0) {
-            nbWins = NB_SIMS;
-        }
+        nbWins = finalNodeWins(board, nbWins);
+    } else if (trace != NULL) {
+        updateAmaf(node, board->playerToPlay, trace);
+    }
 
-    } else {
-        // Sons array initialization
-        node->moveArray = (boardMove*) calloc(node->nbSons, sizeof(boardMove));
-        node->sonsArray = (mcts**) calloc(node->nbSons, sizeof(mcts*));
+    return nbWins;
+}
+
+void expandNode(mcts* node, boardState* board) {
+    // Get the sons of a node and creates the sons array
+    boardMoveL* allMoves = allPossibleMoves(board);
+    node->nbSons = boardMoveLSize(allMoves);
+
+    if (node->nbSons > 0) {
+        // Sons array initialization, sons only exist as moves
+        // until they are selected for the first time
+        node->hasAmaf = (RAVE_EQUIVALENCE > 0);
+        size_t amafSize = node->hasAmaf ? sizeof(amafStats) : 0;
+        node->sons = (sonEntry*) calloc(node->nbSons, sizeof(sonEntry) + amafSize);
 
         int i = 0;
         boardMoveL* sonList = allMoves;
         while (sonList != NULL) {
-            node->moveArray[i] = sonList->move;
-            node->sonsArray[i] = createNode();
+            node->sons[i].move = packMove(sonList->move);
             i++;
             sonList = sonList->next;
         }
+
+        if (PRIOR_WEIGHT > 0) {
+            computePriors(node, board);
+        } else if (WIDENING_COEFFICIENT > 0) {
+            // Widening considers the first sons, they are shuffled to avoid any bias
+            for (int j = node->nbSons - 1; j > 0; j--) {
+                int k = searchRandom() % (j + 1);
+                packedMove move = node->sons[j].move;
+                node->sons[j].move = node->sons[k].move;
+                node->sons[k].move = move;
+            }
+        }
     }
 
     freeBoardMoveL(allMoves);
+}
+
+int finalNodeWins(boardState* board, int nbWins) {
+    // Final node : if there is at least one way to win
+    // for the only remaining player, it wins
+    if (board->playerToPlay == 4 && nbWins < NB_SIMS) {
+        nbWins = 0;
+    }
+    if (board->playerToPlay == 5 && nbWins > 0) {
+        nbWins = NB_SIMS;
+    }
     return nbWins;
 }
 
 mcts* newMCTS(boardState* board) {
     mcts* newTree = createNode();
-    int nbWins = initNode(newTree, board);
+    int nbWins = initNode(newTree, board, NULL);
     return newTree;
 }
 
+mcts* getSon(mcts* tree, int sonIndex) {
+    // Sons are allocated the first time they are needed
+    if (tree->sons[sonIndex].son == 0) {
+        tree->sons[sonIndex].son = createNode()->index;
+    }
+    return nodeAt(tree->sons[sonIndex].son);
+}
+
+int sonNbVisits(mcts* tree, int sonIndex) {
+    nodeIndex son = tree->sons[sonIndex].son;
+    return (son == 0) ? 0 : nodeAt(son)->nbVisits;
+}
+
 int treeSize(mcts* tree) {
     return tree->nbVisits / NB_SIMS;
 }
 
+static uint64_t mixChecksum(uint64_t checksum, int value) {
+    return (checksum ^ (uint32_t) value) * 0x100000001b3ULL;
+}
+
+uint64_t treeChecksum(mcts* tree) {
+    // FNV-1a hash of the statistics and moves of every node, depth first,
+    // two searches gave the same tree when they give the same checksum
+    uint64_t checksum = 0xcbf29ce484222325ULL;
+    int capacity = 1024;
+    int nbNodes = 0;
+    mcts** stack = malloc(capacity * sizeof(mcts*));
+    stack[nbNodes++] = tree;
+
+    while (nbNodes > 0) {
+        mcts* node = stack[--nbNodes];
+        int values[4] = {node->nbVisits, node->nbP1Wins, node->nbVisits - node->nbP1Wins, node->nbSons};
+        for (int i = 0; i < 4; i++) {
+            checksum = mixChecksum(checksum, values[i]);
+        }
+        for (int i = 0; i < node->nbSons; i++) {
+            boardMove move = sonMove(node, i);
+            checksum = mixChecksum(mixChecksum(checksum, move.start.x), move.start.y);
+            checksum = mixChecksum(mixChecksum(checksum, move.end.x), move.end.y);
+        }
+
+        for (int i = node->nbSons - 1; i >= 0; i--) {
+            if (node->sons[i].son == 0) {
+                continue;
+            }
+            if (nbNodes == capacity) {
+                capacity *= 2;
+                stack = realloc(stack, capacity * sizeof(mcts*));
+            }
+            stack[nbNodes++] = nodeAt(node->sons[i].son);
+        }
+    }
+
+    free(stack);
+    return checksum;
+}
+
 void freeNode(mcts* node) {
-    if (node->moveArray != NULL) {
-        free(node->moveArray);
+    // The node goes to the free nodes of the calling thread, its sons are not
+    // freed ; a thread freeing more nodes than it creates gives them back
+    if (node->sons != NULL) {
+        free(node->sons);
     }
-    if (node->sonsArray != NULL) {
-        free(node->sonsArray);
+
+    nodeCache* nodes = &threadNodes;
+    node->nbVisits = (int) nodes->freeNodes;
+    nodes->freeNodes = node->index;
+    nodes->lastFreeNode = (nodes->lastFreeNode == 0) ? node->index : nodes->lastFreeNode;
+    nodes->nbFreeNodes++;
+    atomic_fetch_sub_explicit(&nbAllocatedNodes, 1, memory_order_relaxed);
+
+    if (nodes->nbFreeNodes > 2 * NODE_BATCH) {
+        giveBackNodes(nodes, false);
     }
-    free(node);
 }
 
 void freeMCTS(mcts* tree) {
-    if (tree->nbVisits > 0) {
-        for (int i = 0; i < tree->nbSons; i++) {
-            freeMCTS(tree->sonsArray[i]);
-        }
-    }
-    freeNode(tree);
+    // Nodes waiting to be freed are kept in a stack of our own,
+    // deep trees cannot overflow the call stack
+    treeReclaimer reclaimer = {.nbNodes = 0, .capacity = 0, .nodes = NULL};
+    discardMCTS(&reclaimer, tree);
+    reclaimNodes(&reclaimer, INT_MAX);
+    free(reclaimer.nodes);
 }
 
 void freeMCTSExceptOneSon(mcts* tree, int sonIndex) {
@@ -102,27 +474,281 @@ void freeMCTSExceptOneSon(mcts* tree, int sonIndex) {
     // only keep the current subtree and free the rest
     if (tree->nbVisits > 0) {
         for (int i = 0; i < tree->nbSons; i++) {
-            if (i !=sonIndex) {
-                freeMCTS(tree->sonsArray[i]);
+            if (i !=sonIndex && tree->sons[i].son != 0) {
+                freeMCTS(nodeAt(tree->sons[i].son));
             }  
         }
     }
     freeNode(tree);
 }
 
+////////////////////////////////////////////////////////////////////////////
+// Deferred free of the discarded subtrees
+
+treeReclaimer* newTreeReclaimer() {
+    treeReclaimer* reclaimer = malloc(sizeof(treeReclaimer));
+    reclaimer->nbNodes = 0;
+    reclaimer->capacity = 0;
+    reclaimer->nodes = NULL;
+    return reclaimer;
+}
+
+void pushDiscardedNode(treeReclaimer* reclaimer, mcts* node) {
+    if (reclaimer->nbNodes == reclaimer->capacity) {
+        reclaimer->capacity = (reclaimer->capacity > 0) ? 2 * reclaimer->capacity : 256;
+        reclaimer->nodes = realloc(reclaimer->nodes, reclaimer->capacity * sizeof(mcts*));
+    }
+    reclaimer->nodes[reclaimer->nbNodes++] = node;
+}
+
+void discardMCTS(treeReclaimer* reclaimer, mcts* tree) {
+    // The tree is only freed by the next calls to reclaimNodes
+    pushDiscardedNode(reclaimer, tree);
+}
+
+int reclaimNodes(treeReclaimer* reclaimer, int maxNodes) {
+    // Frees at most maxNodes discarded nodes, their sons wait for the next calls
+    int nbFreed = 0;
+
+    while (reclaimer->nbNodes > 0 && nbFreed < maxNodes) {
+        mcts* node = reclaimer->nodes[--reclaimer->nbNodes];
+        if (node->nbVisits > 0) {
+            for (int i = 0; i < node->nbSons; i++) {
+                if (node->sons[i].son != 0) {
+                    pushDiscardedNode(reclaimer, nodeAt(node->sons[i].son));
+                }
+            }
+        }
+        freeNode(node);
+        nbFreed++;
+    }
+
+    return nbFreed;
+}
+
+void freeTreeReclaimer(treeReclaimer* reclaimer) {
+    reclaimNodes(reclaimer, INT_MAX);
+    free(reclaimer->nodes);
+    free(reclaimer);
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Heuristic priors of the sons
+
+int nbAdjacentIce(boardState* board, boardPos pos, boardPos ignored) {
+    // Number of free ice tiles around a position
+    boardPos adjacent[6];
+    int nbAdjacent = adjacentTilesInside(board, pos, adjacent);
+
+    int nbIce = 0;
+    for (int i = 0; i < nbAdjacent; i++) {
+        if ((adjacent[i].x != ignored.x || adjacent[i].y != ignored.y) && isReachable(board, adjacent[i])) {
+            nbIce++;
+        }
+    }
+    return nbIce;
+}
+
+int hexDistance(boardPos a, boardPos b) {
+    // Rows are shifted every other line, cube coordinates give the distance
+    int qA = a.x - (a.y - (a.y & 1)) / 2;
+    int qB = b.x - (b.y - (b.y & 1)) / 2;
+    int dq = qA - qB;
+    int dr = a.y - b.y;
+    return (abs(dq) + abs(dr) + abs(dq + dr)) / 2;
+}
+
+void computePriors(mcts* node, boardState* board) {
+    // Prior probability of every son, sons are sorted from the most to the least likely
+    node->hasPriors = true;
+    boardPosL* opponentPieces = (board->playerToPlay == 4) ? board->p2Pieces : board->p1Pieces;
+    float maxScore = -INFINITY;
+
+    for (int i = 0; i < node->nbSons; i++) {
+        boardMove move = sonMove(node, i);
+
+        int closestOpponent = board->sizeX + board->sizeY;
+        for (boardPosL* piece = opponentPieces; piece != NULL; piece = piece->next) {
+            int distance = hexDistance(move.end, piece->pos);
+            if (distance < closestOpponent) {
+                closestOpponent = distance;
+            }
+        }
+
+        float score = PRIOR_FISH_WEIGHT * board->map[move.end.x][move.end.y]
+            + PRIOR_MOBILITY_WEIGHT * nbAdjacentIce(board, move.end, move.start)
+            + PRIOR_CONTEST_WEIGHT / (float) closestOpponent;
+
+        node->sons[i].prior = score;
+        if (score > maxScore) {
+            maxScore = score;
+        }
+    }
+
+    float sum = 0;
+    for (int i = 0; i < node->nbSons; i++) {
+        node->sons[i].prior = expf(node->sons[i].prior - maxScore);
+        sum += node->sons[i].prior;
+    }
+
+    // Insertion sort, so that progressive widening considers the best sons first
+    for (int i = 0; i < node->nbSons; i++) {
+        sonEntry son = node->sons[i];
+        son.prior /= sum;
+        int j = i;
+        while (j > 0 && node->sons[j - 1].prior < son.prior) {
+            node->sons[j] = node->sons[j - 1];
+            j--;
+        }
+        node->sons[j] = son;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////
+// All moves as first statistics
+
+amafTrace* newAmafTrace(boardState* board) {
+    amafTrace* trace = malloc(sizeof(amafTrace));
+    trace->sizeY = board->sizeY;
+    trace->nbCells = board->sizeX * board->sizeY;
+    trace->nbGames = (int*) calloc(2 * trace->nbCells, sizeof(int));
+    trace->nbP1Wins = (int*) calloc(2 * trace->nbCells, sizeof(int));
+    return trace;
+}
+
+void clearAmafTrace(amafTrace* trace) {
+    memset(trace->nbGames, 0, 2 * trace->nbCells * sizeof(int));
+    memset(trace->nbP1Wins, 0, 2 * trace->nbCells * sizeof(int));
+}
+
+void freeAmafTrace(amafTrace* trace) {
+    free(trace->nbGames);
+    free(trace->nbP1Wins);
+    free(trace);
+}
+
+int arrivalIndex(amafTrace* trace, int player, boardPos end) {
+    // A tile can only be reached once in a game, by one of the players
+    return (player - 4) * trace->nbCells + end.x * trace->sizeY + end.y;
+}
+
+void recordGame(amafTrace* trace, int* arrivals, int nbArrivals, bool p1Victory) {
+    for (int i = 0; i < nbArrivals; i++) {
+        trace->nbGames[arrivals[i]] += 1;
+        trace->nbP1Wins[arrivals[i]] += p1Victory;
+    }
+}
+
+void recordMove(amafTrace* trace, int player, boardMove move, int nbGames, int nbP1Wins) {
+    // A move of the tree is part of all the games simulated below it
+    int arrival = arrivalIndex(trace, player, move.end);
+    trace->nbGames[arrival] += nbGames;
+    trace->nbP1Wins[arrival] += nbP1Wins;
+}
+
+void updateAmaf(mcts* node, int player, amafTrace* trace) {
+    // Every son gets the games where its move was played later by the same player
+    // Nodes expanded before RAVE was enabled get their statistics now
+    if (!node->hasAmaf) {
+        node->sons = realloc(node->sons, node->nbSons * (sizeof(sonEntry) + sizeof(amafStats)));
+        node->hasAmaf = true;
+        memset(sonsAmaf(node), 0, node->nbSons * sizeof(amafStats));
+    }
+    amafStats* amafArray = sonsAmaf(node);
+    for (int i = 0; i < node->nbSons; i++) {
+        int arrival = arrivalIndex(trace, player, sonMove(node, i).end);
+        amafArray[i].nbVisits += trace->nbGames[arrival];
+        amafArray[i].nbP1Wins += trace->nbP1Wins[arrival];
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Buffers of the search threads
+
+typedef struct _threadBuffers {
+    // Buffers sized for the largest board a thread searched, kept on the heap
+    // rather than on its stack and reused by every descent and random game
+    int nbTiles; // Tiles of the board plus one
+    mcts** path;
+    int* sonIndexes;
+    int* players;
+    int* arrivals;
+    int* adjacentIce;
+    int nbMoves;
+    boardMove* allMoves;
+    bool isRegistered;
+} threadBuffers;
+
+static _Thread_local threadBuffers searchBuffers = {0};
+static pthread_key_t searchBuffersKey;
+static pthread_once_t searchBuffersOnce = PTHREAD_ONCE_INIT;
+
+static void releaseSearchBuffers(void* arg) {
+    threadBuffers* buffers = (threadBuffers*) arg;
+    free(buffers->path);
+    free(buffers->sonIndexes);
+    free(buffers->players);
+    free(buffers->arrivals);
+    free(buffers->adjacentIce);
+    free(buffers->allMoves);
+    *buffers = (threadBuffers) {0};
+}
+
+static void createSearchBuffersKey() {
+    pthread_key_create(&searchBuffersKey, releaseSearchBuffers);
+}
+
+static threadBuffers* buffersFor(boardState* board) {
+    // Buffers of the calling thread, large enough for the board
+    threadBuffers* buffers = &searchBuffers;
+    if (!buffers->isRegistered) {
+        pthread_once(&searchBuffersOnce, createSearchBuffersKey);
+        pthread_setspecific(searchBuffersKey, buffers);
+        buffers->isRegistered = true;
+    }
+
+    int nbTiles = board->sizeX * board->sizeY + 1;
+    if (nbTiles > buffers->nbTiles) {
+        buffers->path = (mcts**) realloc(buffers->path, nbTiles * sizeof(mcts*));
+        buffers->sonIndexes = (int*) realloc(buffers->sonIndexes, nbTiles * sizeof(int));
+        buffers->players = (int*) realloc(buffers->players, nbTiles * sizeof(int));
+        buffers->arrivals = (int*) realloc(buffers->arrivals, nbTiles * sizeof(int));
+        buffers->adjacentIce = (int*) realloc(buffers->adjacentIce, nbTiles * sizeof(int));
+        buffers->nbTiles = nbTiles;
+    }
+    return buffers;
+}
+
+static boardMove* movesBuffer(threadBuffers* buffers, int nbMoves) {
+    if (nbMoves > buffers->nbMoves) {
+        buffers->allMoves = (boardMove*) realloc(buffers->allMoves, nbMoves * sizeof(boardMove));
+        buffers->nbMoves = nbMoves;
+    }
+    return buffers->allMoves;
+}
+
+
 ////////////////////////////////////////////////////////////////////////////
 // Random games simulation to estimate a node
 
 
-bool randomGame(boardState* board) {
+bool randomGame(boardState* board, amafTrace* trace) {
     // Make moves at random and returns true if penguins (P1) win
+    // Tiles reached by each player are recorded in the trace, when there is one
+    if (PLAYOUT_POLICY == 1) {
+        return heavyRandomGame(board, trace);
+    }
+
     boardState* boardCopy = copyBoardState(board);
+    legalMoves* moves = newLegalMoves(boardCopy);
+    int* arrivals = buffersFor(board)->arrivals;
+    int nbArrivals = 0;
     int consecutivePasses = 0;
 
     while (consecutivePasses < 2) {
-        boardMoveL* allMoves = allPossibleMoves(boardCopy);
+        int nbMoves = nbLegalMoves(moves, boardCopy->playerToPlay);
 
-        if (allMoves == NULL) {
+        if (nbMoves == 0) {
         consecutivePasses += 1;
         if (boardCopy->playerToPlay == 4) {
             boardCopy->playerToPlay = 5;
@@ -131,26 +757,119 @@ bool randomGame(boardState* board) {
         }
         } else {
         consecutivePasses = 0;
-        int nbMoves = boardMoveLSize(allMoves);
-        int randomMoveIndex = rand() % nbMoves;
+        int randomMoveIndex = searchRandom() % nbMoves;
 
-        boardMove randomlySelectedMove = getMoveByIndex(allMoves, randomMoveIndex);
-        movePenguin(boardCopy, randomlySelectedMove);
+        boardMove randomlySelectedMove = legalMoveByIndex(moves, boardCopy, randomMoveIndex);
+        if (trace != NULL) {
+            arrivals[nbArrivals++] = arrivalIndex(trace, boardCopy->playerToPlay, randomlySelectedMove.end);
+        }
+        playLegalMove(boardCopy, moves, randomlySelectedMove);
         }
-
-        freeBoardMoveL(allMoves);
     }
+    freeLegalMoves(moves);
     
     bool p1Victory = (boardCopy->p1Score > boardCopy->p2Score);
     freeBoardState(boardCopy);
 
+    if (trace != NULL) {
+        recordGame(trace, arrivals, nbArrivals, p1Victory);
+    }
+
     return p1Victory;
 }
 
-int nbWinsFromRandomGames(boardState* board, int nbSims) {
+void initAdjacentIce(boardState* board, int* adjacentIce) {
+    // Counters of free ice around every ice tile, indexed by x * sizeY + y
+    boardPos none = (boardPos) {.x = -1, .y = -1};
+    for (int i = 0; i < board->sizeX; i++) {
+        for (int j = 0; j < board->sizeY; j++) {
+            boardPos pos = (boardPos) {.x = i, .y = j};
+            adjacentIce[i * board->sizeY + j] = isTerrain(board, pos) ? nbAdjacentIce(board, pos, none) : 0;
+        }
+    }
+}
+
+void updateAdjacentIce(boardState* board, int* adjacentIce, boardMove move) {
+    // The start tile was already occupied, only the end tile stops being free
+    boardPos adjacent[6];
+    int nbAdjacent = adjacentTilesInside(board, move.end, adjacent);
+    for (int i = 0; i < nbAdjacent; i++) {
+        adjacentIce[adjacent[i].x * board->sizeY + adjacent[i].y] -= 1;
+    }
+}
+
+boardMove heavyPlayoutMove(boardState* board, boardMove* allMoves, int nbMoves, int* adjacentIce) {
+    // Move drawn with a probability proportional to its weight from the tables
+    int totalWeight = 0;
+    for (int i = 0; i < nbMoves; i++) {
+        boardPos end = allMoves[i].end;
+        totalWeight += FISH_WEIGHTS[board->map[end.x][end.y]] * MOBILITY_WEIGHTS[adjacentIce[end.x * board->sizeY + end.y]];
+    }
+
+    int randomWeight = searchRandom() % totalWeight;
+    int i = 0;
+    while (i < nbMoves - 1) {
+        boardPos end = allMoves[i].end;
+        randomWeight -= FISH_WEIGHTS[board->map[end.x][end.y]] * MOBILITY_WEIGHTS[adjacentIce[end.x * board->sizeY + end.y]];
+        if (randomWeight < 0) {
+            break;
+        }
+        i++;
+    }
+    return allMoves[i];
+}
+
+bool heavyRandomGame(boardState* board, amafTrace* trace) {
+    // Same as randomGame, but moves are drawn with heavyPlayoutMove
+    boardState* boardCopy = copyBoardState(board);
+    legalMoves* moves = newLegalMoves(boardCopy);
+    threadBuffers* buffers = buffersFor(board);
+    int* arrivals = buffers->arrivals;
+    int nbArrivals = 0;
+    int* adjacentIce = buffers->adjacentIce;
+    initAdjacentIce(boardCopy, adjacentIce);
+    int consecutivePasses = 0;
+
+    while (consecutivePasses < 2) {
+        int nbMoves = nbLegalMoves(moves, boardCopy->playerToPlay);
+
+        if (nbMoves == 0) {
+            consecutivePasses += 1;
+            boardCopy->playerToPlay = (boardCopy->playerToPlay == 4) ? 5 : 4;
+        } else {
+            consecutivePasses = 0;
+            boardMove* allMoves = movesBuffer(buffers, nbMoves);
+            listLegalMoves(moves, boardCopy, allMoves);
+            boardMove move = heavyPlayoutMove(boardCopy, allMoves, nbMoves, adjacentIce);
+            if (trace != NULL) {
+                arrivals[nbArrivals++] = arrivalIndex(trace, boardCopy->playerToPlay, move.end);
+            }
+            updateAdjacentIce(boardCopy, adjacentIce, move);
+            playLegalMove(boardCopy, moves, move);
+        }
+    }
+    freeLegalMoves(moves);
+
+    bool p1Victory = (boardCopy->p1Score > boardCopy->p2Score);
+    freeBoardState(boardCopy);
+
+    if (trace != NULL) {
+        recordGame(trace, arrivals, nbArrivals, p1Victory);
+    }
+
+    return p1Victory;
+}
+
+int nbWinsFromRandomGames(boardState* board, int nbSims, amafTrace* trace) {
+    // Uniform games without a trace are played in lockstep, the last batch
+    // only looping over the lanes it uses
+    if (LOCKSTEP_PLAYOUTS && PLAYOUT_POLICY == 0 && trace == NULL) {
+        return lockstepWins(board, nbSims, searchRandom());
+    }
+
     int nbWins = 0;
-    for (int i=0; i < nbSims; i++) {
-        if (randomGame(board)) {
+    for (int i = 0; i < nbSims; i++) {
+        if (randomGame(board, trace)) {
             nbWins += 1;
         }
     }
@@ -161,33 +880,80 @@ int nbWinsFromRandomGames(boardState* board, int nbSims) {
 ////////////////////////////////////////////////////////////////////////////
 // Monte-Carlo Tree Search
 
-float UCB(mcts* son, int nbFatherVisits, int FatherPlayer) {
+float sonWinRatio(mcts* tree, int sonIndex, int FatherPlayer) {
+    // Win ratio of a son for the father player, blended with its AMAF statistics
+    // Sons never visited are valued like their father until they are tried
+    mcts* son = sonNode(tree, sonIndex);
+    int nbSonVisits = (son == NULL) ? 0 : son->nbVisits;
+    int nbPendingGames = (son == NULL) ? 0 : son->nbPendingVisits * NB_SIMS;
+    float p1WinRatio;
+
+    if (nbSonVisits + nbPendingGames > 0) {
+        int nbP1Wins = son->nbP1Wins + ((FatherPlayer == 5) ? nbPendingGames : 0);
+        p1WinRatio = (float) nbP1Wins / (float) (nbSonVisits + nbPendingGames);
+    } else {
+        p1WinRatio = (float) tree->nbP1Wins / (float) tree->nbVisits;
+    }
+
+    if (RAVE_EQUIVALENCE > 0 && tree->hasAmaf && sonsAmaf(tree)[sonIndex].nbVisits > 0) {
+        amafStats amaf = sonsAmaf(tree)[sonIndex];
+        float amafRatio = (float) amaf.nbP1Wins / (float) amaf.nbVisits;
+        float beta = sqrtf(RAVE_EQUIVALENCE / (3.0f * nbSonVisits + RAVE_EQUIVALENCE));
+        p1WinRatio = beta * amafRatio + (1.0f - beta) * p1WinRatio;
+    }
+
+    return (FatherPlayer == 4) ? p1WinRatio : 1.0f - p1WinRatio;
+}
+
+float UCB(mcts* tree, int sonIndex, int FatherPlayer) {
     // Attractiveness score of a son based on the UCB
+    mcts* son = sonNode(tree, sonIndex);
+    int nbSonVisits = (son == NULL) ? 0 : son->nbVisits + son->nbPendingVisits * NB_SIMS;
 
-    if (son->nbVisits == 0) {
+    if (nbSonVisits == 0) {
         return INFINITY;
     }
 
-    float sonWinRatio;
+    return sonWinRatio(tree, sonIndex, FatherPlayer) + EXPLORATION_CONSTANT * sqrt(log((float) tree->nbVisits) / (float) nbSonVisits);
+}
 
-    if (FatherPlayer == 4) {
-        sonWinRatio = (float) son->nbP1Wins / (float) son->nbVisits;
-    } else {
-        sonWinRatio = (float) son->nbP2Wins / (float) son->nbVisits;
-    }
+float PUCT(mcts* tree, int sonIndex, int FatherPlayer) {
+    // Attractiveness score of a son guided by its prior
+    mcts* son = sonNode(tree, sonIndex);
+    int nbSonVisits = (son == NULL) ? 0 : son->nbVisits + son->nbPendingVisits * NB_SIMS;
 
-    return sonWinRatio + EXPLORATION_CONSTANT * sqrt(log((float) nbFatherVisits) / (float) son->nbVisits);
+    float winRatio = sonWinRatio(tree, sonIndex, FatherPlayer);
+    float nbFatherIterations = (float) tree->nbVisits / (float) NB_SIMS;
+    float nbSonIterations = (float) nbSonVisits / (float) NB_SIMS;
+
+    return winRatio + PRIOR_WEIGHT * tree->sons[sonIndex].prior * sqrtf(nbFatherIterations) / (1.0f + nbSonIterations);
 }
 
 
+int nbConsideredSons(mcts* tree) {
+    // Number of sons allowed by progressive widening
+    if (WIDENING_COEFFICIENT <= 0) {
+        return tree->nbSons;
+    }
+    float nbIterations = (float) tree->nbVisits / (float) NB_SIMS;
+    int nbConsidered = 1 + (int) (WIDENING_COEFFICIENT * powf(nbIterations, WIDENING_EXPONENT));
+    return (nbConsidered < tree->nbSons) ? nbConsidered : tree->nbSons;
+}
+
 int bestSonIndex(mcts* tree, int currentPlayer) {
     // Find the most attractive son based on UCB
 
     int bestIndex = 0;
     float bestScore = -INFINITY;
+    int nbConsidered = nbConsideredSons(tree);
 
-    for (int i = 0; i < tree->nbSons; i++) {
-        float sonScore = UCB(tree->sonsArray[i], tree->nbVisits, currentPlayer);
+    for (int i = 0; i < nbConsidered; i++) {
+        float sonScore;
+        if (tree->hasPriors) {
+            sonScore = PUCT(tree, i, currentPlayer);
+        } else {
+            sonScore = UCB(tree, i, currentPlayer);
+        }
         if (sonScore > bestScore) {
             bestIndex = i;
             bestScore = sonScore;
@@ -197,38 +963,194 @@ int bestSonIndex(mcts* tree, int currentPlayer) {
     return bestIndex;
 }
 
-int mctsStep(mcts* tree, boardState* board) {
-    // Recursive tree update, returning the number of P1 wins 
+int mctsStep(mcts* tree, boardState* board, amafTrace* trace) {
+    // Tree update, returning the number of P1 wins
+    // The descent is recorded in the path buffers of the thread, a move takes
+    // one tile of the board away so the path is never longer than the number of tiles
+    threadBuffers* buffers = buffersFor(board);
+    mcts** path = buffers->path;
+    int* sonIndexes = buffers->sonIndexes;
+    int* players = buffers->players;
+    int pathLength = 0;
+    mcts* node = tree;
 
-    int nbWins;
+    while (node->nbVisits > 0 && node->nbSons > 0) {
+        int i = bestSonIndex(node, board->playerToPlay);
+        path[pathLength] = node;
+        sonIndexes[pathLength] = i;
+        players[pathLength] = board->playerToPlay;
+        pathLength++;
+
+        movePenguin(board, sonMove(node, i));
+        node = getSon(node, i);
+    }
 
-    if (tree->nbVisits == 0) {   
-        nbWins = initNode(tree, board);
-        return nbWins;
+    int nbWins;
 
+    if (node->nbVisits == 0) {
+        nbWins = initNode(node, board, trace);
     } else {
-        if (tree->nbSons > 0) {
-            int i = bestSonIndex(tree, board->playerToPlay);
-            movePenguin(board, tree->moveArray[i]);
-            nbWins = mctsStep(tree->sonsArray[i], board);
-        } else {
-            nbWins = nbWinsFromRandomGames(board, NB_SIMS);
-        }
+        nbWins = nbWinsFromRandomGames(board, NB_SIMS, trace);
+        node->nbVisits += NB_SIMS;
+        node->nbP1Wins += nbWins;
+    }
 
-        tree->nbVisits += NB_SIMS;
-        tree->nbP1Wins += nbWins;
-        tree->nbP2Wins += NB_SIMS - nbWins;
+    // Backpropagation, from the father of the leaf up to the root
+    for (int depth = pathLength - 1; depth >= 0; depth--) {
+        mcts* father = path[depth];
 
-        return nbWins;
+        if (trace != NULL) {
+            recordMove(trace, players[depth], sonMove(father, sonIndexes[depth]), NB_SIMS, nbWins);
+            updateAmaf(father, players[depth], trace);
+        }
+
+        father->nbVisits += NB_SIMS;
+        father->nbP1Wins += nbWins;
     }
+
+    return nbWins;
 }
 
 void mctsSteps(mcts* tree, boardState* board, int nbSteps) {
+    if (LEAF_EVALUATION > 0) {
+        leafBatch* batch = newLeafBatch(board, EVALUATION_BATCH);
+        for (int i = 0; i < nbSteps; i += EVALUATION_BATCH) {
+            int nbDescents = (nbSteps - i < EVALUATION_BATCH) ? nbSteps - i : EVALUATION_BATCH;
+            mctsBatch(tree, board, batch, nbDescents);
+        }
+        freeLeafBatch(batch);
+        return;
+    }
+
+    amafTrace* trace = (RAVE_EQUIVALENCE > 0) ? newAmafTrace(board) : NULL;
+
     for (int i = 0; i < nbSteps; i++) {
         boardState* boardCopy = copyBoardState(board);
-        int nbWins = mctsStep(tree, boardCopy);
+        if (trace != NULL) {
+            clearAmafTrace(trace);
+        }
+        int nbWins = mctsStep(tree, boardCopy, trace);
         freeBoardState(boardCopy);
     }
+
+    if (trace != NULL) {
+        freeAmafTrace(trace);
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Batched leaf evaluation
+
+leafBatch* newLeafBatch(boardState* board, int maxDescents) {
+    // A descent goes one tile deeper at each move, at most until the board is empty
+    leafBatch* batch = malloc(sizeof(leafBatch));
+    batch->nbDescents = 0;
+    batch->maxDescents = maxDescents;
+    batch->maxPathLength = board->sizeX * board->sizeY + 1;
+    batch->paths = (mcts**) malloc(maxDescents * batch->maxPathLength * sizeof(mcts*));
+    batch->pathLengths = (int*) calloc(maxDescents, sizeof(int));
+    batch->leaves = (boardState**) calloc(maxDescents, sizeof(boardState*));
+    batch->p1WinProbas = (float*) calloc(maxDescents, sizeof(float));
+    return batch;
+}
+
+void freeLeafBatch(leafBatch* batch) {
+    free(batch->paths);
+    free(batch->pathLengths);
+    free(batch->leaves);
+    free(batch->p1WinProbas);
+    free(batch);
+}
+
+void pendingDescent(leafBatch* batch, mcts* tree, boardState* board) {
+    // Descent until a new node or a node without sons, every node of the path
+    // gets a pending visit until the leaf is evaluated
+    int descent = batch->nbDescents;
+    mcts** path = &batch->paths[descent * batch->maxPathLength];
+    int pathLength = 0;
+    boardState* leafBoard = copyBoardState(board);
+    mcts* node = tree;
+
+    while (true) {
+        path[pathLength++] = node;
+        node->nbPendingVisits += 1;
+
+        if (node->nbVisits == 0 || node->nbSons == 0) {
+            break;
+        }
+        int i = bestSonIndex(node, leafBoard->playerToPlay);
+        movePenguin(leafBoard, sonMove(node, i));
+        node = getSon(node, i);
+    }
+
+    batch->pathLengths[descent] = pathLength;
+    batch->leaves[descent] = leafBoard;
+    batch->nbDescents += 1;
+}
+
+void evaluateLeaves(leafBatch* batch) {
+    // Static evaluation of all the leaves at once, averaged with random games if asked
+    evaluateBoards(batch->leaves, batch->nbDescents, batch->p1WinProbas);
+
+    if (LEAF_EVALUATION == 2) {
+        for (int i = 0; i < batch->nbDescents; i++) {
+            float playoutsRatio = (float) nbWinsFromRandomGames(batch->leaves[i], NB_SIMS, NULL) / (float) NB_SIMS;
+            batch->p1WinProbas[i] = 0.5f * (batch->p1WinProbas[i] + playoutsRatio);
+        }
+    }
+}
+
+int roundWins(float p1WinProba) {
+    // Tree statistics are counted in games, the expected number of P1 wins
+    // is rounded at random to keep it unbiased
+    float expectedWins = p1WinProba * NB_SIMS;
+    int nbWins = (int) expectedWins;
+    if ((float) (searchRandom() >> 8) / 16777216.0f < expectedWins - nbWins) {
+        nbWins += 1;
+    }
+    return nbWins;
+}
+
+void backupLeaves(leafBatch* batch) {
+    // New leaves are expanded, then evaluations go up their paths
+    for (int descent = 0; descent < batch->nbDescents; descent++) {
+        mcts** path = &batch->paths[descent * batch->maxPathLength];
+        int pathLength = batch->pathLengths[descent];
+        boardState* leafBoard = batch->leaves[descent];
+        mcts* leaf = path[pathLength - 1];
+        int nbWins = roundWins(batch->p1WinProbas[descent]);
+
+        // Two descents of a batch may have reached the same new leaf
+        if (leaf->nbVisits == 0) {
+            expandNode(leaf, leafBoard);
+            if (leaf->nbSons == 0) {
+                nbWins = finalNodeWins(leafBoard, nbWins);
+            }
+        }
+
+        for (int i = 0; i < pathLength; i++) {
+            path[i]->nbPendingVisits -= 1;
+            path[i]->nbVisits += NB_SIMS;
+            path[i]->nbP1Wins += nbWins;
+        }
+
+        freeBoardState(leafBoard);
+        batch->leaves[descent] = NULL;
+    }
+
+    batch->nbDescents = 0;
+}
+
+void mctsBatch(mcts* tree, boardState* board, leafBatch* batch, int nbDescents) {
+    // Several descents, then a single evaluation of their leaves
+    int64_t spanStart = timelineBegin();
+    for (int i = 0; i < nbDescents && i < batch->maxDescents; i++) {
+        pendingDescent(batch, tree, board);
+    }
+    evaluateLeaves(batch);
+    backupLeaves(batch);
+    timelineEnd("batch", spanStart);
 }
 
 
@@ -240,36 +1162,51 @@ boardMove bestMove(mcts* tree) {
     int biggestNbVisits = -1;
     int sonIndex = 0;
     for (int i = 0; i < tree->nbSons; i++) {
-        if (tree->sonsArray[i]->nbVisits > biggestNbVisits) {
-            biggestNbVisits = tree->sonsArray[i]->nbVisits;
+        if (sonNbVisits(tree, i) > biggestNbVisits) {
+            biggestNbVisits = sonNbVisits(tree, i);
             sonIndex = i;
         }
     }
     
-    return tree->moveArray[sonIndex];
+    return sonMove(tree, sonIndex);
 } 
 
-mcts* makeMove(mcts* tree, boardMove move) {
-    // Searching for the move and updating the tree
+int sonIndexOfMove(mcts* tree, boardMove move) {
+    // Searching for the move, -1 when it is not a son of the tree
 
     int sonIndex = -1;
-    mcts* chosenSon = NULL;
+    packedMove packed = packMove(move);
 
     for (int i = 0; i < tree->nbSons; i++) {
+        if (tree->sons[i].move == packed) {
+            sonIndex = i;
+        }
+    }
 
-        boardMove m = tree->moveArray[i];
+    return sonIndex;
+}
 
-        if (m.start.x == move.start.x 
-            && m.start.y == move.start.y
-            && m.end.x == move.end.x
-            && m.end.y == move.end.y) {
+mcts* makeMove(mcts* tree, boardMove move) {
+    // Updating the tree, the rest of the tree is freed right away
+    int sonIndex = sonIndexOfMove(tree, move);
+    mcts* chosenSon = (sonIndex >= 0) ? getSon(tree, sonIndex) : NULL;
 
-                sonIndex = i;
-                chosenSon = tree->sonsArray[i];
-            }
+    freeMCTSExceptOneSon(tree, sonIndex);
+    return chosenSon;
+}
+
+mcts* makeMoveDeferred(treeReclaimer* reclaimer, mcts* tree, boardMove move) {
+    // Same as makeMove, but the rest of the tree is handed to the reclaimer,
+    // so that the move takes the same time whatever the size of the tree
+    int sonIndex = sonIndexOfMove(tree, move);
+    mcts* chosenSon = NULL;
+
+    if (sonIndex >= 0) {
+        chosenSon = getSon(tree, sonIndex);
+        tree->sons[sonIndex].son = 0;
     }
 
-    freeMCTSExceptOneSon(tree, sonIndex);
+    discardMCTS(reclaimer, tree);
     return chosenSon;
 }
 
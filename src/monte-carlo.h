@@ -1,56 +1,216 @@
+#ifndef MONTE_CARLO_H
+#define MONTE_CARLO_H
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
-#include "raylib.h"
-#include "raymath.h"
 #include "math.h"
 
 #include "board.h"
+#include "evaluation.h"
+#include "lockstep.h"
+#include "timeline.h"
+
+////////////////////////////////////////////////////////////////////////////
+// Search parameters, they can be tuned before a search starts
+// Every thread has its own, starting from the defaults, see useSearchSettings
+
+extern _Thread_local int NB_SIMS;
+extern _Thread_local float EXPLORATION_CONSTANT;
+extern _Thread_local float WIDENING_COEFFICIENT;
+extern _Thread_local float WIDENING_EXPONENT;
+extern _Thread_local float PRIOR_WEIGHT;
+extern _Thread_local int PLAYOUT_POLICY;
+extern _Thread_local int LOCKSTEP_PLAYOUTS;
+extern _Thread_local float RAVE_EQUIVALENCE;
+extern _Thread_local int LEAF_EVALUATION;
+extern _Thread_local int EVALUATION_BATCH;
+
+typedef struct _searchSettings {
+    // The search parameters above, as one value
+    int nbSims;
+    float explorationConstant;
+    float wideningCoefficient;
+    float wideningExponent;
+    float priorWeight;
+    int playoutPolicy;
+    int lockstepPlayouts;
+    float raveEquivalence;
+    int leafEvaluation;
+    int evaluationBatch;
+} searchSettings;
+
+searchSettings currentSearchSettings();
+void useSearchSettings(const searchSettings* settings);
 
 ////////////////////////////////////////////////////////////////////////////
 // Data structures
 
+typedef struct _amafStats {
+    int nbVisits;
+    int nbP1Wins;
+} amafStats;
+
+// Move packed in 32 bits, the start tile in the high half and the end tile
+// in the low half, each tile being x << 8 | y
+typedef uint32_t packedMove;
+
+// Position of a node in the node pool, 0 is no node
+typedef uint32_t nodeIndex;
+
+typedef struct _sonEntry {
+    packedMove move;
+    nodeIndex son; // 0 for sons never selected
+    float prior; // 0 when priors are disabled
+} sonEntry;
+
 typedef struct _mcts {
 
-    int nbVisits;
+    int nbVisits; // P2 wins are the visits that are not P1 wins
     int nbP1Wins;
-    int nbP2Wins;
+    int nbPendingVisits; // Descents waiting for the evaluation of their leaf
 
-    int nbSons;
+    int nbSons : 30;
+    unsigned int hasPriors : 1;
+    unsigned int hasAmaf : 1; // AMAF statistics of the sons follow the sons array
 
-    boardMove* moveArray;
-    struct _mcts** sonsArray;
+    nodeIndex index; // Position of the node itself in the pool
+    sonEntry* sons; // NULL without sons
 
 } mcts;
 
+typedef struct _amafTrace {
+    // Games and P1 wins of the simulations where a player reached a tile,
+    // indexed by (player - 4) * nbCells + x * sizeY + y
+    int nbCells;
+    int sizeY;
+    int* nbGames;
+    int* nbP1Wins;
+} amafTrace;
+
+typedef struct _treeReclaimer {
+    // Discarded subtrees waiting to be freed, a few nodes at a time
+    int nbNodes;
+    int capacity;
+    struct _mcts** nodes;
+} treeReclaimer;
+
+typedef struct _leafBatch {
+    // Descents made before their leaves are evaluated together
+    int nbDescents;
+    int maxDescents;
+    int maxPathLength;
+    mcts** paths; // maxPathLength nodes per descent, from the root to the leaf
+    int* pathLengths;
+    boardState** leaves;
+    float* p1WinProbas;
+} leafBatch;
+
+////////////////////////////////////////////////////////////////////////////
+// Random streams of the search
+
+void seedSearchRandom(uint64_t seed, uint64_t stream);
+uint32_t searchRandom();
+
+////////////////////////////////////////////////////////////////////////////
+// Compact nodes and moves
+
+packedMove packMove(boardMove move);
+boardMove unpackMove(packedMove move);
+mcts* nodeAt(nodeIndex index);
+boardMove sonMove(mcts* tree, int sonIndex);
+mcts* sonNode(mcts* tree, int sonIndex);
+amafStats* sonsAmaf(mcts* tree);
+int nbLiveNodes(void);
+size_t treeMemory(mcts* tree);
+
 ////////////////////////////////////////////////////////////////////////////
 // Monte-Carlo Tree data structure initialization and free
 
 mcts* createNode();
-int initNode(mcts* node, boardState* board);
+int initNode(mcts* node, boardState* board, amafTrace* trace);
+void expandNode(mcts* node, boardState* board);
+int finalNodeWins(boardState* board, int nbWins);
 mcts* newMCTS(boardState* board);
+mcts* getSon(mcts* tree, int sonIndex);
+int sonNbVisits(mcts* tree, int sonIndex);
 int treeSize(mcts* tree);
+uint64_t treeChecksum(mcts* tree);
 void freeNode(mcts* node);
 void freeMCTS(mcts* tree);
 void freeMCTSExceptOneSon(mcts* tree, int sonIndex);
 
+////////////////////////////////////////////////////////////////////////////
+// Deferred free of the discarded subtrees
+
+treeReclaimer* newTreeReclaimer();
+void discardMCTS(treeReclaimer* reclaimer, mcts* tree);
+int reclaimNodes(treeReclaimer* reclaimer, int maxNodes);
+void freeTreeReclaimer(treeReclaimer* reclaimer);
+
+////////////////////////////////////////////////////////////////////////////
+// Heuristic priors of the sons
+
+int nbAdjacentIce(boardState* board, boardPos pos, boardPos ignored);
+int hexDistance(boardPos a, boardPos b);
+void computePriors(mcts* node, boardState* board);
+
+////////////////////////////////////////////////////////////////////////////
+// All moves as first statistics
+
+amafTrace* newAmafTrace(boardState* board);
+void clearAmafTrace(amafTrace* trace);
+void freeAmafTrace(amafTrace* trace);
+int arrivalIndex(amafTrace* trace, int player, boardPos end);
+void recordGame(amafTrace* trace, int* arrivals, int nbArrivals, bool p1Victory);
+void recordMove(amafTrace* trace, int player, boardMove move, int nbGames, int nbP1Wins);
+void updateAmaf(mcts* node, int player, amafTrace* trace);
+
 ////////////////////////////////////////////////////////////////////////////
 // Random games simulation to estimate a node
 
-bool randomGame(boardState* board);
-int nbWinsFromRandomGames(boardState* board, int nbSims);
+bool randomGame(boardState* board, amafTrace* trace);
+void initAdjacentIce(boardState* board, int* adjacentIce);
+void updateAdjacentIce(boardState* board, int* adjacentIce, boardMove move);
+boardMove heavyPlayoutMove(boardState* board, boardMove* allMoves, int nbMoves, int* adjacentIce);
+bool heavyRandomGame(boardState* board, amafTrace* trace);
+int nbWinsFromRandomGames(boardState* board, int nbSims, amafTrace* trace);
 
 ////////////////////////////////////////////////////////////////////////////
 // Monte-Carlo Tree Search
 
-float UCB(mcts* son, int nbFatherVisits, int FatherPlayer);
+float sonWinRatio(mcts* tree, int sonIndex, int FatherPlayer);
+float UCB(mcts* tree, int sonIndex, int FatherPlayer);
+float PUCT(mcts* tree, int sonIndex, int FatherPlayer);
+int nbConsideredSons(mcts* tree);
 int bestSonIndex(mcts* tree, int currentPlayer);
-int mctsStep(mcts* tree, boardState* board);
+int mctsStep(mcts* tree, boardState* board, amafTrace* trace);
 void mctsSteps(mcts* tree, boardState* board, int nbSteps);
 
+////////////////////////////////////////////////////////////////////////////
+// Batched leaf evaluation
+
+leafBatch* newLeafBatch(boardState* board, int maxDescents);
+void freeLeafBatch(leafBatch* batch);
+void pendingDescent(leafBatch* batch, mcts* tree, boardState* board);
+void evaluateLeaves(leafBatch* batch);
+int roundWins(float p1WinProba);
+void backupLeaves(leafBatch* batch);
+void mctsBatch(mcts* tree, boardState* board, leafBatch* batch, int nbDescents);
+
 
 ////////////////////////////////////////////////////////////////////////////
 // Making a move !
 
 boardMove bestMove(mcts* tree);
+int sonIndexOfMove(mcts* tree, boardMove move);
 mcts* makeMove(mcts* tree, boardMove move);
+mcts* makeMoveDeferred(treeReclaimer* reclaimer, mcts* tree, boardMove move);
+
+
+#endif
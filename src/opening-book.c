@@ -0,0 +1,203 @@
+#include "opening-book.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Opening book built offline by book-builder.c
+// Positions are keyed by the whole board, fishes and scores included, so a
+// book only knows the fish layouts it was built from : a game that wants to
+// use it draws its layout among them with bookLayoutSeed
+
+const uint32_t BOOK_VERSION = 2;
+
+
+////////////////////////////////////////////////////////////////////////////
+// Position keys
+
+uint64_t splitMix64(uint64_t x) {
+    // Deterministic pseudo-random numbers, so that keys do not depend on the process
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+uint64_t bookKey(boardState* board) {
+    // Zobrist-like hash of the fishes of the tiles still floating, the pieces,
+    // the scores and the player to play
+    uint64_t key = 0;
+
+    for (int i = 0; i < board->sizeX; i++) {
+        for (int j = 0; j < board->sizeY; j++) {
+            int tile = board->map[i][j];
+            if (tile > 0) {
+                key ^= splitMix64((uint64_t) (cellIndex(board, (boardPos){.x=i, .y=j}) * 8 + tile));
+            }
+        }
+    }
+
+    key ^= splitMix64(1ULL << 62 | (uint64_t) board->p1Score << 31 | (uint64_t) board->p2Score);
+    if (board->playerToPlay == 5) {
+        key ^= splitMix64(0xffffffffULL);
+    }
+
+    return key;
+}
+
+uint16_t cellIndex(boardState* board, boardPos pos) {
+    return (uint16_t) (pos.x * board->sizeY + pos.y);
+}
+
+boardPos cellPos(boardState* board, uint16_t cell) {
+    return (boardPos) {.x = cell / board->sizeY, .y = cell % board->sizeY};
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Loading and querying a book
+
+openingBook* loadOpeningBook(const char* path) {
+    // Maps a book file in memory, returns NULL if there is no valid book
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) < 0 || (size_t) fileStat.st_size < sizeof(bookHeader)) {
+        close(fd);
+        return NULL;
+    }
+
+    void* mapping = mmap(NULL, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+
+    const bookHeader* header = (const bookHeader*) mapping;
+    if (memcmp(header->magic, "PGBK", 4) != 0
+        || header->version != BOOK_VERSION
+        || sizeof(bookHeader) + header->nbEntries * sizeof(bookEntry) != (size_t) fileStat.st_size) {
+
+        munmap(mapping, fileStat.st_size);
+        return NULL;
+    }
+
+    openingBook* book = malloc(sizeof(openingBook));
+    book->mapping = mapping;
+    book->mappingSize = fileStat.st_size;
+    book->header = header;
+    book->entries = (const bookEntry*) ((const char*) mapping + sizeof(bookHeader));
+
+    return book;
+}
+
+void freeOpeningBook(openingBook* book) {
+    if (book != NULL) {
+        munmap(book->mapping, book->mappingSize);
+        free(book);
+    }
+}
+
+unsigned int bookLayoutSeed(openingBook* book, unsigned int seed) {
+    // Seed of the fish layout of a new game : one of the layouts of the book
+    // when there is one, so that its positions can come up
+    if (book == NULL || book->header->nbLayouts == 0) {
+        return seed;
+    }
+    return 1 + seed % book->header->nbLayouts;
+}
+
+bool probeOpeningBook(openingBook* book, boardState* board, boardMove* move) {
+    // Binary search of the current position, the move is only
+    // returned if it is legal on this board
+
+    if (book == NULL
+        || book->header->sizeX != (uint32_t) board->sizeX
+        || book->header->sizeY != (uint32_t) board->sizeY) {
+        return false;
+    }
+
+    uint64_t key = bookKey(board);
+    uint64_t low = 0;
+    uint64_t high = book->header->nbEntries;
+
+    while (low < high) {
+        uint64_t middle = low + (high - low) / 2;
+        if (book->entries[middle].key < key) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    if (low == book->header->nbEntries || book->entries[low].key != key) {
+        return false;
+    }
+
+    boardMove bookMove = (boardMove) {
+        .start = cellPos(board, book->entries[low].start),
+        .end = cellPos(board, book->entries[low].end)
+    };
+
+    if (board->map[bookMove.start.x][bookMove.start.y] != board->playerToPlay) {
+        return false;
+    }
+
+    boardPosL* reachablePos = neighbours(bookMove.start, board);
+    bool isLegal = posInList(bookMove.end, reachablePos);
+    freeBoardPosL(reachablePos);
+
+    if (isLegal) {
+        *move = bookMove;
+    }
+    return isLegal;
+}
+
+boardMove bestMoveWithBook(openingBook* book, mcts* tree, boardState* board) {
+    // Book move if the position is known, most visited move otherwise
+    boardMove move;
+    if (probeOpeningBook(book, board, &move)) {
+        return move;
+    }
+    return bestMove(tree);
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Writing a book
+
+int compareBookEntries(const void* a, const void* b) {
+    uint64_t keyA = ((const bookEntry*) a)->key;
+    uint64_t keyB = ((const bookEntry*) b)->key;
+    return (keyA > keyB) - (keyA < keyB);
+}
+
+bool writeOpeningBook(const char* path, boardState* board, int nbLayouts, bookEntry* entries, uint64_t nbEntries) {
+    // Entries are sorted in place, keys must be unique
+    qsort(entries, nbEntries, sizeof(bookEntry), compareBookEntries);
+
+    bookHeader header;
+    memset(&header, 0, sizeof(bookHeader));
+    memcpy(header.magic, "PGBK", 4);
+    header.version = BOOK_VERSION;
+    header.sizeX = board->sizeX;
+    header.sizeY = board->sizeY;
+    header.nbLayouts = nbLayouts;
+    header.nbEntries = nbEntries;
+
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        return false;
+    }
+
+    bool success = fwrite(&header, sizeof(bookHeader), 1, file) == 1
+        && fwrite(entries, sizeof(bookEntry), nbEntries, file) == nbEntries;
+
+    return fclose(file) == 0 && success;
+}
@@ -0,0 +1,62 @@
+#ifndef OPENING_BOOK_H
+#define OPENING_BOOK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "board.h"
+#include "monte-carlo.h"
+
+////////////////////////////////////////////////////////////////////////////
+// Data structures
+
+// On disk, a book is a header followed by entries sorted by key,
+// so that it can be memory-mapped and searched without any parsing
+typedef struct _bookHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t sizeX;
+    uint32_t sizeY;
+    uint32_t nbLayouts; // The fish layouts drawn with srand(1) to srand(nbLayouts)
+    uint64_t nbEntries;
+} bookHeader;
+
+typedef struct _bookEntry {
+    uint64_t key;
+    uint16_t start; // Cell index of the moving piece
+    uint16_t end; // Cell index of the destination tile
+    uint32_t weight; // Visits of the move in the search that chose it
+} bookEntry;
+
+typedef struct _openingBook {
+    void* mapping;
+    size_t mappingSize;
+
+    const bookHeader* header;
+    const bookEntry* entries;
+} openingBook;
+
+////////////////////////////////////////////////////////////////////////////
+// Position keys
+
+uint64_t bookKey(boardState* board);
+uint16_t cellIndex(boardState* board, boardPos pos);
+boardPos cellPos(boardState* board, uint16_t cell);
+
+////////////////////////////////////////////////////////////////////////////
+// Loading and querying a book
+
+openingBook* loadOpeningBook(const char* path);
+void freeOpeningBook(openingBook* book);
+unsigned int bookLayoutSeed(openingBook* book, unsigned int seed);
+bool probeOpeningBook(openingBook* book, boardState* board, boardMove* move);
+boardMove bestMoveWithBook(openingBook* book, mcts* tree, boardState* board);
+
+////////////////////////////////////////////////////////////////////////////
+// Writing a book
+
+bool writeOpeningBook(const char* path, boardState* board, int nbLayouts, bookEntry* entries, uint64_t nbEntries);
+
+
+#endif
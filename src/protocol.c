@@ -0,0 +1,161 @@
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "protocol.h"
+
+// Output lines are written whole, whatever thread writes them
+pthread_mutex_t outputMutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+////////////////////////////////////////////////////////////////////////////
+// Output
+
+void reply(const char* format, ...) {
+    // The reading thread and the searching threads all write on stdout
+    pthread_mutex_lock(&outputMutex);
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+    printf("\n");
+    fflush(stdout);
+    pthread_mutex_unlock(&outputMutex);
+}
+
+double now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Moves and positions, as written in the commands
+
+int formatMove(char* buffer, size_t size, boardMove move) {
+    return snprintf(buffer, size, "%i,%i-%i,%i", move.start.x, move.start.y, move.end.x, move.end.y);
+}
+
+bool parseMove(const char* token, boardMove* move) {
+    int startX, startY, endX, endY;
+    char extra;
+    if (sscanf(token, "%d,%d-%d,%d%c", &startX, &startY, &endX, &endY, &extra) != 4) {
+        return false;
+    }
+    *move = (boardMove) {.start = (boardPos) {.x = startX, .y = startY}, .end = (boardPos) {.x = endX, .y = endY}};
+    return true;
+}
+
+bool sameMove(boardMove a, boardMove b) {
+    return a.start.x == b.start.x && a.start.y == b.start.y && a.end.x == b.end.x && a.end.y == b.end.y;
+}
+
+bool isLegalMove(boardState* board, boardMove move) {
+    if (move.start.x < 0 || move.start.x >= board->sizeX || move.start.y < 0 || move.start.y >= board->sizeY) {
+        return false;
+    }
+    if (board->map[move.start.x][move.start.y] != board->playerToPlay) {
+        return false;
+    }
+    boardPosL* reachablePos = neighbours(move.start, board);
+    bool isLegal = posInList(move.end, reachablePos);
+    freeBoardPosL(reachablePos);
+    return isLegal;
+}
+
+bool parsePlayedMove(boardState* board, const char* token, boardMove* move, bool* isPass) {
+    // A move of the moves command, legal on the board, pass being only legal
+    // when the player has no other move
+    *isPass = strcmp(token, "pass") == 0;
+    if (*isPass) {
+        boardMoveL* allMoves = allPossibleMoves(board);
+        freeBoardMoveL(allMoves);
+        return allMoves == NULL;
+    }
+    return parseMove(token, move) && isLegalMove(board, *move);
+}
+
+boardState* parsePosition(char** savePtr) {
+    // <player> <p1Score> <p2Score> <sizeX> <sizeY> <tiles...>, after the
+    // command and its session if any
+    int values[5];
+    for (int i = 0; i < 5; i++) {
+        char* token = strtok_r(NULL, " \t\n", savePtr);
+        if (token == NULL) {
+            return NULL;
+        }
+        values[i] = atoi(token);
+    }
+    if ((values[0] != 4 && values[0] != 5) || values[3] < 3 || values[4] < 3 || values[3] > MAX_POSITION_SIZE || values[4] > MAX_POSITION_SIZE) {
+        return NULL;
+    }
+
+    boardState* board = emptyBoard(values[3], values[4]);
+    if (board == NULL) {
+        return NULL;
+    }
+    board->playerToPlay = values[0];
+    board->p1Score = values[1];
+    board->p2Score = values[2];
+
+    for (int i = 0; i < board->sizeX; i++) {
+        for (int j = 0; j < board->sizeY; j++) {
+            char* token = strtok_r(NULL, " \t\n", savePtr);
+            int tile = (token != NULL) ? atoi(token) : -1;
+            if (tile < 0 || tile > 5) {
+                freeBoardState(board);
+                return NULL;
+            }
+            board->map[i][j] = tile;
+        }
+    }
+
+    board->p1Pieces = piecesPosL(board, 4);
+    board->p2Pieces = piecesPosL(board, 5);
+    return board;
+}
+
+int formatPosition(char* buffer, size_t size, boardState* board) {
+    // The position command of the board, without line feed, -1 when it
+    // does not fit in the buffer
+    size_t length = snprintf(buffer, size, "position %i %i %i %i %i",
+        board->playerToPlay, board->p1Score, board->p2Score, board->sizeX, board->sizeY);
+    for (int i = 0; i < board->sizeX && length < size; i++) {
+        for (int j = 0; j < board->sizeY && length < size; j++) {
+            length += snprintf(buffer + length, size - length, " %i", board->map[i][j]);
+        }
+    }
+    return (length < size) ? (int) length : -1;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Search options
+
+bool parseSearchOption(searchSettings* settings, const char* name, const char* value) {
+    // The setoption lines changing the search parameters, false for any other
+    // option or for an invalid value
+    if (strcmp(name, "exploration") == 0) {
+        settings->explorationConstant = atof(value);
+    } else if (strcmp(name, "sims") == 0 && atoi(value) > 0) {
+        settings->nbSims = atoi(value);
+    } else if (strcmp(name, "widening") == 0) {
+        settings->wideningCoefficient = atof(value);
+    } else if (strcmp(name, "prior") == 0) {
+        settings->priorWeight = atof(value);
+    } else if (strcmp(name, "rave") == 0) {
+        settings->raveEquivalence = atof(value);
+    } else if (strcmp(name, "playouts") == 0 && (strcmp(value, "uniform") == 0 || strcmp(value, "heavy") == 0)) {
+        settings->playoutPolicy = (strcmp(value, "heavy") == 0) ? 1 : 0;
+    } else if (strcmp(name, "evaluation") == 0 && (strcmp(value, "playouts") == 0 || strcmp(value, "static") == 0 || strcmp(value, "mixed") == 0)) {
+        settings->leafEvaluation = (strcmp(value, "static") == 0) ? 1 : (strcmp(value, "mixed") == 0) ? 2 : 0;
+    } else if (strcmp(name, "batch") == 0 && atoi(value) > 0) {
+        settings->evaluationBatch = atoi(value);
+    } else {
+        return false;
+    }
+    return true;
+}
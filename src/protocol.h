@@ -0,0 +1,46 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "board.h"
+#include "monte-carlo.h"
+
+////////////////////////////////////////////////////////////////////////////
+// Line protocol shared by penguins-engine, penguins-server and penguins-cluster
+
+// Largest map a position command may give, the rays of every size met are
+// kept until the program ends and grow with the cells times the map width
+#define MAX_POSITION_SIZE 64
+
+typedef struct _searchLimits {
+    long long iterations; // 0 means no limit
+    double moveTime; // In seconds, 0 means no limit
+} searchLimits;
+
+////////////////////////////////////////////////////////////////////////////
+// Output
+
+void reply(const char* format, ...);
+double now();
+
+////////////////////////////////////////////////////////////////////////////
+// Moves and positions, as written in the commands
+
+int formatMove(char* buffer, size_t size, boardMove move);
+bool parseMove(const char* token, boardMove* move);
+bool sameMove(boardMove a, boardMove b);
+bool isLegalMove(boardState* board, boardMove move);
+bool parsePlayedMove(boardState* board, const char* token, boardMove* move, bool* isPass);
+boardState* parsePosition(char** savePtr);
+int formatPosition(char* buffer, size_t size, boardState* board);
+
+////////////////////////////////////////////////////////////////////////////
+// Search options
+
+bool parseSearchOption(searchSettings* settings, const char* name, const char* value);
+
+
+#endif
@@ -1,4 +1,11 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
 #include "render.h"
+#include "asset-bundle.h"
+#include "timeline.h"
 
 // Ugly functions to render the game in 3D based on the board
 
@@ -10,41 +17,333 @@ float selectedSizeIncrease = 0.0f; // Size increase when a tile is clicked on
 boardPos selectedPos = (boardPos) {.x = 0, .y = 0}; // Memorize the last selected tile
 
 Ray ray = {0};  
-RayCollision collision = {0}; 
 
-Model blueFish;
-Model purpleFish;
-Model magentaFish;
+// Reachable tiles from the selected tile
+boardPosL* neighboursCache = NULL;
+bool areNeighboursCached = false;
+
+// Asset cache : every model and texture is loaded once, the pieces share
+// the models and only keep their own pose and orientation
+Model penguinModel;
+Model crocoModel;
+Texture2D penguinTexture;
+Texture2D crocoTexture;
+
+// The three colours of fishes are the same model with another texture
+Model fishModel;
+Texture2D fishTextures[3];
+const int FISH_MATERIAL = 2;
+
+// Materials whose texture is replaced by the one above, the other materials
+// keep the texture their model came with
+const int PENGUIN_MATERIAL = 1;
+const int CROCO_MATERIAL = 0;
+unsigned int defaultTextureId = 0;
+
+// Fishes are drawn with one instanced draw per mesh and per colour,
+// their transforms only change when the board does
+Shader instancingShader;
+Matrix* fishTransforms[3] = {NULL, NULL, NULL};
+int nbFishInstances[3] = {0, 0, 0};
+
+// The whole ice floe is a single mesh, rebuilt when a tile shatters
+Mesh iceMesh = {0};
+Material iceMaterial;
+bool hasIceMesh = false;
+
+const Color ICE_SIDE_COLOR = SKYBLUE;
+const Color ICE_TOP_COLOR = (Color){0xd8, 0xee, 0xff, 0xff};
+
+const char* INSTANCING_VERTEX_SHADER =
+    "#version 330\n"
+    "in vec3 vertexPosition;\n"
+    "in vec2 vertexTexCoord;\n"
+    "in vec4 vertexColor;\n"
+    "in mat4 instanceTransform;\n"
+    "uniform mat4 mvp;\n"
+    "out vec2 fragTexCoord;\n"
+    "out vec4 fragColor;\n"
+    "void main() {\n"
+    "    fragTexCoord = vertexTexCoord;\n"
+    "    fragColor = vertexColor;\n"
+    "    gl_Position = mvp * instanceTransform * vec4(vertexPosition, 1.0);\n"
+    "}\n";
+
+const char* INSTANCING_FRAGMENT_SHADER =
+    "#version 330\n"
+    "in vec2 fragTexCoord;\n"
+    "in vec4 fragColor;\n"
+    "uniform sampler2D texture0;\n"
+    "uniform vec4 colDiffuse;\n"
+    "out vec4 finalColor;\n"
+    "void main() {\n"
+    "    finalColor = texture(texture0, fragTexCoord) * colDiffuse * fragColor;\n"
+    "}\n";
+
 ModelAnimation* penguinAnimations;
 ModelAnimation* crocoAnimations;
 
-unsigned int nbPenguinAnims;
-unsigned int nbCrocoAnims;
+int nbPenguinAnims;
+int nbCrocoAnims;
+
+// Assets come from the baked bundle when there is one : a loader thread copies
+// them out of the mapping while the game starts, and the window thread uploads
+// them to the GPU a group at a time. Without a bundle, the groups are loaded
+// from the resources, one per frame. Until its group is there, a piece is a
+// plain cylinder and the fishes are not drawn.
+#define FISH_ASSETS 0
+#define PENGUIN_ASSETS 1
+#define CROCO_ASSETS 2
+#define NB_ASSET_GROUPS 3
+
+const char* ASSET_GROUPS[NB_ASSET_GROUPS] = {"fish", "penguin", "croco"};
+const char* FISH_TEXTURES[3] = {"blue", "purple", "magenta"};
+
+char resourcesDirectory[1024] = "../resources";
+assetBundle* bundle = NULL;
+pthread_t assetLoader;
+bool hasAssetLoader = false;
+
+atomic_int nbPreparedAssets = 0; // Groups the loader is done with, in order
+int nbUploadedAssets = 0;
+bool isPreparedFromBundle[NB_ASSET_GROUPS] = {false, false, false};
+bool isAssetLoaded[NB_ASSET_GROUPS] = {false, false, false};
+
+// Copies out of the bundle, waiting for their upload
+Model preparedModels[NB_ASSET_GROUPS];
+ModelAnimation* preparedAnimations[NB_ASSET_GROUPS] = {NULL, NULL, NULL};
+int nbPreparedAnimations[NB_ASSET_GROUPS] = {0, 0, 0};
 
 
 ////////////////////////////////////////////////////////////////////////////
 // Load 3D models
 
-void load3DModels() {
+Matrix fishTransform() {
+    return MatrixMultiply(MatrixMultiply(MatrixTranslate(1.5f, 0.0f, 0.0f), MatrixScale(0.15f, 0.15f, 0.15f)), MatrixRotateZ(PI / 2.0f));
+}
+
+int replacedMaterial(int group) {
+    if (group == FISH_ASSETS) {
+        return FISH_MATERIAL;
+    }
+    return (group == PENGUIN_ASSETS) ? PENGUIN_MATERIAL : CROCO_MATERIAL;
+}
+
+bool isModelTexture(Model model, int material, int replaced) {
+    // A texture only this material of the model owns, the first one using it
+    unsigned int id = model.materials[material].maps[MATERIAL_MAP_DIFFUSE].texture.id;
+    if (material == replaced || id == 0 || id == defaultTextureId) {
+        return false;
+    }
+    for (int m = 0; m < material; m++) {
+        if (m != replaced && model.materials[m].maps[MATERIAL_MAP_DIFFUSE].texture.id == id) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void replaceModelTexture(Model* model, int material, Texture2D texture) {
+    // The texture the material came with goes, unless another material uses it
+    Texture2D previous = model->materials[material].maps[MATERIAL_MAP_DIFFUSE].texture;
+    bool isOwned = previous.id != 0 && previous.id != defaultTextureId && previous.id != texture.id;
+    for (int m = 0; m < model->materialCount; m++) {
+        isOwned = isOwned && (m == material || model->materials[m].maps[MATERIAL_MAP_DIFFUSE].texture.id != previous.id);
+    }
+    if (isOwned) {
+        UnloadTexture(previous);
+    }
+    model->materials[material].maps[MATERIAL_MAP_DIFFUSE].texture = texture;
+}
+
+void unloadModelTextures(Model model, int replaced) {
+    // UnloadModel leaves the textures of the materials to the caller
+    for (int m = 0; m < model.materialCount; m++) {
+        if (isModelTexture(model, m, replaced)) {
+            UnloadTexture(model.materials[m].maps[MATERIAL_MAP_DIFFUSE].texture);
+        }
+    }
+}
+
+void finishAssetGroup(int group) {
+    // Same tweaks whatever the assets were loaded from
+    if (group == FISH_ASSETS) {
+        fishModel.transform = fishTransform();
+        for (int m = 0; m < fishModel.materialCount; m++) {
+            fishModel.materials[m].shader = instancingShader;
+        }
+        replaceModelTexture(&fishModel, FISH_MATERIAL, fishTextures[0]);
+    } else if (group == PENGUIN_ASSETS) {
+        replaceModelTexture(&penguinModel, PENGUIN_MATERIAL, penguinTexture);
+    } else {
+        replaceModelTexture(&crocoModel, CROCO_MATERIAL, crocoTexture);
+    }
+    isAssetLoaded[group] = true;
+}
+
+void loadAssetGroupFromFiles(int group) {
+    if (group == FISH_ASSETS) {
+        fishModel = LoadModel(TextFormat("%s/models/fish/scene.gltf", resourcesDirectory));
+        fishTextures[0] = LoadTexture(TextFormat("%s/models/fish/textures/blueFish.png", resourcesDirectory));
+        fishTextures[1] = LoadTexture(TextFormat("%s/models/fish/textures/purpleFish.png", resourcesDirectory));
+        fishTextures[2] = LoadTexture(TextFormat("%s/models/fish/textures/magentaFish.png", resourcesDirectory));
+    } else if (group == PENGUIN_ASSETS) {
+        penguinAnimations = LoadModelAnimations(TextFormat("%s/models/penguin/penguinAnims.glb", resourcesDirectory), &nbPenguinAnims);
+        penguinModel = LoadModel(TextFormat("%s/models/penguin/penguinAnims.glb", resourcesDirectory));
+        penguinTexture = LoadTexture(TextFormat("%s/models/penguin/textures/penguin_color.jpg", resourcesDirectory));
+    } else {
+        crocoAnimations = LoadModelAnimations(TextFormat("%s/models/crocodile/crocoAnims.glb", resourcesDirectory), &nbCrocoAnims);
+        crocoModel = LoadModel(TextFormat("%s/models/crocodile/crocoAnims.glb", resourcesDirectory));
+        crocoTexture = LoadTexture(TextFormat("%s/models/crocodile/textures/croco_color.jpg", resourcesDirectory));
+    }
+    finishAssetGroup(group);
+}
+
+bool hasBundleAssets() {
+    // Everything loadAssetGroupFromFiles would have loaded
+    char name[MAX_BUNDLE_NAME];
+    for (int group = 0; group < NB_ASSET_GROUPS; group++) {
+        snprintf(name, sizeof(name), "%s/model", ASSET_GROUPS[group]);
+        if (findBundleEntry(bundle, name, BUNDLE_MODEL) == NULL) {
+            return false;
+        }
+        if (group != FISH_ASSETS) {
+            snprintf(name, sizeof(name), "%s/animations", ASSET_GROUPS[group]);
+            bool hasAnimations = findBundleEntry(bundle, name, BUNDLE_ANIMATIONS) != NULL;
+            snprintf(name, sizeof(name), "%s/color", ASSET_GROUPS[group]);
+            if (!hasAnimations || findBundleEntry(bundle, name, BUNDLE_IMAGE) == NULL) {
+                return false;
+            }
+        }
+    }
+    for (int k = 0; k < 3; k++) {
+        snprintf(name, sizeof(name), "fish/%s", FISH_TEXTURES[k]);
+        if (findBundleEntry(bundle, name, BUNDLE_IMAGE) == NULL) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool prepareAssetGroup(int group) {
+    // Loader thread : the pages of the group are read, then its meshes and
+    // animations copied, nothing touches the GPU
+    char prefix[MAX_BUNDLE_NAME];
+    int prefixLength = snprintf(prefix, sizeof(prefix), "%s/", ASSET_GROUPS[group]);
+    for (uint32_t i = 0; i < bundle->header->nbEntries; i++) {
+        if (strncmp(bundle->entries[i].name, prefix, prefixLength) == 0) {
+            prefaultBundleEntry(bundle, &bundle->entries[i]);
+        }
+    }
+
+    char name[MAX_BUNDLE_NAME];
+    snprintf(name, sizeof(name), "%s/model", ASSET_GROUPS[group]);
+    if (!prepareBundleModel(bundle, findBundleEntry(bundle, name, BUNDLE_MODEL), &preparedModels[group])) {
+        return false;
+    }
+    if (group != FISH_ASSETS) {
+        snprintf(name, sizeof(name), "%s/animations", ASSET_GROUPS[group]);
+        preparedAnimations[group] = prepareBundleAnimations(bundle, findBundleEntry(bundle, name, BUNDLE_ANIMATIONS), &nbPreparedAnimations[group]);
+        if (preparedAnimations[group] == NULL) {
+            freePreparedBundleModel(&preparedModels[group]);
+            return false;
+        }
+    }
+    return true;
+}
+
+void* prepareAssets(void* arg) {
+    (void) arg;
+    nameTimelineThread("assets");
+    for (int group = 0; group < NB_ASSET_GROUPS; group++) {
+        int64_t span = timelineBegin();
+        isPreparedFromBundle[group] = prepareAssetGroup(group);
+        timelineEnd("prepareAssets", span);
+        atomic_store_explicit(&nbPreparedAssets, group + 1, memory_order_release);
+    }
+    return NULL;
+}
+
+void uploadAssetGroup(int group) {
+    // Window thread : a group the loader failed to prepare comes from the resources
+    if (!isPreparedFromBundle[group]) {
+        loadAssetGroupFromFiles(group);
+        return;
+    }
+
+    char name[MAX_BUNDLE_NAME];
+    snprintf(name, sizeof(name), "%s/model", ASSET_GROUPS[group]);
+    Model* model = &preparedModels[group];
+    uploadBundleModel(bundle, findBundleEntry(bundle, name, BUNDLE_MODEL), model, replacedMaterial(group));
+    if (group != FISH_ASSETS) {
+        snprintf(name, sizeof(name), "%s/color", ASSET_GROUPS[group]);
+    }
+
+    if (group == FISH_ASSETS) {
+        fishModel = *model;
+        for (int k = 0; k < 3; k++) {
+            snprintf(name, sizeof(name), "fish/%s", FISH_TEXTURES[k]);
+            fishTextures[k] = uploadBundleTexture(bundle, name);
+        }
+    } else if (group == PENGUIN_ASSETS) {
+        penguinModel = *model;
+        penguinTexture = uploadBundleTexture(bundle, name);
+        penguinAnimations = preparedAnimations[group];
+        nbPenguinAnims = nbPreparedAnimations[group];
+    } else {
+        crocoModel = *model;
+        crocoTexture = uploadBundleTexture(bundle, name);
+        crocoAnimations = preparedAnimations[group];
+        nbCrocoAnims = nbPreparedAnimations[group];
+    }
+    preparedAnimations[group] = NULL;
+    finishAssetGroup(group);
+}
+
+void startLoadingAssets(const char* resourcesDir) {
+    // Returns at once, the assets come with the next calls to streamAssets
+    snprintf(resourcesDirectory, sizeof(resourcesDirectory), "%s", resourcesDir);
 
-    penguinAnimations = LoadModelAnimations("../resources/models/penguin/penguinAnims.glb", &nbPenguinAnims);
-    crocoAnimations = LoadModelAnimations("../resources/models/crocodile/crocoAnims.glb", &nbCrocoAnims);
+    // Same output as the default shader, with a transform per instance
+    instancingShader = LoadShaderFromMemory(INSTANCING_VERTEX_SHADER, INSTANCING_FRAGMENT_SHADER);
+    instancingShader.locs[SHADER_LOC_MATRIX_MVP] = GetShaderLocation(instancingShader, "mvp");
+    instancingShader.locs[SHADER_LOC_MATRIX_MODEL] = GetShaderLocationAttrib(instancingShader, "instanceTransform");
 
-    blueFish = LoadModel("../resources/models/fish/scene.gltf");
-    Texture2D blueTexture = LoadTexture("../resources/models/fish/textures/blueFish.png");
-    blueFish.materials[2].maps[MATERIAL_MAP_DIFFUSE].texture = blueTexture; 
-    blueFish.transform = MatrixMultiply(MatrixMultiply(MatrixTranslate(1.5f, 0.0f, 0.0f), MatrixScale(0.15f, 0.15f, 0.15f)), MatrixRotateZ(PI / 2.0f));
+    // The ice mesh only has vertex colours
+    iceMaterial = LoadMaterialDefault();
+    defaultTextureId = iceMaterial.maps[MATERIAL_MAP_DIFFUSE].texture.id;
 
-    purpleFish = LoadModel("../resources/models/fish/scene.gltf");
-    Texture2D purpleTexture = LoadTexture("../resources/models/fish/textures/purpleFish.png");
-    purpleFish.materials[2].maps[MATERIAL_MAP_DIFFUSE].texture = purpleTexture; 
-    purpleFish.transform = MatrixMultiply(MatrixMultiply(MatrixTranslate(1.5f, 0.0f, 0.0f), MatrixScale(0.15f, 0.15f, 0.15f)), MatrixRotateZ(PI / 2.0f));
+    bundle = openAssetBundle(TextFormat("%s/penguins.bundle", resourcesDirectory));
+    if (bundle != NULL && !hasBundleAssets()) {
+        closeAssetBundle(bundle);
+        bundle = NULL;
+    }
+    if (bundle == NULL) {
+        TraceLog(LOG_WARNING, "No asset bundle in %s, loading the raw resources", resourcesDirectory);
+        atomic_store(&nbPreparedAssets, NB_ASSET_GROUPS);
+        return;
+    }
+    hasAssetLoader = pthread_create(&assetLoader, NULL, prepareAssets, NULL) == 0;
+    if (!hasAssetLoader) {
+        prepareAssets(NULL);
+    }
+}
 
-    magentaFish = LoadModel("../resources/models/fish/scene.gltf");
-    Texture2D magentaTexture = LoadTexture("../resources/models/fish/textures/magentaFish.png");
-    magentaFish.materials[2].maps[MATERIAL_MAP_DIFFUSE].texture = magentaTexture; 
-    magentaFish.transform = MatrixMultiply(MatrixMultiply(MatrixTranslate(1.5f, 0.0f, 0.0f), MatrixScale(0.15f, 0.15f, 0.15f)), MatrixRotateZ(PI / 2.0f));  
+void streamAssets(double timeBudget) {
+    // Uploads the groups ready so far, at least one when there is one, and
+    // then as many as the budget allows
+    double start = GetTime();
+    int nbPrepared = atomic_load_explicit(&nbPreparedAssets, memory_order_acquire);
+    while (nbUploadedAssets < nbPrepared) {
+        uploadAssetGroup(nbUploadedAssets++);
+        if (GetTime() - start > timeBudget) {
+            break;
+        }
+    }
+}
 
+bool areAssetsLoaded() {
+    return nbUploadedAssets == NB_ASSET_GROUPS;
 }
 
 
@@ -65,16 +364,11 @@ pieceModel* createPieceModel(boardPos pos, bool isPenguin) {
     newPiece->movingProgress = 0.0f;
     newPiece->currentMove = (boardMove) {.start = (boardPos) {.x = 0, .y = 0}, .end = (boardPos) {.x = 0, .y = 0}};
 
+    // The model itself is shared by all the pieces of the same kind
     if (isPenguin) {
-        newPiece->pieceModel = LoadModel("../resources/models/penguin/penguinAnims.glb"); 
-        Texture2D penguinTexture = LoadTexture("../resources/models/penguin/textures/penguin_color.jpg");
-        newPiece->pieceModel.materials[1].maps[MATERIAL_MAP_DIFFUSE].texture = penguinTexture; 
-        newPiece->pieceModel.transform = MatrixMultiply(MatrixTranslate(0.0f, 0.0f, 0.0f), MatrixMultiply(MatrixRotateX(PI / 2.0f), MatrixScale(0.06f, 0.06f, 0.06f)));
+        newPiece->transform = MatrixMultiply(MatrixTranslate(0.0f, 0.0f, 0.0f), MatrixMultiply(MatrixRotateX(PI / 2.0f), MatrixScale(0.06f, 0.06f, 0.06f)));
     } else {
-        newPiece->pieceModel = LoadModel("../resources/models/crocodile/crocoAnims.glb"); 
-        Texture2D crocoTexture = LoadTexture("../resources/models/crocodile/textures/croco_color.jpg");
-        newPiece->pieceModel.materials[0].maps[MATERIAL_MAP_DIFFUSE].texture = crocoTexture; 
-        newPiece->pieceModel.transform = MatrixMultiply(MatrixTranslate(0.0f, 0.0f, 0.0f), MatrixMultiply(MatrixRotateX(PI / 2.0f), MatrixScale(5.0f, 5.0f, 5.0f)));
+        newPiece->transform = MatrixMultiply(MatrixTranslate(0.0f, 0.0f, 0.0f), MatrixMultiply(MatrixRotateX(PI / 2.0f), MatrixScale(5.0f, 5.0f, 5.0f)));
     }
 
     newPiece->currentAnimation = 1;
@@ -153,7 +447,6 @@ void makePiecesDance(pieceModelL* pieces) {
 // Free allocated stuff
 
 void freePieceModel(pieceModel* piece) {
-    UnloadModel(piece->pieceModel);
     free(piece);
 }
 
@@ -166,10 +459,49 @@ void freePieceModelL(pieceModelL* pieces) {
 }
 
 void unloadAllModels(pieceModelL* pieces) {
-    UnloadModel(blueFish);
-    UnloadModel(purpleFish);
-    UnloadModel(magentaFish);
+    // Whatever was loaded, then the copies the loader left
+    if (hasAssetLoader) {
+        pthread_join(assetLoader, NULL);
+    }
+    if (isAssetLoaded[FISH_ASSETS]) {
+        unloadModelTextures(fishModel, FISH_MATERIAL);
+        UnloadModel(fishModel);
+        for (int k = 0; k < 3; k++) {
+            UnloadTexture(fishTextures[k]);
+        }
+    }
+    if (isAssetLoaded[PENGUIN_ASSETS]) {
+        unloadModelTextures(penguinModel, PENGUIN_MATERIAL);
+        UnloadModel(penguinModel);
+        UnloadTexture(penguinTexture);
+        UnloadModelAnimations(penguinAnimations, nbPenguinAnims);
+    }
+    if (isAssetLoaded[CROCO_ASSETS]) {
+        unloadModelTextures(crocoModel, CROCO_MATERIAL);
+        UnloadModel(crocoModel);
+        UnloadTexture(crocoTexture);
+        UnloadModelAnimations(crocoAnimations, nbCrocoAnims);
+    }
+    for (int group = nbUploadedAssets; group < NB_ASSET_GROUPS; group++) {
+        if (isPreparedFromBundle[group]) {
+            freePreparedBundleModel(&preparedModels[group]);
+            if (preparedAnimations[group] != NULL) {
+                UnloadModelAnimations(preparedAnimations[group], nbPreparedAnimations[group]);
+            }
+        }
+    }
+    closeAssetBundle(bundle);
+
+    UnloadShader(instancingShader);
+    if (hasIceMesh) {
+        UnloadMesh(iceMesh);
+    }
+    UnloadMaterial(iceMaterial);
+    for (int k = 0; k < 3; k++) {
+        free(fishTransforms[k]);
+    }
     freePieceModelL(pieces);
+    freeBoardPosL(neighboursCache);
 }
 
 ////////////////////////////////////////////////////////////////////////////
@@ -183,21 +515,30 @@ Vector3 renderPosFromBoardPos(boardPos pos, float y) {
 }
 
 
+void drawPiece(pieceModel* piece, Vector3 position) {
+    // The shared model takes the orientation of the piece, a cylinder stands in until it is loaded
+    if (!isAssetLoaded[piece->isPenguin ? PENGUIN_ASSETS : CROCO_ASSETS]) {
+        DrawCylinder(position, 0.6f, 0.9f, 2.0f, 12, piece->isPenguin ? LIGHTGRAY : DARKGREEN);
+        return;
+    }
+    Model* model = piece->isPenguin ? &penguinModel : &crocoModel;
+    model->transform = piece->transform;
+    DrawModel(*model, position, 1.0f, WHITE);
+}
+
 void renderPieces(pieceModelL* pieces) {
     // Render all the pieces, either idle or running
 
     while (pieces != NULL) {
-        ModelAnimation anim;
+        // The shared model takes the pose of the piece just before it is drawn
+        if (isAssetLoaded[pieces->piece->isPenguin ? PENGUIN_ASSETS : CROCO_ASSETS]) {
+            Model* model = pieces->piece->isPenguin ? &penguinModel : &crocoModel;
+            ModelAnimation anim = pieces->piece->isPenguin ? penguinAnimations[pieces->piece->currentAnimation] : crocoAnimations[pieces->piece->currentAnimation];
 
-        if (pieces->piece->isPenguin) {
-            ModelAnimation anim = penguinAnimations[pieces->piece->currentAnimation];
-        } else {
-            ModelAnimation anim = crocoAnimations[pieces->piece->currentAnimation];
+            pieces->piece->currentAnimationFrame = (pieces->piece->currentAnimationFrame + 1) % anim.frameCount;
+            UpdateModelAnimation(*model, anim, pieces->piece->currentAnimationFrame);
         }
 
-        pieces->piece->currentAnimationFrame = (pieces->piece->currentAnimationFrame + 1) % anim.frameCount;
-        UpdateModelAnimation(pieces->piece->pieceModel, anim, pieces->piece->currentAnimationFrame);
-
         Vector3 startPos = renderPosFromBoardPos(pieces->piece->pos, 0.6f);
         
         if (pieces->piece->isCurrentlyMoving) {
@@ -205,10 +546,10 @@ void renderPieces(pieceModelL* pieces) {
 
             float distance = sqrt(pow(endPos.x - startPos.x, 2) + pow(endPos.y - startPos.y, 2));
             
-            pieces->piece->pieceModel.transform = MatrixMultiply(pieces->piece->pieceModel.transform, MatrixRotateY(-pieces->piece->angle));
+            pieces->piece->transform = MatrixMultiply(pieces->piece->transform, MatrixRotateY(-pieces->piece->angle));
             float angle = 3 * PI / 2 - atan2(startPos.z - endPos.z, startPos.x - endPos.x);
             pieces->piece->angle = angle;
-            pieces->piece->pieceModel.transform = MatrixMultiply(pieces->piece->pieceModel.transform, MatrixRotateY(pieces->piece->angle));
+            pieces->piece->transform = MatrixMultiply(pieces->piece->transform, MatrixRotateY(pieces->piece->angle));
             
 
 
@@ -219,7 +560,7 @@ void renderPieces(pieceModelL* pieces) {
                 .y = 0.6f, 
                 .z = startPos.z + (endPos.z - startPos.z) / distance * pieces->piece->movingProgress};
 
-                DrawModel(pieces->piece->pieceModel, currentPos, 1.0f, WHITE);
+                drawPiece(pieces->piece, currentPos);
                 pieces->piece->movingProgress += 0.2f;
 
             }
@@ -234,7 +575,7 @@ void renderPieces(pieceModelL* pieces) {
      
         } else {
             // Idle
-            DrawModel(pieces->piece->pieceModel, startPos, 1.0f, WHITE);
+            drawPiece(pieces->piece, startPos);
         }
 
         pieces = pieces->next;
@@ -248,6 +589,80 @@ bool isPlayingPieceSelected(boardState* board) {
 ////////////////////////////////////////////////////////////////////////////
 // Rendering the board
 
+void addIceTriangle(Mesh* mesh, int* nbVertices, Vector3 a, Vector3 b, Vector3 c, Color color) {
+    Vector3 corners[3] = {a, b, c};
+    for (int k = 0; k < 3; k++) {
+        mesh->vertices[3 * *nbVertices] = corners[k].x;
+        mesh->vertices[3 * *nbVertices + 1] = corners[k].y;
+        mesh->vertices[3 * *nbVertices + 2] = corners[k].z;
+        mesh->colors[4 * *nbVertices] = color.r;
+        mesh->colors[4 * *nbVertices + 1] = color.g;
+        mesh->colors[4 * *nbVertices + 2] = color.b;
+        mesh->colors[4 * *nbVertices + 3] = color.a;
+        *nbVertices += 1;
+    }
+}
+
+void updateIceMesh(boardState* board) {
+    // Same prisms as drawHexagonalPrism, for all the ice tiles at once
+    if (hasIceMesh) {
+        UnloadMesh(iceMesh);
+        hasIceMesh = false;
+    }
+
+    int nbTiles = 0;
+    for (int i = 0; i < board->sizeX; i++) {
+        for (int j = 0; j < board->sizeY; j++) {
+            nbTiles += (board->map[i][j] > 0);
+        }
+    }
+    if (nbTiles == 0) {
+        return;
+    }
+
+    // 12 triangles on the sides and 6 on the top of every tile
+    iceMesh = (Mesh) {0};
+    iceMesh.triangleCount = 18 * nbTiles;
+    iceMesh.vertexCount = 3 * iceMesh.triangleCount;
+    iceMesh.vertices = (float*) MemAlloc(3 * iceMesh.vertexCount * sizeof(float));
+    iceMesh.colors = (unsigned char*) MemAlloc(4 * iceMesh.vertexCount * sizeof(unsigned char));
+
+    int nbVertices = 0;
+    float angle = 2.0f * PI / 6.0f;
+
+    for (int i = 0; i < board->sizeX; i++) {
+        for (int j = 0; j < board->sizeY; j++) {
+            if (board->map[i][j] <= 0) {
+                continue;
+            }
+
+            Vector3 position = renderPosFromBoardPos((boardPos){.x=i, .y=j}, 0.5f);
+            Vector3 baseVertices[6];
+            Vector3 topVertices[6];
+            for (int k = 0; k < 6; k++) {
+                baseVertices[k] = (Vector3){position.x + HEX_SIZE * cosf((k + 0.5) * angle), position.y, position.z + HEX_SIZE * sinf((k + 0.5) * angle)};
+                topVertices[k] = (Vector3){baseVertices[k].x, position.y + HEX_HEIGHT, baseVertices[k].z};
+            }
+
+            for (int k = 0; k < 6; k++) {
+                addIceTriangle(&iceMesh, &nbVertices, baseVertices[k], topVertices[k], baseVertices[(k + 1) % 6], ICE_SIDE_COLOR);
+                addIceTriangle(&iceMesh, &nbVertices, baseVertices[(k + 1) % 6], topVertices[k], topVertices[(k + 1) % 6], ICE_SIDE_COLOR);
+                addIceTriangle(&iceMesh, &nbVertices, topVertices[k], position, topVertices[(k + 1) % 6], ICE_TOP_COLOR);
+            }
+        }
+    }
+
+    UploadMesh(&iceMesh, false);
+    hasIceMesh = true;
+}
+
+void updateBoardRender(boardState* board) {
+    // Geometry depending on the tiles, must be called every time the board changes
+    updateIceMesh(board);
+    updateFishInstances(board);
+    areNeighboursCached = false;
+}
+
 void drawHexagonalPrism(Vector3 position, bool isSelected) {
     // Iceberg rendering
 
@@ -345,43 +760,71 @@ void drawMove(boardMove move) {
     
 }
 
-void renderBoard(boardState* board) {
-
-    DrawPlane((Vector3){0.0f, -1.0f, 0.0f}, (Vector2){5000.0f, 5000.0f}, (Color){0x03, 0x52, 0x8e, 0xff});
+void updateFishInstances(boardState* board) {
+    // Transforms of all the fishes, by number of fishes on their tile
+    Vector3 offsets[3][3] = {
+        {{0.0f, 0.6f, 0.0f}},
+        {{-0.7f, 0.6f, 0.0f}, {0.7f, 0.6f, 0.0f}},
+        {{-0.3f, 0.6f, 0.0f}, {0.3f, 0.6f, 0.0f}, {0.0f, 1.0f, 0.0f}}
+    };
+
+    for (int k = 0; k < 3; k++) {
+        fishTransforms[k] = realloc(fishTransforms[k], (k + 1) * board->sizeX * board->sizeY * sizeof(Matrix));
+        nbFishInstances[k] = 0;
+    }
 
     for (int i = 0; i < board->sizeX; i++) {
         for (int j = 0; j < board->sizeY; j++) {
+            int nbFishes = board->map[i][j];
+            if (nbFishes < 1 || nbFishes > 3) {
+                continue;
+            }
 
             Vector3 renderPos = renderPosFromBoardPos((boardPos){.x=i, .y=j}, 0.0f);
-            
-            if (board->map[i][j] > 0) {
-                // Iceberg
-                float rotationAngle = PI / 6.0f;
-                drawHexagonalPrism((Vector3){renderPos.x, 0.5f, renderPos.z}, (i == selectedPos.x && j == selectedPos.y));
+            int k = nbFishes - 1;
+            for (int f = 0; f < nbFishes; f++) {
+                Matrix translation = MatrixTranslate(renderPos.x + offsets[k][f].x, offsets[k][f].y, renderPos.z + offsets[k][f].z);
+                fishTransforms[k][nbFishInstances[k]++] = MatrixMultiply(fishTransform(), translation);
             }
+        }
+    }
+}
 
-            if (board->map[i][j] == 1) {
-                DrawModel(blueFish, (Vector3){renderPos.x, 0.6f, renderPos.z}, 1.0f, WHITE);
-            }
+void drawFishes() {
+    // One instanced draw per mesh of the fish model and per colour
+    if (!isAssetLoaded[FISH_ASSETS]) {
+        return;
+    }
+    for (int k = 0; k < 3; k++) {
+        if (nbFishInstances[k] == 0) {
+            continue;
+        }
+        fishModel.materials[FISH_MATERIAL].maps[MATERIAL_MAP_DIFFUSE].texture = fishTextures[k];
+        for (int m = 0; m < fishModel.meshCount; m++) {
+            Material material = fishModel.materials[fishModel.meshMaterial[m]];
+            DrawMeshInstanced(fishModel.meshes[m], material, fishTransforms[k], nbFishInstances[k]);
+        }
+    }
+}
 
-            if (board->map[i][j] == 2) {
-                DrawModel(purpleFish, (Vector3){renderPos.x - 0.7f, 0.6f, renderPos.z}, 1.0f, WHITE);
-                DrawModel(purpleFish, (Vector3){renderPos.x + 0.7f, 0.6f, renderPos.z}, 1.0f, WHITE);
-            }
+void renderBoard(boardState* board) {
 
-            if (board->map[i][j] == 3) {
-                DrawModel(magentaFish, (Vector3){renderPos.x - 0.3f, 0.6f, renderPos.z}, 1.0f, WHITE);
-                DrawModel(magentaFish, (Vector3){renderPos.x + 0.3f, 0.6f, renderPos.z}, 1.0f, WHITE);
-                DrawModel(magentaFish, (Vector3){renderPos.x, 1.0f, renderPos.z}, 1.0f, WHITE);
-            }
+    DrawPlane((Vector3){0.0f, -1.0f, 0.0f}, (Vector2){5000.0f, 5000.0f}, (Color){0x03, 0x52, 0x8e, 0xff});
 
-        }
+    if (hasIceMesh) {
+        DrawMesh(iceMesh, iceMaterial, MatrixIdentity());
+    }
+
+    if (board->map[selectedPos.x][selectedPos.y] > 0) {
+        // Highlight of the selected iceberg, slightly above the mesh to cover it
+        Vector3 renderPos = renderPosFromBoardPos(selectedPos, 0.51f);
+        drawHexagonalPrism(renderPos, true);
     }
 
+    drawFishes();
+
     if (isPlayingPieceSelected(board)) {
-        boardPosL* neighboursOfSelected = neighbours(selectedPos, board);
-        drawNeighbours(neighboursOfSelected);
-        freeBoardPosL(neighboursOfSelected);
+        drawNeighbours(selectedNeighbours(board));
     }
 
     selectedSizeIncrease *= 0.9;
@@ -390,67 +833,105 @@ void renderBoard(boardState* board) {
 
 
 ////////////////////////////////////////////////////////////////////////////
-// Hitboxes and click detection
+// Tile picking and click detection
+
+boardPosL* selectedNeighbours(boardState* board) {
+    // Tiles reachable from the selected tile, computed again only after
+    // the selection or the board changed
+    if (!areNeighboursCached) {
+        freeBoardPosL(neighboursCache);
+        neighboursCache = neighbours(selectedPos, board);
+        areNeighboursCached = true;
+    }
+    return neighboursCache;
+}
 
-BoundingBox hexHitbox(int i, int j) {
-    // A basic box to intercept the ray from the camera
-    Vector3 renderPos = renderPosFromBoardPos((boardPos){.x=i, .y=j}, HEX_HEIGHT);
+void selectPos(boardPos pos) {
+    selectedPos = pos;
+    areNeighboursCached = false;
+}
 
-    return (BoundingBox){(Vector3){renderPos.x - 1.5f, renderPos.y - 0.1f, renderPos.z - 1.5f},
-                        (Vector3){renderPos.x + 1.5f, renderPos.y + 0.1f, renderPos.z + 1.5f}};
+bool pickBoardPos(boardState* board, Ray ray, boardPos* picked) {
+    // Intersection of the ray with the plane of the tiles, then conversion of the point
+    // to the hexagon containing it : the tiles are pointy hexagons with their centers
+    // HEX_SPACING apart, in rows shifted by half a tile every other line
+    if (fabsf(ray.direction.y) < 1e-6f) {
+        return false;
+    }
+    float t = (HEX_HEIGHT - ray.position.y) / ray.direction.y;
+    if (t < 0.0f) {
+        return false;
+    }
+    float worldX = ray.position.x + t * ray.direction.x;
+    float worldZ = ray.position.z + t * ray.direction.z;
+
+    // Axial coordinates, rounded in cube coordinates
+    float radius = HEX_SPACING / sqrtf(3.0f);
+    float q = (sqrtf(3.0f) / 3.0f * worldX - worldZ / 3.0f) / radius;
+    float r = (2.0f / 3.0f * worldZ) / radius;
+    float s = -q - r;
+
+    float roundedQ = roundf(q);
+    float roundedR = roundf(r);
+    float roundedS = roundf(s);
+    float errorQ = fabsf(roundedQ - q);
+    float errorR = fabsf(roundedR - r);
+    float errorS = fabsf(roundedS - s);
+    if (errorQ > errorR && errorQ > errorS) {
+        roundedQ = -roundedR - roundedS;
+    } else if (errorR > errorS) {
+        roundedR = -roundedQ - roundedS;
+    }
+
+    // Back to the board coordinates, the row is y and the shifted rows are the odd ones
+    int row = (int) roundedR;
+    int column = (int) roundedQ + (row - (row & 1)) / 2;
+    if (column < 0 || column >= board->sizeX || row < 0 || row >= board->sizeY) {
+        return false;
+    }
+
+    *picked = (boardPos){.x = column, .y = row};
+    return true;
 }
 
 boardMoveL* updateSelectedPos(boardState* mainBoard, Camera3D camera, pieceModelL* pieces, bool hasClicked) {
-    // Check if any iceberg hitbox intercepts the camera ray
+    // Check which tile is under the mouse
     // Returns a move list containing the move to do, or an empty move list
-    collision.hit = false;
-
     boardMoveL* movesDetected = NULL;
+    boardPos hitPos;
 
-    boardPosL* neighboursOfSelected = neighbours(selectedPos, mainBoard);
-            
     ray = GetScreenToWorldRay(GetMousePosition(), camera);
+    if (!pickBoardPos(mainBoard, ray, &hitPos)) {
+        return NULL;
+    }
 
-    for (int i=0; i < mainBoard->sizeX; i++) {
-        for (int j=0; j < mainBoard->sizeY; j++) {
-            collision = GetRayCollisionBox(ray, hexHitbox(i, j));
-            if (collision.hit) {
-                
-                boardPos hitPos = (boardPos){.x = i, .y = j};
-                if (isPlayingPieceSelected(mainBoard) && posInList(hitPos, neighboursOfSelected)) {
-
-                    if (hasClicked) {
-                        // The move is played
-                        boardMove moveToPlay = (boardMove) {.start = (boardPos){.x = selectedPos.x, .y = selectedPos.y}, hitPos};
-                        
-                        selectedPos.x = 0;
-                        selectedPos.y = 0;
-
-                        movesDetected = addMove(movesDetected, moveToPlay);
-                    } else {
-                        drawMove((boardMove) {.start = selectedPos, .end=hitPos});
-                    }
-
-                } else {
-                    if (hasClicked) {
-                        // A tile is selected
-                        pieceModel* selectedPiece = getPieceModelByPosition(pieces,hitPos);
-                        if (selectedPiece != NULL) {
-                            changeAnimation(selectedPiece, 2, 60);
-                        }
-
-                        selectedPos.x = i;
-                        selectedPos.y = j;
-                        selectedSizeIncrease = 0.8f;
-                    }
-                }   
-            
+    if (isPlayingPieceSelected(mainBoard) && posInList(hitPos, selectedNeighbours(mainBoard))) {
+
+        if (hasClicked) {
+            // The move is played
+            boardMove moveToPlay = (boardMove) {.start = (boardPos){.x = selectedPos.x, .y = selectedPos.y}, hitPos};
+
+            selectPos((boardPos){.x = 0, .y = 0});
+
+            movesDetected = addMove(movesDetected, moveToPlay);
+        } else {
+            drawMove((boardMove) {.start = selectedPos, .end=hitPos});
+        }
+
+    } else {
+        if (hasClicked) {
+            // A tile is selected
+            pieceModel* selectedPiece = getPieceModelByPosition(pieces,hitPos);
+            if (selectedPiece != NULL) {
+                changeAnimation(selectedPiece, 2, 60);
             }
+
+            selectPos(hitPos);
+            selectedSizeIncrease = 0.8f;
         }
-    }    
+    }
 
-    freeBoardPosL(neighboursOfSelected);
-    return movesDetected;       
+    return movesDetected;
 }
 
 ////////////////////////////////////////////////////////////////////////////
@@ -20,7 +20,7 @@ typedef struct _pieceModel {
     float movingProgress;
     boardMove currentMove;
 
-    Model pieceModel;
+    Matrix transform; // Orientation of the piece, its model is shared
     ModelAnimation* animations;
     int currentAnimation;
     int currentAnimationFrame;
@@ -36,7 +36,20 @@ typedef struct _pieceModelL {
 ////////////////////////////////////////////////////////////////////////////
 // Load 3D models
 
-void load3DModels();
+Matrix fishTransform();
+int replacedMaterial(int group);
+bool isModelTexture(Model model, int material, int replaced);
+void replaceModelTexture(Model* model, int material, Texture2D texture);
+void unloadModelTextures(Model model, int replaced);
+void finishAssetGroup(int group);
+void loadAssetGroupFromFiles(int group);
+bool hasBundleAssets();
+bool prepareAssetGroup(int group);
+void* prepareAssets(void* arg);
+void uploadAssetGroup(int group);
+void startLoadingAssets(const char* resourcesDir);
+void streamAssets(double timeBudget);
+bool areAssetsLoaded();
 
 ////////////////////////////////////////////////////////////////////////////
 // 3D models and animations for penguins and crocodiles
@@ -63,6 +76,7 @@ void unloadAllModels(pieceModelL* pieces);
 // Rendering the pieces
 
 Vector3 renderPosFromBoardPos(boardPos pos, float y);
+void drawPiece(pieceModel* piece, Vector3 position);
 void renderPieces(pieceModelL* pieces);
 bool isPlayingPieceSelected(boardState* board);
 
@@ -72,12 +86,19 @@ bool isPlayingPieceSelected(boardState* board);
 void drawHexagonalPrism(Vector3 position, bool isSelected);
 void drawNeighbours(boardPosL* neighboursL);
 void drawMove(boardMove move);
+void addIceTriangle(Mesh* mesh, int* nbVertices, Vector3 a, Vector3 b, Vector3 c, Color color);
+void updateIceMesh(boardState* board);
+void updateBoardRender(boardState* board);
+void updateFishInstances(boardState* board);
+void drawFishes();
 void renderBoard(boardState* board);
 
 ////////////////////////////////////////////////////////////////////////////
-// Hitboxes and click detection
+// Tile picking and click detection
 
-BoundingBox hexHitbox(int i, int j);
+boardPosL* selectedNeighbours(boardState* board);
+void selectPos(boardPos pos);
+bool pickBoardPos(boardState* board, Ray ray, boardPos* picked);
 boardMoveL* updateSelectedPos(boardState* mainBoard, Camera3D camera, pieceModelL* pieces,bool hasClicked);
 
 ////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,271 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "search-feed.h"
+
+// Live statistics of a running search : the search thread publishes snapshots
+// of its root into a double buffer, an exporter thread writes the new ones
+// as JSON lines to a file or to the dashboards connected on a Unix socket
+//
+// Neither side takes a lock : every buffer carries a sequence number, odd while
+// it is written, and readers copy a snapshot again when its number moved
+
+
+////////////////////////////////////////////////////////////////////////////
+// Publishing snapshots, from the search thread only
+
+searchStats* beginStatsUpdate(statsFeed* feed) {
+    // The buffer that is not the latest one, readers may still be copying it
+    int next = 1 - atomic_load_explicit(&feed->latest, memory_order_relaxed);
+    statsBuffer* buffer = &feed->buffers[next];
+    atomic_fetch_add_explicit(&buffer->sequence, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    return &buffer->stats;
+}
+
+void endStatsUpdate(statsFeed* feed) {
+    int next = 1 - atomic_load_explicit(&feed->latest, memory_order_relaxed);
+    atomic_fetch_add_explicit(&feed->buffers[next].sequence, 1, memory_order_release);
+    atomic_store_explicit(&feed->latest, next, memory_order_release);
+    atomic_fetch_add_explicit(&feed->nbPublished, 1, memory_order_release);
+}
+
+void fillSearchStats(searchStats* stats, mcts* tree, boardState* board, long long iterations, double elapsed) {
+    stats->iterations = iterations;
+    stats->elapsed = elapsed;
+    stats->iterationsPerSecond = (elapsed > 0) ? iterations / elapsed : 0.0;
+
+    stats->playerToPlay = board->playerToPlay;
+    stats->nbVisits = tree->nbVisits;
+    stats->p1WinRatio = (tree->nbVisits > 0) ? (float) tree->nbP1Wins / (float) tree->nbVisits : 0.5f;
+
+    stats->nbSons = (tree->nbSons < MAX_FEED_SONS) ? tree->nbSons : MAX_FEED_SONS;
+    for (int i = 0; i < stats->nbSons; i++) {
+        stats->sonMoves[i] = sonMove(tree, i);
+        stats->sonVisits[i] = sonNbVisits(tree, i);
+    }
+
+    // Principal variation : the most visited son, again and again
+    stats->pvLength = 0;
+    while (stats->pvLength < MAX_FEED_PV && tree->nbVisits > 0 && tree->nbSons > 0) {
+        int sonIndex = 0;
+        for (int i = 1; i < tree->nbSons; i++) {
+            if (sonNbVisits(tree, i) > sonNbVisits(tree, sonIndex)) {
+                sonIndex = i;
+            }
+        }
+        if (sonNbVisits(tree, sonIndex) == 0) {
+            break;
+        }
+        stats->pv[stats->pvLength++] = sonMove(tree, sonIndex);
+        tree = sonNode(tree, sonIndex);
+    }
+}
+
+void publishSearchStats(statsFeed* feed, mcts* tree, boardState* board, long long iterations, double elapsed) {
+    // Called by the thread owning the tree, between two descents
+    searchStats* stats = beginStatsUpdate(feed);
+    fillSearchStats(stats, tree, board, iterations, elapsed);
+    endStatsUpdate(feed);
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Reading snapshots, from any thread
+
+long long readSearchStats(statsFeed* feed, searchStats* stats) {
+    // Copy of the latest snapshot, returns the number of snapshots published so far
+    while (true) {
+        long long nbPublished = atomic_load_explicit(&feed->nbPublished, memory_order_acquire);
+        int latest = atomic_load_explicit(&feed->latest, memory_order_acquire);
+        statsBuffer* buffer = &feed->buffers[latest];
+
+        unsigned int sequence = atomic_load_explicit(&buffer->sequence, memory_order_acquire);
+        if (sequence % 2 == 1) {
+            continue;
+        }
+        memcpy(stats, &buffer->stats, sizeof(searchStats));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&buffer->sequence, memory_order_relaxed) == sequence) {
+            return nbPublished;
+        }
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Exporting snapshots to a JSONL file or to a Unix socket
+
+static int appendMove(char* buffer, size_t size, size_t length, boardMove move) {
+    return snprintf(buffer + length, size - length, "\"%i,%i-%i,%i\"", move.start.x, move.start.y, move.end.x, move.end.y);
+}
+
+int formatSearchStats(char* buffer, size_t size, searchStats* stats) {
+    // One JSON object on a single line, ended by a line feed
+    size_t length = snprintf(buffer, size,
+        "{\"iterations\":%lld,\"elapsed\":%.3f,\"nps\":%.0f,\"player\":%i,\"visits\":%i,\"p1WinRatio\":%.4f,\"sons\":[",
+        stats->iterations, stats->elapsed, stats->iterationsPerSecond, stats->playerToPlay, stats->nbVisits, stats->p1WinRatio);
+
+    for (int i = 0; i < stats->nbSons && length < size; i++) {
+        length += snprintf(buffer + length, size - length, "%s{\"move\":", (i > 0) ? "," : "");
+        if (length < size) {
+            length += appendMove(buffer, size, length, stats->sonMoves[i]);
+        }
+        if (length < size) {
+            length += snprintf(buffer + length, size - length, ",\"visits\":%i}", stats->sonVisits[i]);
+        }
+    }
+    if (length < size) {
+        length += snprintf(buffer + length, size - length, "],\"pv\":[");
+    }
+    for (int i = 0; i < stats->pvLength && length < size; i++) {
+        if (i > 0) {
+            length += snprintf(buffer + length, size - length, ",");
+        }
+        if (length < size) {
+            length += appendMove(buffer, size, length, stats->pv[i]);
+        }
+    }
+    if (length < size) {
+        length += snprintf(buffer + length, size - length, "]}\n");
+    }
+
+    // A truncated line is not sent
+    return (length < size) ? (int) length : -1;
+}
+
+static void acceptClients(statsFeed* feed) {
+    int client;
+    while (feed->nbClients < MAX_FEED_CLIENTS && (client = accept(feed->listeningSocket, NULL, NULL)) >= 0) {
+        fcntl(client, F_SETFL, fcntl(client, F_GETFL) | O_NONBLOCK);
+        feed->clients[feed->nbClients++] = client;
+    }
+}
+
+static void sendToClients(statsFeed* feed, const char* line, int length) {
+    // A dashboard too slow to take a whole line misses it, one that left is forgotten
+    for (int i = 0; i < feed->nbClients; i++) {
+        // Half a line would break the stream of the client, it is dropped as well
+        ssize_t sent = send(feed->clients[i], line, length, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if ((sent >= 0 && sent < length) || (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            close(feed->clients[i]);
+            feed->clients[i--] = feed->clients[--feed->nbClients];
+        }
+    }
+}
+
+static void* exporterLoop(void* arg) {
+    statsFeed* feed = (statsFeed*) arg;
+    searchStats* stats = malloc(sizeof(searchStats));
+    size_t lineSize = MAX_FEED_SONS * 48 + MAX_FEED_PV * 24 + 256;
+    char* line = malloc(lineSize);
+    long long lastExported = 0;
+
+    struct timespec period;
+    period.tv_sec = (time_t) feed->period;
+    period.tv_nsec = (long) ((feed->period - period.tv_sec) * 1e9);
+
+    // The last snapshot is still exported once the feed is closed
+    bool isClosing = false;
+    while (!isClosing) {
+        nanosleep(&period, NULL);
+        isClosing = atomic_load(&feed->stopRequested);
+        if (feed->file == NULL) {
+            acceptClients(feed);
+        }
+        if (atomic_load_explicit(&feed->nbPublished, memory_order_acquire) == lastExported) {
+            continue;
+        }
+
+        lastExported = readSearchStats(feed, stats);
+        int length = formatSearchStats(line, lineSize, stats);
+        if (length < 0) {
+            continue;
+        }
+        if (feed->file != NULL) {
+            fwrite(line, 1, length, feed->file);
+            fflush(feed->file);
+        } else {
+            sendToClients(feed, line, length);
+        }
+    }
+
+    free(line);
+    free(stats);
+    return NULL;
+}
+
+statsFeed* openStatsFeed(const char* target, double rate) {
+    // target is unix:<path> to listen on a socket, or the path of a JSONL file
+    // Snapshots are published and exported rate times per second at most
+    if (rate <= 0) {
+        return NULL;
+    }
+
+    statsFeed* feed = calloc(1, sizeof(statsFeed));
+    atomic_init(&feed->buffers[0].sequence, 0);
+    atomic_init(&feed->buffers[1].sequence, 0);
+    atomic_init(&feed->latest, 0);
+    atomic_init(&feed->nbPublished, 0);
+    atomic_init(&feed->stopRequested, false);
+    feed->period = 1.0 / rate;
+    feed->listeningSocket = -1;
+
+    if (strncmp(target, "unix:", 5) == 0) {
+        struct sockaddr_un address = {.sun_family = AF_UNIX};
+        if (strlen(target + 5) >= sizeof(address.sun_path)) {
+            free(feed);
+            return NULL;
+        }
+        strcpy(address.sun_path, target + 5);
+        strcpy(feed->socketPath, target + 5);
+
+        feed->listeningSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+        unlink(feed->socketPath);
+        if (feed->listeningSocket < 0
+            || bind(feed->listeningSocket, (struct sockaddr*) &address, sizeof(address)) < 0
+            || listen(feed->listeningSocket, MAX_FEED_CLIENTS) < 0) {
+            if (feed->listeningSocket >= 0) {
+                close(feed->listeningSocket);
+            }
+            free(feed);
+            return NULL;
+        }
+        fcntl(feed->listeningSocket, F_SETFL, fcntl(feed->listeningSocket, F_GETFL) | O_NONBLOCK);
+    } else {
+        feed->file = fopen(target, "a");
+        if (feed->file == NULL) {
+            free(feed);
+            return NULL;
+        }
+    }
+
+    pthread_create(&feed->exporter, NULL, exporterLoop, feed);
+    return feed;
+}
+
+void closeStatsFeed(statsFeed* feed) {
+    // The search must be over, nothing publishes in the feed anymore
+    if (feed == NULL) {
+        return;
+    }
+
+    atomic_store(&feed->stopRequested, true);
+    pthread_join(feed->exporter, NULL);
+
+    if (feed->file != NULL) {
+        fclose(feed->file);
+    } else {
+        for (int i = 0; i < feed->nbClients; i++) {
+            close(feed->clients[i]);
+        }
+        close(feed->listeningSocket);
+        unlink(feed->socketPath);
+    }
+    free(feed);
+}
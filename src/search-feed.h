@@ -0,0 +1,86 @@
+#ifndef SEARCH_FEED_H
+#define SEARCH_FEED_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "board.h"
+#include "monte-carlo.h"
+
+////////////////////////////////////////////////////////////////////////////
+// Live statistics of a running search, for external dashboards
+
+// Root sons and principal variation moves kept in a snapshot
+#define MAX_FEED_SONS 256
+#define MAX_FEED_PV 16
+
+// Dashboards connected at the same time to the socket of a feed
+#define MAX_FEED_CLIENTS 8
+
+typedef struct _searchStats {
+    long long iterations;
+    double elapsed; // In seconds since the start of the search
+    double iterationsPerSecond;
+
+    int playerToPlay;
+    int nbVisits;
+    float p1WinRatio; // Same estimation as the bar of the game
+
+    int nbSons;
+    boardMove sonMoves[MAX_FEED_SONS];
+    int sonVisits[MAX_FEED_SONS];
+
+    int pvLength;
+    boardMove pv[MAX_FEED_PV];
+} searchStats;
+
+typedef struct _statsBuffer {
+    // Odd sequence numbers mark a buffer being written
+    atomic_uint sequence;
+    searchStats stats;
+} statsBuffer;
+
+typedef struct _statsFeed {
+    // Double buffer : the search thread writes the buffer readers are not told about,
+    // then publishes it, it never waits for the readers
+    statsBuffer buffers[2];
+    atomic_int latest;
+    atomic_llong nbPublished;
+
+    // Exporter thread, writing every new snapshot as a JSON line
+    double period; // In seconds
+    pthread_t exporter;
+    atomic_bool stopRequested;
+
+    FILE* file; // JSONL file, or NULL with a socket
+    char socketPath[108];
+    int listeningSocket;
+    int clients[MAX_FEED_CLIENTS];
+    int nbClients;
+} statsFeed;
+
+////////////////////////////////////////////////////////////////////////////
+// Publishing snapshots, from the search thread only
+
+searchStats* beginStatsUpdate(statsFeed* feed);
+void endStatsUpdate(statsFeed* feed);
+void fillSearchStats(searchStats* stats, mcts* tree, boardState* board, long long iterations, double elapsed);
+void publishSearchStats(statsFeed* feed, mcts* tree, boardState* board, long long iterations, double elapsed);
+
+////////////////////////////////////////////////////////////////////////////
+// Reading snapshots, from any thread
+
+long long readSearchStats(statsFeed* feed, searchStats* stats);
+
+////////////////////////////////////////////////////////////////////////////
+// Exporting snapshots to a JSONL file or to a Unix socket
+
+int formatSearchStats(char* buffer, size_t size, searchStats* stats);
+statsFeed* openStatsFeed(const char* target, double rate);
+void closeStatsFeed(statsFeed* feed);
+
+
+#endif
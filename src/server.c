@@ -0,0 +1,609 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "board.h"
+#include "monte-carlo.h"
+#include "protocol.h"
+
+
+// Server hosting many games at once, each session with its own position,
+// tree and time budget, on stdin/stdout like penguins-engine
+// Usage : ./penguins-server [nbWorkers]
+//
+// Commands, every game command naming its session :
+//   penguins                   -> id name ..., then penguinsok
+//   isready                    -> readyok
+//   setoption <session> <name> <value>
+//                              search parameters of the session, the ones of
+//                              the engine : exploration, sims, widening, prior,
+//                              rave, playouts, evaluation and batch
+//   newgame <session> [seed]   standard map with fishes drawn from the seed, or
+//                              from the own stream of the session without one
+//   map <session> <file> [seed]
+//   position <session> <player> <p1Score> <p2Score> <sizeX> <sizeY> <tiles...>
+//   moves <session> <move> ... moves written x,y-x,y, or pass without any other move
+//   go <session> [iterations <n>] [movetime <ms>]
+//                              -> info <session> ..., then bestmove <session> <move>
+//   stop <session>             stops the search, which answers bestmove
+//   close <session>            forgets the session
+//   stats                      -> session <session> ... lines, then total ...
+//   quit
+//
+// Searches are cut in slices of a few milliseconds, run by a fixed pool of
+// workers. Every worker owns a deque of searching sessions sorted by deadline :
+// it runs the most urgent one from the bottom and puts it back after its slice,
+// and idle workers steal the least urgent one from the top of the others.
+
+// Maximum number of sessions alive at the same time
+#define MAX_SESSIONS 1024
+
+#define MAX_WORKERS 64
+
+// Duration of the search slice of a session, before the worker moves on
+const double SLICE_TIME = 0.002;
+
+
+typedef struct _session {
+    char name[32];
+    boardState* board;
+    mcts* tree;
+
+    // The board and the tree belong to a worker while the session is searching
+    pthread_mutex_t mutex;
+    pthread_cond_t searchOver;
+    bool isSearching;
+    atomic_bool stopRequested;
+
+    searchLimits limits;
+    searchSettings settings; // Taken by the worker running a slice of the session
+    unsigned int layoutSeed; // Next fishes of the session, see drawLayout
+    double deadline; // INFINITY without a time limit
+    long long searchIterations;
+
+    atomic_llong nbSearches;
+    atomic_llong nbIterations;
+    atomic_llong searchMicroseconds;
+} session;
+
+typedef struct _taskDeque {
+    // Searching sessions waiting for their next slice, from the latest deadline
+    // at the top (index 0) to the closest one at the bottom
+    pthread_mutex_t mutex;
+    session* tasks[MAX_SESSIONS];
+    int nbTasks;
+} taskDeque;
+
+typedef struct _workerPool {
+    int nbWorkers;
+    pthread_t threads[MAX_WORKERS];
+    taskDeque deques[MAX_WORKERS];
+    int nextDeque;
+
+    // Idle workers sleep until a task is queued
+    pthread_mutex_t mutex;
+    pthread_cond_t taskQueued;
+    atomic_int nbQueued;
+    bool isShuttingDown;
+
+    double startTime;
+    atomic_llong nbIterations;
+    atomic_llong nbSlices;
+    atomic_llong nbSteals;
+} workerPool;
+
+typedef struct _workerState {
+    workerPool* pool;
+    int index;
+} workerState;
+
+
+////////////////////////////////////////////////////////////////////////////
+// Task deques
+
+void pushTask(workerPool* pool, int dequeIndex, session* task) {
+    // Above the sessions with a closer or the same deadline, so that sessions
+    // with the same deadline take turns
+    taskDeque* deque = &pool->deques[dequeIndex];
+    pthread_mutex_lock(&deque->mutex);
+    int position = 0;
+    while (position < deque->nbTasks && deque->tasks[position]->deadline > task->deadline) {
+        position++;
+    }
+    memmove(&deque->tasks[position + 1], &deque->tasks[position], (deque->nbTasks - position) * sizeof(session*));
+    deque->tasks[position] = task;
+    deque->nbTasks++;
+    pthread_mutex_unlock(&deque->mutex);
+
+    pthread_mutex_lock(&pool->mutex);
+    atomic_fetch_add(&pool->nbQueued, 1);
+    pthread_cond_signal(&pool->taskQueued);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+session* popTask(workerPool* pool, int dequeIndex) {
+    // The owner takes the most urgent session, at the bottom
+    taskDeque* deque = &pool->deques[dequeIndex];
+    session* task = NULL;
+
+    pthread_mutex_lock(&deque->mutex);
+    if (deque->nbTasks > 0) {
+        task = deque->tasks[--deque->nbTasks];
+        atomic_fetch_sub(&pool->nbQueued, 1);
+    }
+    pthread_mutex_unlock(&deque->mutex);
+
+    return task;
+}
+
+session* stealTask(workerPool* pool, int thiefIndex) {
+    // An idle worker takes the least urgent session of another worker, at the
+    // top, the one its owner would run last ; victims are tried from the
+    // neighbour of the thief so that thieves spread over the deques
+    for (int k = 1; k < pool->nbWorkers; k++) {
+        taskDeque* deque = &pool->deques[(thiefIndex + k) % pool->nbWorkers];
+        session* task = NULL;
+
+        pthread_mutex_lock(&deque->mutex);
+        if (deque->nbTasks > 0) {
+            task = deque->tasks[0];
+            memmove(&deque->tasks[0], &deque->tasks[1], (--deque->nbTasks) * sizeof(session*));
+            atomic_fetch_sub(&pool->nbQueued, 1);
+        }
+        pthread_mutex_unlock(&deque->mutex);
+
+        if (task != NULL) {
+            atomic_fetch_add(&pool->nbSteals, 1);
+            return task;
+        }
+    }
+    return NULL;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Workers
+
+int stepSize(long long iterations, long long budget) {
+    // Descents made between two checks of the limits, a whole batch of
+    // descents when leaves are evaluated together, -1 budget meaning no
+    // limit
+    long long nbSteps = (LEAF_EVALUATION > 0) ? EVALUATION_BATCH : 1;
+    if (budget >= 0 && budget - iterations < nbSteps) {
+        nbSteps = budget - iterations;
+    }
+    return (int) nbSteps;
+}
+
+bool searchSlice(workerPool* pool, session* task) {
+    // Tree descents of a session for one slice, returns true once its search is over
+    double startTime = now();
+    double sliceEnd = startTime + SLICE_TIME;
+    long long budget = (task->limits.iterations > 0) ? task->limits.iterations : -1;
+    long long iterations = 0;
+    bool isOver = false;
+
+    if (task->tree == NULL) {
+        // Built here rather than by the reading thread, so that the root is
+        // expanded with the search settings of the session
+        task->tree = newMCTS(task->board);
+    }
+
+    while (!isOver) {
+        int nbSteps = stepSize(task->searchIterations, budget);
+        mctsSteps(task->tree, task->board, nbSteps);
+        task->searchIterations += nbSteps;
+        iterations += nbSteps;
+
+        double time = now();
+        isOver = atomic_load(&task->stopRequested) || time >= task->deadline
+            || (budget > 0 && task->searchIterations >= budget);
+        if (time >= sliceEnd) {
+            break;
+        }
+    }
+
+    atomic_fetch_add(&task->nbIterations, iterations);
+    atomic_fetch_add(&task->searchMicroseconds, (long long) ((now() - startTime) * 1e6));
+    atomic_fetch_add(&pool->nbIterations, iterations);
+    atomic_fetch_add(&pool->nbSlices, 1);
+    return isOver;
+}
+
+void finishSearch(session* task) {
+    // The best move is sent, then the session is given back to the reading thread
+    mcts* tree = task->tree;
+    float p1WinRatio = (tree->nbVisits > 0) ? (float) tree->nbP1Wins / (float) tree->nbVisits : 0.5f;
+    float winRate = (task->board->playerToPlay == 4) ? p1WinRatio : 1.0f - p1WinRatio;
+    reply("info %s iterations %lld visits %i nodes %i winrate %.4f",
+        task->name, task->searchIterations, tree->nbVisits, treeSize(tree), winRate);
+
+    if (tree->nbSons > 0) {
+        char move[32];
+        formatMove(move, sizeof(move), bestMove(tree));
+        reply("bestmove %s %s", task->name, move);
+    } else {
+        reply("bestmove %s pass", task->name);
+    }
+
+    pthread_mutex_lock(&task->mutex);
+    task->isSearching = false;
+    pthread_cond_broadcast(&task->searchOver);
+    pthread_mutex_unlock(&task->mutex);
+}
+
+void* workerLoop(void* arg) {
+    workerState* worker = (workerState*) arg;
+    workerPool* pool = worker->pool;
+    // Slices of a session go to any worker, searches cannot be reproduced anyway
+    seedSearchRandom((uint64_t) (pool->startTime * 1e9), worker->index);
+
+    while (true) {
+        session* task = popTask(pool, worker->index);
+        if (task == NULL) {
+            task = stealTask(pool, worker->index);
+        }
+
+        if (task == NULL) {
+            pthread_mutex_lock(&pool->mutex);
+            while (atomic_load(&pool->nbQueued) == 0 && !pool->isShuttingDown) {
+                pthread_cond_wait(&pool->taskQueued, &pool->mutex);
+            }
+            bool isShuttingDown = pool->isShuttingDown;
+            pthread_mutex_unlock(&pool->mutex);
+            if (isShuttingDown) {
+                break;
+            }
+            continue;
+        }
+
+        useSearchSettings(&task->settings);
+        if (searchSlice(pool, task)) {
+            finishSearch(task);
+        } else {
+            pushTask(pool, worker->index, task);
+        }
+    }
+
+    free(worker);
+    return NULL;
+}
+
+void startPool(workerPool* pool, int nbWorkers) {
+    pool->nbWorkers = nbWorkers;
+    pool->nextDeque = 0;
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->taskQueued, NULL);
+    atomic_init(&pool->nbQueued, 0);
+    atomic_init(&pool->nbIterations, 0);
+    atomic_init(&pool->nbSlices, 0);
+    atomic_init(&pool->nbSteals, 0);
+    pool->isShuttingDown = false;
+    pool->startTime = now();
+
+    for (int i = 0; i < nbWorkers; i++) {
+        pthread_mutex_init(&pool->deques[i].mutex, NULL);
+        pool->deques[i].nbTasks = 0;
+    }
+    for (int i = 0; i < nbWorkers; i++) {
+        workerState* worker = malloc(sizeof(workerState));
+        *worker = (workerState) {.pool = pool, .index = i};
+        pthread_create(&pool->threads[i], NULL, workerLoop, worker);
+    }
+}
+
+void stopPool(workerPool* pool) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->isShuttingDown = true;
+    pthread_cond_broadcast(&pool->taskQueued);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (int i = 0; i < pool->nbWorkers; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Sessions
+
+session* sessions[MAX_SESSIONS];
+int nbSessions = 0;
+int nbOpenedSessions = 0;
+
+session* findSession(const char* name) {
+    for (int i = 0; i < nbSessions; i++) {
+        if (strcmp(sessions[i]->name, name) == 0) {
+            return sessions[i];
+        }
+    }
+    return NULL;
+}
+
+boardState* drawLayout(session* task, const char* path) {
+    // The standard map, or the map file at path, with fishes drawn from the
+    // stream of the session : the rand of the process is seeded for this
+    // board only, and what the other sessions drew changes nothing
+    srand(task->layoutSeed);
+    boardState* board = (path != NULL) ? loadMap(path) : freshBoard();
+    if (path == NULL) {
+        initializeBoard(board);
+    }
+    task->layoutSeed = (unsigned int) rand();
+    return board;
+}
+
+session* openSession(const char* name) {
+    // Existing session with this name, or a new one on a standard board
+    session* task = findSession(name);
+    if (task != NULL || nbSessions == MAX_SESSIONS || strlen(name) >= sizeof(task->name)) {
+        return task;
+    }
+
+    task = calloc(1, sizeof(session));
+    strcpy(task->name, name);
+    pthread_mutex_init(&task->mutex, NULL);
+    pthread_cond_init(&task->searchOver, NULL);
+    atomic_init(&task->stopRequested, false);
+    atomic_init(&task->nbSearches, 0);
+    atomic_init(&task->nbIterations, 0);
+    atomic_init(&task->searchMicroseconds, 0);
+    task->settings = currentSearchSettings();
+    task->layoutSeed = (unsigned int) time(NULL) + (unsigned int) nbOpenedSessions++ * 2654435761u;
+    task->board = drawLayout(task, NULL);
+
+    sessions[nbSessions++] = task;
+    return task;
+}
+
+void waitSearch(session* task) {
+    // Stops the search of a session and waits until a worker gives it back
+    pthread_mutex_lock(&task->mutex);
+    if (task->isSearching) {
+        atomic_store(&task->stopRequested, true);
+        while (task->isSearching) {
+            pthread_cond_wait(&task->searchOver, &task->mutex);
+        }
+    }
+    pthread_mutex_unlock(&task->mutex);
+}
+
+void startSearch(workerPool* pool, session* task, searchLimits limits) {
+    waitSearch(task);
+    task->limits = limits;
+    task->deadline = (limits.moveTime > 0) ? now() + limits.moveTime : INFINITY;
+    task->searchIterations = 0;
+    atomic_store(&task->stopRequested, false);
+    atomic_fetch_add(&task->nbSearches, 1);
+    task->isSearching = true;
+
+    // New searches are spread over the deques, stealing balances them afterwards
+    pushTask(pool, pool->nextDeque, task);
+    pool->nextDeque = (pool->nextDeque + 1) % pool->nbWorkers;
+}
+
+void setBoard(session* task, boardState* board) {
+    // The previous tree is useless on a new position
+    if (task->tree != NULL) {
+        freeMCTS(task->tree);
+        task->tree = NULL;
+    }
+    if (task->board != NULL) {
+        freeBoardState(task->board);
+    }
+    task->board = board;
+}
+
+void closeSession(session* task) {
+    waitSearch(task);
+    setBoard(task, NULL);
+    pthread_mutex_destroy(&task->mutex);
+    pthread_cond_destroy(&task->searchOver);
+
+    for (int i = 0; i < nbSessions; i++) {
+        if (sessions[i] == task) {
+            sessions[i] = sessions[--nbSessions];
+            break;
+        }
+    }
+    free(task);
+}
+
+void printStats(workerPool* pool) {
+    // Throughput of every session while it searched, and of the whole server
+    for (int i = 0; i < nbSessions; i++) {
+        session* task = sessions[i];
+        long long iterations = atomic_load(&task->nbIterations);
+        double searchTime = atomic_load(&task->searchMicroseconds) * 1e-6;
+        pthread_mutex_lock(&task->mutex);
+        bool isSearching = task->isSearching;
+        pthread_mutex_unlock(&task->mutex);
+        reply("session %s searches %lld iterations %lld time %.3f nps %.0f%s",
+            task->name, atomic_load(&task->nbSearches), iterations, searchTime,
+            (searchTime > 0) ? iterations / searchTime : 0.0, isSearching ? " searching" : "");
+    }
+
+    double elapsed = now() - pool->startTime;
+    long long iterations = atomic_load(&pool->nbIterations);
+    reply("total sessions %i workers %i iterations %lld slices %lld steals %lld uptime %.3f nps %.0f",
+        nbSessions, pool->nbWorkers, iterations, atomic_load(&pool->nbSlices), atomic_load(&pool->nbSteals),
+        elapsed, (elapsed > 0) ? iterations / elapsed : 0.0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Position updates
+
+void applyMove(session* task, const char* token) {
+    // Plays a move, keeping the subtree of the move when there is one
+
+    boardMove move;
+    bool isPass;
+    if (!parsePlayedMove(task->board, token, &move, &isPass)) {
+        reply("info %s string illegal move %s", task->name, token);
+        return;
+    }
+
+    if (isPass) {
+        if (task->tree != NULL) {
+            freeMCTS(task->tree);
+            task->tree = NULL;
+        }
+        task->board->playerToPlay = (task->board->playerToPlay == 4) ? 5 : 4;
+        return;
+    }
+
+    if (task->tree != NULL) {
+        if (task->tree->nbVisits > 0) {
+            task->tree = makeMove(task->tree, move);
+        } else {
+            freeMCTS(task->tree);
+            task->tree = NULL;
+        }
+    }
+    movePenguin(task->board, move);
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Main loop reading commands
+
+int main(int argc, char** argv) {
+
+    int nbWorkers = (argc > 1) ? atoi(argv[1]) : (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (nbWorkers < 1 || nbWorkers > MAX_WORKERS) {
+        fprintf(stderr, "Usage : %s [nbWorkers], at most %i workers\n", argv[0], MAX_WORKERS);
+        return 1;
+    }
+
+    static workerPool pool;
+    startPool(&pool, nbWorkers);
+
+    char line[8192];
+    while (fgets(line, sizeof(line), stdin) != NULL) {
+        char* savePtr = NULL;
+        char* command = strtok_r(line, " \t\n", &savePtr);
+        if (command == NULL) {
+            continue;
+        }
+
+        if (strcmp(command, "quit") == 0) {
+            break;
+        }
+        if (strcmp(command, "isready") == 0) {
+            reply("readyok");
+            continue;
+        }
+        if (strcmp(command, "penguins") == 0) {
+            reply("id name penguin-game-mcts server");
+            reply("penguinsok");
+            continue;
+        }
+        if (strcmp(command, "stats") == 0) {
+            printStats(&pool);
+            continue;
+        }
+
+        char* name = strtok_r(NULL, " \t\n", &savePtr);
+        if (name == NULL) {
+            reply("info string missing session for %s", command);
+            continue;
+        }
+
+        if (strcmp(command, "stop") == 0 || strcmp(command, "close") == 0) {
+            session* task = findSession(name);
+            if (task == NULL) {
+                reply("info %s string unknown session", name);
+            } else if (strcmp(command, "stop") == 0) {
+                atomic_store(&task->stopRequested, true);
+            } else {
+                closeSession(task);
+            }
+            continue;
+        }
+
+        session* task = openSession(name);
+        if (task == NULL) {
+            reply("info %s string cannot open session", name);
+            continue;
+        }
+
+        // Any other command is handled once the search of the session is over
+        waitSearch(task);
+
+        if (strcmp(command, "setoption") == 0) {
+            char* option = strtok_r(NULL, " \t\n", &savePtr);
+            char* value = strtok_r(NULL, " \t\n", &savePtr);
+            if (option == NULL || value == NULL || !parseSearchOption(&task->settings, option, value)) {
+                reply("info %s string invalid option %s %s", name, (option != NULL) ? option : "", (value != NULL) ? value : "");
+            } else if (strcmp(option, "sims") == 0) {
+                // Tree statistics are counted in random games, the tree is restarted
+                setBoard(task, copyBoardState(task->board));
+            }
+
+        } else if (strcmp(command, "newgame") == 0) {
+            char* seed = strtok_r(NULL, " \t\n", &savePtr);
+            if (seed != NULL) {
+                task->layoutSeed = (unsigned int) strtoul(seed, NULL, 10);
+            }
+            setBoard(task, drawLayout(task, NULL));
+
+        } else if (strcmp(command, "map") == 0) {
+            char* path = strtok_r(NULL, " \t\n", &savePtr);
+            char* seed = strtok_r(NULL, " \t\n", &savePtr);
+            if (seed != NULL) {
+                task->layoutSeed = (unsigned int) strtoul(seed, NULL, 10);
+            }
+            boardState* board = (path != NULL) ? drawLayout(task, path) : NULL;
+            if (board != NULL) {
+                setBoard(task, board);
+            } else {
+                reply("info %s string cannot load map %s", name, (path != NULL) ? path : "");
+            }
+
+        } else if (strcmp(command, "position") == 0) {
+            boardState* board = parsePosition(&savePtr);
+            if (board != NULL) {
+                setBoard(task, board);
+            } else {
+                reply("info %s string invalid position", name);
+            }
+
+        } else if (strcmp(command, "moves") == 0) {
+            char* token;
+            while ((token = strtok_r(NULL, " \t\n", &savePtr)) != NULL) {
+                applyMove(task, token);
+            }
+
+        } else if (strcmp(command, "go") == 0) {
+            searchLimits limits = {.iterations = 0, .moveTime = 0};
+            char* token;
+            while ((token = strtok_r(NULL, " \t\n", &savePtr)) != NULL) {
+                char* value = NULL;
+                if (strcmp(token, "iterations") == 0 && (value = strtok_r(NULL, " \t\n", &savePtr)) != NULL) {
+                    limits.iterations = atoll(value);
+                } else if (strcmp(token, "movetime") == 0 && (value = strtok_r(NULL, " \t\n", &savePtr)) != NULL) {
+                    limits.moveTime = atof(value) / 1000.0;
+                }
+            }
+            if (limits.iterations <= 0 && limits.moveTime <= 0) {
+                limits.moveTime = 1.0;
+            }
+            startSearch(&pool, task, limits);
+
+        } else {
+            reply("info %s string unknown command %s", name, command);
+        }
+    }
+
+    for (int i = nbSessions - 1; i >= 0; i--) {
+        closeSession(sessions[i]);
+    }
+    stopPool(&pool);
+
+    return 0;
+}
@@ -0,0 +1,196 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "timeline.h"
+
+// Timeline of what every thread is doing, to find out why a given frame or
+// search stalls : spans, counters and instants go to a ring of the thread,
+// and the rings are written on demand as a Chrome trace (chrome://tracing,
+// or ui.perfetto.dev)
+//
+// A ring has a single writer, its thread, which never waits : the number of
+// events written is published after each event, and the reader drops the
+// events that were overwritten while it copied them. A ring outlives its
+// thread, the next thread recording an event takes it over.
+
+
+typedef struct _timelineEvent {
+    const char* name;
+    int64_t start; // In nanoseconds
+    int64_t value; // Duration of a span, value of a counter
+    char phase; // 'X' span, 'C' counter, 'i' instant
+} timelineEvent;
+
+typedef struct _timelineRing {
+    timelineEvent events[TIMELINE_RING_SIZE];
+    atomic_llong nbWritten;
+    atomic_bool isOwned;
+    int threadId;
+    char threadName[32];
+    struct _timelineRing* next;
+} timelineRing;
+
+static atomic_bool timelineEnabled = false;
+static _Atomic(timelineRing*) timelineRings = NULL;
+static atomic_int nbTimelineRings = 0;
+
+static _Thread_local timelineRing* threadRing = NULL;
+static pthread_key_t ringOwnerKey;
+static pthread_once_t ringOwnerOnce = PTHREAD_ONCE_INIT;
+
+
+////////////////////////////////////////////////////////////////////////////
+// Rings of the threads
+
+static int64_t timelineNow() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (int64_t) time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+static void releaseRing(void* ring) {
+    // The thread is over, its events stay in the ring for the next dump
+    atomic_store(&((timelineRing*) ring)->isOwned, false);
+}
+
+static void createOwnerKey() {
+    pthread_key_create(&ringOwnerKey, releaseRing);
+}
+
+static timelineRing* ownRing() {
+    // Ring of the calling thread : a ring left by a finished thread, or a new one
+    if (threadRing != NULL) {
+        return threadRing;
+    }
+    pthread_once(&ringOwnerOnce, createOwnerKey);
+
+    timelineRing* ring = atomic_load(&timelineRings);
+    for (; ring != NULL; ring = ring->next) {
+        bool isOwned = false;
+        if (atomic_compare_exchange_strong(&ring->isOwned, &isOwned, true)) {
+            break;
+        }
+    }
+
+    if (ring == NULL) {
+        ring = calloc(1, sizeof(timelineRing));
+        atomic_init(&ring->nbWritten, 0);
+        atomic_init(&ring->isOwned, true);
+        ring->threadId = atomic_fetch_add(&nbTimelineRings, 1) + 1;
+        snprintf(ring->threadName, sizeof(ring->threadName), "thread %i", ring->threadId);
+
+        ring->next = atomic_load(&timelineRings);
+        while (!atomic_compare_exchange_weak(&timelineRings, &ring->next, ring)) {}
+    }
+
+    pthread_setspecific(ringOwnerKey, ring);
+    threadRing = ring;
+    return ring;
+}
+
+static void record(const char* name, int64_t start, int64_t value, char phase) {
+    timelineRing* ring = ownRing();
+    long long index = atomic_load_explicit(&ring->nbWritten, memory_order_relaxed);
+    ring->events[index % TIMELINE_RING_SIZE] = (timelineEvent) {.name = name, .start = start, .value = value, .phase = phase};
+    atomic_store_explicit(&ring->nbWritten, index + 1, memory_order_release);
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Recording spans, counters and instants, from any thread
+
+void setTimelineEnabled(bool isEnabled) {
+    atomic_store(&timelineEnabled, isEnabled);
+}
+
+bool isTimelineEnabled() {
+    return atomic_load_explicit(&timelineEnabled, memory_order_relaxed);
+}
+
+void nameTimelineThread(const char* name) {
+    // Name of the calling thread in the trace, the ring keeps a copy
+    timelineRing* ring = ownRing();
+    snprintf(ring->threadName, sizeof(ring->threadName), "%s", name);
+}
+
+int64_t timelineBegin() {
+    // Start of a span, 0 when the timeline is off
+    return isTimelineEnabled() ? timelineNow() : 0;
+}
+
+void timelineEnd(const char* name, int64_t start) {
+    if (start != 0) {
+        record(name, start, timelineNow() - start, 'X');
+    }
+}
+
+void timelineCounter(const char* name, int64_t value) {
+    if (isTimelineEnabled()) {
+        record(name, timelineNow(), value, 'C');
+    }
+}
+
+void timelineInstant(const char* name) {
+    if (isTimelineEnabled()) {
+        record(name, timelineNow(), 0, 'i');
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Writing the timeline in the Chrome trace format
+
+static void writeEvent(FILE* file, timelineEvent* event, int threadId, bool* isFirst) {
+    // Timestamps and durations in microseconds
+    fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"pid\":1,\"tid\":%i,\"ts\":%.3f",
+        *isFirst ? "" : ",", event->name, event->phase, threadId, event->start * 1e-3);
+    if (event->phase == 'X') {
+        fprintf(file, ",\"dur\":%.3f}", event->value * 1e-3);
+    } else if (event->phase == 'C') {
+        fprintf(file, ",\"args\":{\"value\":%lld}}", (long long) event->value);
+    } else {
+        fprintf(file, ",\"s\":\"g\"}");
+    }
+    *isFirst = false;
+}
+
+bool dumpTimeline(const char* path) {
+    // The events of every ring, while the threads keep recording
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        return false;
+    }
+
+    timelineEvent* events = malloc(TIMELINE_RING_SIZE * sizeof(timelineEvent));
+    bool isFirst = true;
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+    for (timelineRing* ring = atomic_load(&timelineRings); ring != NULL; ring = ring->next) {
+        long long last = atomic_load_explicit(&ring->nbWritten, memory_order_acquire);
+        long long first = (last > TIMELINE_RING_SIZE) ? last - TIMELINE_RING_SIZE : 0;
+        for (long long i = first; i < last; i++) {
+            events[i - first] = ring->events[i % TIMELINE_RING_SIZE];
+        }
+
+        // Events written over during the copy are dropped, along with the one
+        // the thread may be writing right now
+        atomic_thread_fence(memory_order_acquire);
+        long long nbWritten = atomic_load_explicit(&ring->nbWritten, memory_order_relaxed);
+        long long firstIntact = (nbWritten + 1 > TIMELINE_RING_SIZE) ? nbWritten + 1 - TIMELINE_RING_SIZE : 0;
+
+        fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%i,\"args\":{\"name\":\"%s\"}}",
+            isFirst ? "" : ",", ring->threadId, ring->threadName);
+        isFirst = false;
+
+        for (long long i = (first > firstIntact) ? first : firstIntact; i < last; i++) {
+            writeEvent(file, &events[i - first], ring->threadId, &isFirst);
+        }
+    }
+
+    fprintf(file, "\n]}\n");
+    free(events);
+    return fclose(file) == 0;
+}
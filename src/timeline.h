@@ -0,0 +1,32 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+////////////////////////////////////////////////////////////////////////////
+// Timeline parameters
+
+// Last events kept by every thread, older ones are overwritten
+#define TIMELINE_RING_SIZE 16384
+
+////////////////////////////////////////////////////////////////////////////
+// Recording spans, counters and instants, from any thread
+
+// Names are never copied, they must live as long as the program
+void setTimelineEnabled(bool isEnabled);
+bool isTimelineEnabled(void);
+void nameTimelineThread(const char* name);
+int64_t timelineBegin(void);
+void timelineEnd(const char* name, int64_t start);
+void timelineCounter(const char* name, int64_t value);
+void timelineInstant(const char* name);
+
+////////////////////////////////////////////////////////////////////////////
+// Writing the timeline in the Chrome trace format
+
+bool dumpTimeline(const char* path);
+
+
+#endif
@@ -0,0 +1,549 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "board.h"
+#include "protocol.h"
+
+
+// Local tournament between engine configurations, played by penguins-engine subprocesses
+// Usage : ./tournament [-g games] [-j concurrency] [-e engine] [-s seed]
+//                      [-0 elo0] [-1 elo1] [-a alpha] [-b beta] baseline candidate...
+//
+// A configuration is written name:option=value,option=value with the options
+// exploration, widening, prior, rave, heavy (0 or 1), evaluation (0 playouts, 1 static,
+// 2 mixed), sims, threads, iterations and movetime (in milliseconds), e.g.
+//   ./tournament base:iterations=2000 wide:iterations=2000,exploration=2.5
+//
+// Every candidate plays the baseline, in pairs of games on the same fish layout
+// with colours swapped. Results are given as Elo estimates and as a sequential
+// probability ratio test of elo0 against elo1, along with the CPU time of each side.
+
+extern char** environ;
+
+#define MAX_CONFIGS 16
+
+typedef struct _engineConfig {
+    char name[64];
+    float exploration;
+    float widening;
+    float prior;
+    float rave;
+    int heavyPlayouts;
+    int evaluation;
+    int sims;
+    int threads;
+    long long iterations;
+    int moveTime;
+} engineConfig;
+
+typedef struct _engineProcess {
+    pid_t pid;
+    FILE* in;
+    FILE* out;
+} engineProcess;
+
+typedef struct _gameResult {
+    int p1Score;
+    int p2Score;
+    int forfeit; // 0, or the player who played an illegal move
+    double cpuTime[2]; // Of the engine playing P1, then P2
+    int nbMoves[2];
+} gameResult;
+
+typedef struct _matchStats {
+    // From the point of view of the candidate
+    int wins;
+    int draws;
+    int losses;
+    double cpuTime[2]; // Baseline, then candidate
+    int nbMoves[2];
+    bool isDecided;
+} matchStats;
+
+typedef struct _tournament {
+    const char* enginePath;
+    engineConfig configs[MAX_CONFIGS];
+    int nbConfigs;
+
+    int nbGames;
+    unsigned int seed;
+    double elo0, elo1, alpha, beta;
+
+    atomic_int nextGame;
+    int nbFinishedGames;
+    matchStats stats[MAX_CONFIGS];
+    pthread_mutex_t mutex;
+} tournament;
+
+pthread_mutex_t layoutMutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+////////////////////////////////////////////////////////////////////////////
+// Configurations
+
+bool parseConfig(const char* text, engineConfig* config) {
+    *config = (engineConfig) {.exploration = 1.41f, .prior = 2.0f, .sims = 4, .threads = 1, .iterations = 0, .moveTime = 0};
+
+    const char* options = strchr(text, ':');
+    size_t nameLength = (options != NULL) ? (size_t) (options - text) : strlen(text);
+    if (nameLength == 0 || nameLength >= sizeof(config->name)) {
+        return false;
+    }
+    memcpy(config->name, text, nameLength);
+    config->name[nameLength] = '\0';
+
+    while (options != NULL) {
+        options++;
+        char key[32];
+        double value;
+        if (sscanf(options, "%31[^=]=%lf", key, &value) != 2) {
+            return false;
+        }
+        if (strcmp(key, "exploration") == 0) {
+            config->exploration = value;
+        } else if (strcmp(key, "widening") == 0) {
+            config->widening = value;
+        } else if (strcmp(key, "prior") == 0) {
+            config->prior = value;
+        } else if (strcmp(key, "rave") == 0) {
+            config->rave = value;
+        } else if (strcmp(key, "evaluation") == 0) {
+            config->evaluation = (int) value;
+        } else if (strcmp(key, "heavy") == 0) {
+            config->heavyPlayouts = (int) value;
+        } else if (strcmp(key, "sims") == 0) {
+            config->sims = (int) value;
+        } else if (strcmp(key, "threads") == 0) {
+            config->threads = (int) value;
+        } else if (strcmp(key, "iterations") == 0) {
+            config->iterations = (long long) value;
+        } else if (strcmp(key, "movetime") == 0) {
+            config->moveTime = (int) value;
+        } else {
+            return false;
+        }
+        options = strchr(options, ',');
+    }
+
+    if (config->iterations <= 0 && config->moveTime <= 0) {
+        config->iterations = 1000;
+    }
+    return config->sims > 0 && config->threads > 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Engine subprocesses
+
+bool startEngine(const char* path, engineProcess* engine) {
+    // The engine reads our commands on its stdin and answers on its stdout
+    int toEngine[2], fromEngine[2];
+    if (pipe2(toEngine, O_CLOEXEC) < 0) {
+        return false;
+    }
+    if (pipe2(fromEngine, O_CLOEXEC) < 0) {
+        close(toEngine[0]);
+        close(toEngine[1]);
+        return false;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, toEngine[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, fromEngine[1], STDOUT_FILENO);
+
+    char* argv[] = {(char*) path, NULL};
+    int error = posix_spawn(&engine->pid, path, &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(toEngine[0]);
+    close(fromEngine[1]);
+
+    if (error != 0) {
+        close(toEngine[1]);
+        close(fromEngine[0]);
+        return false;
+    }
+
+    engine->in = fdopen(toEngine[1], "w");
+    engine->out = fdopen(fromEngine[0], "r");
+    return true;
+}
+
+double stopEngine(engineProcess* engine) {
+    // Returns the CPU time used by the engine during its whole life
+    fprintf(engine->in, "quit\n");
+    fclose(engine->in);
+    fclose(engine->out);
+
+    int status;
+    struct rusage usage;
+    while (wait4(engine->pid, &status, 0, &usage) < 0 && errno == EINTR) {}
+
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6
+        + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+}
+
+void sendCommand(engineProcess* engine, const char* command) {
+    fprintf(engine->in, "%s\n", command);
+    fflush(engine->in);
+}
+
+bool waitBestMove(engineProcess* engine, char* move, size_t size) {
+    // Skips info lines until the engine gives its move
+    char line[1024];
+    while (fgets(line, sizeof(line), engine->out) != NULL) {
+        if (strncmp(line, "bestmove ", 9) == 0) {
+            snprintf(move, size, "%s", line + 9);
+            move[strcspn(move, " \r\n")] = '\0';
+            return true;
+        }
+    }
+    return false;
+}
+
+void configureEngine(engineProcess* engine, engineConfig* config) {
+    char command[128];
+    snprintf(command, sizeof(command), "setoption exploration %f", config->exploration);
+    sendCommand(engine, command);
+    snprintf(command, sizeof(command), "setoption widening %f", config->widening);
+    sendCommand(engine, command);
+    snprintf(command, sizeof(command), "setoption prior %f", config->prior);
+    sendCommand(engine, command);
+    snprintf(command, sizeof(command), "setoption rave %f", config->rave);
+    sendCommand(engine, command);
+    snprintf(command, sizeof(command), "setoption playouts %s", config->heavyPlayouts ? "heavy" : "uniform");
+    sendCommand(engine, command);
+    const char* evaluations[3] = {"playouts", "static", "mixed"};
+    snprintf(command, sizeof(command), "setoption evaluation %s", evaluations[config->evaluation % 3]);
+    sendCommand(engine, command);
+    snprintf(command, sizeof(command), "setoption sims %i", config->sims);
+    sendCommand(engine, command);
+    snprintf(command, sizeof(command), "setoption threads %i", config->threads);
+    sendCommand(engine, command);
+}
+
+void sendPosition(engineProcess* engine, boardState* board) {
+    fprintf(engine->in, "position %i %i %i %i %i", board->playerToPlay, board->p1Score, board->p2Score, board->sizeX, board->sizeY);
+    for (int i = 0; i < board->sizeX; i++) {
+        for (int j = 0; j < board->sizeY; j++) {
+            fprintf(engine->in, " %i", board->map[i][j]);
+        }
+    }
+    fprintf(engine->in, "\n");
+    fflush(engine->in);
+}
+
+void sendGo(engineProcess* engine, engineConfig* config) {
+    char command[128];
+    if (config->moveTime > 0 && config->iterations > 0) {
+        snprintf(command, sizeof(command), "go iterations %lld movetime %i", config->iterations, config->moveTime);
+    } else if (config->moveTime > 0) {
+        snprintf(command, sizeof(command), "go movetime %i", config->moveTime);
+    } else {
+        snprintf(command, sizeof(command), "go iterations %lld", config->iterations);
+    }
+    sendCommand(engine, command);
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Playing a game
+
+gameResult playGame(const char* enginePath, engineConfig* p1Config, engineConfig* p2Config, unsigned int seed) {
+    // The referee keeps its own board and forwards every move to both engines
+    gameResult result = {0};
+
+    // Fish layouts come from the global rand, shared by all games
+    pthread_mutex_lock(&layoutMutex);
+    srand(seed);
+    boardState* board = freshBoard();
+    initializeBoard(board);
+    pthread_mutex_unlock(&layoutMutex);
+
+    engineProcess engines[2];
+    engineConfig* configs[2] = {p1Config, p2Config};
+    for (int p = 0; p < 2; p++) {
+        if (!startEngine(enginePath, &engines[p])) {
+            fprintf(stderr, "Cannot start %s\n", enginePath);
+            exit(1);
+        }
+        configureEngine(&engines[p], configs[p]);
+        sendPosition(&engines[p], board);
+    }
+
+    int consecutivePasses = 0;
+    while (consecutivePasses < 2 && result.forfeit == 0) {
+        boardMoveL* allMoves = allPossibleMoves(board);
+        int player = (board->playerToPlay == 4) ? 0 : 1;
+        char command[64];
+
+        if (allMoves == NULL) {
+            consecutivePasses += 1;
+            board->playerToPlay = (board->playerToPlay == 4) ? 5 : 4;
+            snprintf(command, sizeof(command), "moves pass");
+        } else {
+            consecutivePasses = 0;
+            freeBoardMoveL(allMoves);
+
+            char moveText[32];
+            boardMove move;
+            sendGo(&engines[player], configs[player]);
+            result.nbMoves[player] += 1;
+
+            if (!waitBestMove(&engines[player], moveText, sizeof(moveText))
+                || !parseMove(moveText, &move)
+                || !isLegalMove(board, move)) {
+                result.forfeit = board->playerToPlay;
+                break;
+            }
+
+            movePenguin(board, move);
+            snprintf(command, sizeof(command), "moves %s", moveText);
+        }
+
+        sendCommand(&engines[0], command);
+        sendCommand(&engines[1], command);
+    }
+
+    result.p1Score = board->p1Score;
+    result.p2Score = board->p2Score;
+    result.cpuTime[0] = stopEngine(&engines[0]);
+    result.cpuTime[1] = stopEngine(&engines[1]);
+
+    freeBoardState(board);
+    return result;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Statistics
+
+double scoreFromElo(double elo) {
+    return 1.0 / (1.0 + pow(10.0, -elo / 400.0));
+}
+
+double eloFromScore(double score) {
+    if (score <= 0.0) {
+        return -INFINITY;
+    }
+    if (score >= 1.0) {
+        return INFINITY;
+    }
+    return -400.0 * log10(1.0 / score - 1.0);
+}
+
+void scoreAndVariance(matchStats* stats, double* score, double* variance) {
+    // Mean and variance of the result of a single game
+    int nbGames = stats->wins + stats->draws + stats->losses;
+    *score = (stats->wins + 0.5 * stats->draws) / nbGames;
+    *variance = (stats->wins * pow(1.0 - *score, 2)
+        + stats->draws * pow(0.5 - *score, 2)
+        + stats->losses * pow(*score, 2)) / nbGames;
+}
+
+double logLikelihoodRatio(matchStats* stats, double elo0, double elo1) {
+    // Generalized SPRT with a normal approximation of the game results
+    int nbGames = stats->wins + stats->draws + stats->losses;
+    if (nbGames == 0) {
+        return 0.0;
+    }
+    double score, variance;
+    scoreAndVariance(stats, &score, &variance);
+    if (variance <= 0.0) {
+        return 0.0;
+    }
+    double score0 = scoreFromElo(elo0);
+    double score1 = scoreFromElo(elo1);
+    return nbGames * (score1 - score0) * (2.0 * score - score0 - score1) / (2.0 * variance);
+}
+
+void printStandings(tournament* t) {
+    double lowerBound = log(t->beta / (1.0 - t->alpha));
+    double upperBound = log((1.0 - t->beta) / t->alpha);
+    engineConfig* baseline = &t->configs[0];
+
+    printf("\nAfter %i games\n", t->nbFinishedGames);
+    for (int c = 1; c < t->nbConfigs; c++) {
+        matchStats* stats = &t->stats[c];
+        int nbGames = stats->wins + stats->draws + stats->losses;
+        if (nbGames == 0) {
+            continue;
+        }
+
+        double score, variance;
+        scoreAndVariance(stats, &score, &variance);
+        double margin = 1.96 * sqrt(variance / nbGames);
+        double llr = logLikelihoodRatio(stats, t->elo0, t->elo1);
+
+        printf("%s vs %s : +%i =%i -%i, score %.3f, elo %+.1f [%+.1f, %+.1f]\n",
+            t->configs[c].name, baseline->name, stats->wins, stats->draws, stats->losses,
+            score, eloFromScore(score), eloFromScore(score - margin), eloFromScore(score + margin));
+        printf("  SPRT elo0 %.1f elo1 %.1f : LLR %.2f [%.2f, %.2f]%s\n",
+            t->elo0, t->elo1, llr, lowerBound, upperBound,
+            (llr >= upperBound) ? ", H1 accepted" : ((llr <= lowerBound) ? ", H0 accepted" : ""));
+
+        // Strength only matters at equal cost
+        double baselineCost = stats->cpuTime[0] / (stats->nbMoves[0] > 0 ? stats->nbMoves[0] : 1);
+        double candidateCost = stats->cpuTime[1] / (stats->nbMoves[1] > 0 ? stats->nbMoves[1] : 1);
+        printf("  CPU per move : %s %.1f ms, %s %.1f ms, ratio %.2f\n",
+            baseline->name, baselineCost * 1000.0, t->configs[c].name, candidateCost * 1000.0,
+            (baselineCost > 0) ? candidateCost / baselineCost : 0.0);
+    }
+    fflush(stdout);
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+// Worker threads
+
+void* gamesLoop(void* arg) {
+    // Game 2k and 2k+1 share a fish layout with colours swapped
+    tournament* t = (tournament*) arg;
+    int nbCandidates = t->nbConfigs - 1;
+
+    while (true) {
+        int game = atomic_fetch_add(&t->nextGame, 1);
+        if (game >= t->nbGames) {
+            break;
+        }
+        int pair = game / 2;
+        int candidate = 1 + pair % nbCandidates;
+        unsigned int seed = t->seed + pair / nbCandidates;
+        bool candidateIsP1 = (game % 2 == 0);
+
+        pthread_mutex_lock(&t->mutex);
+        bool isDecided = t->stats[candidate].isDecided;
+        pthread_mutex_unlock(&t->mutex);
+        if (isDecided) {
+            continue;
+        }
+
+        engineConfig* p1Config = candidateIsP1 ? &t->configs[candidate] : &t->configs[0];
+        engineConfig* p2Config = candidateIsP1 ? &t->configs[0] : &t->configs[candidate];
+        gameResult result = playGame(t->enginePath, p1Config, p2Config, seed);
+
+        // An illegal move loses the game
+        int candidateScore = candidateIsP1 ? result.p1Score : result.p2Score;
+        int baselineScore = candidateIsP1 ? result.p2Score : result.p1Score;
+        if (result.forfeit != 0) {
+            bool candidateForfeits = (result.forfeit == 4) == candidateIsP1;
+            candidateScore = candidateForfeits ? -1 : 1;
+            baselineScore = 0;
+        }
+        int candidateSide = candidateIsP1 ? 0 : 1;
+
+        pthread_mutex_lock(&t->mutex);
+        matchStats* stats = &t->stats[candidate];
+        if (candidateScore > baselineScore) {
+            stats->wins += 1;
+        } else if (candidateScore == baselineScore) {
+            stats->draws += 1;
+        } else {
+            stats->losses += 1;
+        }
+        stats->cpuTime[1] += result.cpuTime[candidateSide];
+        stats->cpuTime[0] += result.cpuTime[1 - candidateSide];
+        stats->nbMoves[1] += result.nbMoves[candidateSide];
+        stats->nbMoves[0] += result.nbMoves[1 - candidateSide];
+
+        double llr = logLikelihoodRatio(stats, t->elo0, t->elo1);
+        if (llr >= log((1.0 - t->beta) / t->alpha) || llr <= log(t->beta / (1.0 - t->alpha))) {
+            stats->isDecided = true;
+        }
+
+        t->nbFinishedGames += 1;
+        if (t->nbFinishedGames % 10 == 0) {
+            printStandings(t);
+        }
+        pthread_mutex_unlock(&t->mutex);
+    }
+
+    return NULL;
+}
+
+
+int main(int argc, char** argv) {
+
+    tournament t = {0};
+    t.enginePath = "./penguins-engine";
+    t.nbGames = 1000;
+    t.seed = 1;
+    t.elo0 = 0.0;
+    t.elo1 = 10.0;
+    t.alpha = 0.05;
+    t.beta = 0.05;
+    int concurrency = 0;
+
+    int option;
+    while ((option = getopt(argc, argv, "g:j:e:s:0:1:a:b:")) != -1) {
+        switch (option) {
+            case 'g': t.nbGames = atoi(optarg); break;
+            case 'j': concurrency = atoi(optarg); break;
+            case 'e': t.enginePath = optarg; break;
+            case 's': t.seed = (unsigned int) strtoul(optarg, NULL, 10); break;
+            case '0': t.elo0 = atof(optarg); break;
+            case '1': t.elo1 = atof(optarg); break;
+            case 'a': t.alpha = atof(optarg); break;
+            case 'b': t.beta = atof(optarg); break;
+            default:
+                fprintf(stderr, "Usage : %s [-g games] [-j concurrency] [-e engine] [-s seed] "
+                    "[-0 elo0] [-1 elo1] [-a alpha] [-b beta] baseline candidate...\n", argv[0]);
+                return 1;
+        }
+    }
+
+    for (int i = optind; i < argc && t.nbConfigs < MAX_CONFIGS; i++) {
+        if (!parseConfig(argv[i], &t.configs[t.nbConfigs])) {
+            fprintf(stderr, "Invalid configuration %s\n", argv[i]);
+            return 1;
+        }
+        t.nbConfigs++;
+    }
+    if (t.nbConfigs < 2) {
+        fprintf(stderr, "At least a baseline and a candidate configuration are needed\n");
+        return 1;
+    }
+
+    // By default every core is busy, without oversubscription
+    if (concurrency <= 0) {
+        int maxThreads = 1;
+        for (int c = 0; c < t.nbConfigs; c++) {
+            if (t.configs[c].threads > maxThreads) {
+                maxThreads = t.configs[c].threads;
+            }
+        }
+        long nbCores = sysconf(_SC_NPROCESSORS_ONLN);
+        concurrency = (nbCores > maxThreads) ? nbCores / maxThreads : 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    pthread_mutex_init(&t.mutex, NULL);
+    atomic_init(&t.nextGame, 0);
+
+    pthread_t* workers = malloc(concurrency * sizeof(pthread_t));
+    for (int i = 0; i < concurrency; i++) {
+        pthread_create(&workers[i], NULL, gamesLoop, &t);
+    }
+    for (int i = 0; i < concurrency; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+
+    printStandings(&t);
+    pthread_mutex_destroy(&t.mutex);
+
+    return 0;
+}